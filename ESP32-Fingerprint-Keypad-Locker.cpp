@@ -1,45 +1,175 @@
 #include <Arduino.h>
+#include <inttypes.h>
 #include <Adafruit_Fingerprint.h>
-#include <SimpleKeypad.h>
 #include <Wire.h>
 #include <LCD_I2C.h>
 #include <EEPROM.h>
 #include "esp_sleep.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
 #include "driver/rtc_io.h"
+#include "soc/rtc.h"
+#include "esp32/clk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "EventScheduler.h"
+#include "FingerprintLink.h"
+#include "MatrixKeypad.h"
+#include "LcdFrameBuffer.h"
+#include "PersistentBlock.h"
+#include "UlpKeypadMonitor.h"
+#include "TemplateIndex.h"
+#include "MatchStats.h"
+#include "TemplateTransfer.h"
+#include "SerialConsole.h"
+#include "LatencyHistogram.h"
+#include "PinCredential.h"
+#include "ToneSequencer.h"
+#include "RelayController.h"
+#include "UserTable.h"
+#include "AccessLog.h"
+#include "StaticStorage.h"
+#include "BoardProfile.h"
+#ifdef LOCKER_BENCHMARK
+#include "SampleSet.h"
+#endif
+#ifdef LOCKER_NETWORK
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include <HTTPClient.h>
+#include <esp_ota_ops.h>
+#include "RemoteCommand.h"
+#include "OtaUpdate.h"
+#endif
 
 #define CONFIG_ESP_SYSTEM_PM_POWER_DOWN_CPU 1
 
-struct PinConfig {
-    static constexpr uint8_t RELAY = 13;
+// Hardware revisions. Pick one with -DLOCKER_BOARD_<name> (see platformio.ini);
+// everything sized by the keypad or the LCD follows from the profile.
+
+// The original build: 4x3 keypad, 16x2 LCD
+struct Keypad4x3Lcd1602 {
+    static constexpr uint8_t KEYPAD_ROWS = 4;
+    static constexpr uint8_t KEYPAD_COLS = 3;
+    static constexpr uint8_t ROW_PINS[KEYPAD_ROWS] = {32, 33, 25, 26};
+    static constexpr uint8_t COL_PINS[KEYPAD_COLS] = {27, 14, 12};
+    static constexpr char KEYS[KEYPAD_ROWS * KEYPAD_COLS] = {'1','2','3','4','5','6','7','8','9','*','0','#'};
+    static constexpr uint8_t LCD_COLS = 16;
+    static constexpr uint8_t LCD_ROWS = 2;
+    static constexpr uint8_t LCD_I2C_ADDR = 0x27;
     static constexpr uint8_t FP_RX = 16;
     static constexpr uint8_t FP_TX = 17;
+    static constexpr uint32_t FP_BAUD_RATE = 57600;
+    static constexpr uint32_t FP_FAST_BAUD_RATE = 115200;
+};
+
+// 4x4 keypad: the extra column on GPIO15, A-D in the right-hand column
+struct Keypad4x4Lcd1602 : Keypad4x3Lcd1602 {
+    static constexpr uint8_t KEYPAD_COLS = 4;
+    static constexpr uint8_t COL_PINS[KEYPAD_COLS] = {27, 14, 12, 15};
+    static constexpr char KEYS[KEYPAD_ROWS * KEYPAD_COLS] = {'1','2','3','A','4','5','6','B',
+                                                             '7','8','9','C','*','0','#','D'};
+};
+
+// 4x4 keypad with a 20x4 LCD on a PCF8574A backpack; the sensor sits on a
+// long lead and stays at its factory rate
+struct Keypad4x4Lcd2004 : Keypad4x4Lcd1602 {
+    static constexpr uint8_t LCD_COLS = 20;
+    static constexpr uint8_t LCD_ROWS = 4;
+    static constexpr uint8_t LCD_I2C_ADDR = 0x3F;
+    static constexpr uint32_t FP_FAST_BAUD_RATE = 57600;
+};
+
+// Define the static constexpr members
+constexpr uint8_t Keypad4x3Lcd1602::ROW_PINS[];
+constexpr uint8_t Keypad4x3Lcd1602::COL_PINS[];
+constexpr char Keypad4x3Lcd1602::KEYS[];
+constexpr uint8_t Keypad4x4Lcd1602::COL_PINS[];
+constexpr char Keypad4x4Lcd1602::KEYS[];
+
+#if defined(LOCKER_BOARD_KEYPAD4X4_LCD2004)
+using Board = BoardTraits<Keypad4x4Lcd2004>;
+#elif defined(LOCKER_BOARD_KEYPAD4X4)
+using Board = BoardTraits<Keypad4x4Lcd1602>;
+#else
+using Board = BoardTraits<Keypad4x3Lcd1602>;
+#endif
+
+struct PinConfig {
+    static constexpr uint8_t RELAY = 13;
+    static constexpr int8_t DOOR_SENSOR = -1;       // Door contact input; -1 when none is fitted
+    static constexpr uint8_t DOOR_OPEN_LEVEL = HIGH;  // Contact level with the door open
+    static constexpr uint8_t FP_RX = Board::FP_RX;
+    static constexpr uint8_t FP_TX = Board::FP_TX;
     static constexpr uint8_t BUZZER = 4;  // Using GPIO 32 for buzzer
-    static constexpr uint8_t I2C_ADDR = 0x27;
+    static constexpr uint8_t I2C_ADDR = Board::LCD_I2C_ADDR;
     static constexpr uint8_t BUZZER_CHANNEL = 0;  // LEDC channel for buzzer
     static constexpr uint8_t BUZZER_RESOLUTION = 8;  // 8-bit resolution
     static constexpr uint32_t BUZZER_BASE_FREQ = 2000;  // Base frequency in Hz
-    static constexpr uint8_t WAKE_PIN = 23;  // External wake-up pin
-    static constexpr uint64_t KEYPAD_WAKE_PINS = ((1ULL << 32) | (1ULL << 33) | (1ULL << 25) | (1ULL << 26) | 
-                                                 (1ULL << 27) | (1ULL << 14) | (1ULL << 12));  // Keypad pins for wake-up
+    static constexpr uint8_t WAKE_PIN = 36;  // Sensor touch output; an RTC GPIO, with an external pull-down
+    static constexpr uint64_t KEYPAD_WAKE_PINS = Board::KEYPAD_WAKE_PINS;  // Keypad pins for wake-up
+    static constexpr uint64_t KEYPAD_ROW_PINS = Board::KEYPAD_ROW_MASK;    // EXT1 fallback wakes on these
 };
+static_assert((board::RTC_GPIOS >> PinConfig::WAKE_PIN) & 1, "the touch line must be an RTC GPIO to wake from deep sleep");
 
 struct Config {
     // System constants
-    static constexpr uint32_t UART_BAUD_RATE = 57600;
-    static constexpr uint16_t EEPROM_SIZE = 32;
+    static constexpr uint32_t UART_BAUD_RATE = Board::FP_BAUD_RATE;
+    static constexpr uint32_t FP_FAST_BAUD_RATE = Board::FP_FAST_BAUD_RATE;  // Raised at init; the sensor keeps the setting
+    static constexpr bool FP_RAISE_BAUD = FP_FAST_BAUD_RATE > UART_BAUD_RATE;
+    static constexpr uint16_t EEPROM_SIZE = 32;               // Legacy layout, read once to migrate
+    static constexpr uint16_t SETTINGS_VERSION = 4;           // Bump when Settings changes layout
+    static constexpr uint32_t SETTINGS_COMMIT_DELAY = 2000;   // Quiet time before changes hit flash
     
     // Timing constants (ms)
     static constexpr unsigned long INACTIVITY_TIME = 8000;    // Screen timeout
     static constexpr uint16_t FINGERPRINT_TIMEOUT_MS = 10000; // Fingerprint operation timeout
     static constexpr unsigned long UNLOCK_TIME = 3000;        // Door unlock duration in ms
+    static constexpr bool RELAY_EXTEND_ON_REGRANT = true;     // Access while open restarts UNLOCK_TIME
+    static constexpr bool RELOCK_ON_CLOSE = true;             // Door sensor only: relock once opened and shut
+    static constexpr uint16_t DOOR_POLL_INTERVAL = 20;        // Door contact sample period in ms
     static constexpr unsigned long LOCKOUT_TIME = 30000;      // Lockout duration in ms
+    static constexpr uint32_t MENU_IDLE_TIMEOUT = 30000;      // An open menu closes after this long without a key
+    static constexpr uint16_t FP_POLL_INTERVAL = 100;         // Sensor poll period in ms
+    static constexpr uint16_t FP_REPLY_TIMEOUT = 1500;        // Longest wait for one sensor reply (full search)
+    static constexpr bool FP_TOUCH_INTERRUPT = true;          // Sensor touch output wired to WAKE_PIN; false = poll only
+    static constexpr uint16_t FP_MAX_TEMPLATES = 1000;        // Largest library the template index can describe
+    static constexpr uint16_t FP_INDEX_VERSION = 1;
+    static constexpr uint8_t FP_SECURITY_LEVEL = 4;           // Until set with fp-level: 1 most lenient .. 5 strictest
+    static constexpr uint8_t FP_CAPTURE_RETRIES = 2;          // Silent re-captures per touch after a poor image
+    static constexpr uint8_t FP_STATS_USERS = 32;             // Users whose match confidence is tracked
+    static constexpr uint16_t FP_STATS_VERSION = 1;
+    static constexpr uint16_t USER_SLOTS = 512;               // User table hash slots; holds up to half as many users
+    static constexpr uint16_t USER_TABLE_VERSION = 1;
+    static constexpr uint16_t LOG_RAM_RECORDS = 64;           // Access events held before they reach flash
+    static constexpr uint32_t LOG_FLUSH_DELAY = 30000;        // Longest a part-filled page waits for the rest
+    static constexpr uint8_t LOG_EXPORT_BURST = 8;            // Records printed per loop pass while exporting
+    static constexpr uint32_t FP_INDEX_COMMIT_DELAY = 60000;  // Match statistics are cheap to lose; batch their writes
+    static constexpr uint32_t TRANSFER_IDLE_TIMEOUT = 10000;  // Template transfer session ends after this long without a frame
+    static constexpr uint32_t CONSOLE_SESSION_TIME = 300000;  // Console login lapses after this long without a command
+    static constexpr uint8_t CONSOLE_MAX_FAILURES = 3;        // Bad logins before the console locks out for LOCKOUT_TIME
+    static constexpr uint32_t KEYPAD_ROW_PERIOD_US = 1000;    // One row per timer tick: 4 ms per matrix pass
+    static constexpr uint8_t KEYPAD_DEBOUNCE_SCANS = 5;       // Passes a key must hold steady (20 ms)
+    static constexpr uint8_t KEYPAD_TIMER = 0;                // Hardware timer driving the scan
+    static constexpr uint16_t KEYPAD_PARK_AFTER = 1000;       // Stop scanning after this long with no key
+    static constexpr bool ULP_KEYPAD = true;                  // ULP watches the keypad in deep sleep; false = EXT1 level wake
+    static constexpr uint32_t ULP_SAMPLE_PERIOD_US = 10000;   // ULP matrix sample period
+    static constexpr uint8_t ULP_DEBOUNCE_SAMPLES = 2;        // Extra identical samples before a key counts (20-30 ms)
+
+    // Power governor: full clock while in use, DFS plus light sleep when idle,
+    // deep sleep after INACTIVITY_TIME
+    static constexpr uint32_t POWER_ACTIVE_HOLD = 3000;       // Full clock this long after the last input
+    static constexpr int POWER_MIN_MHZ = 80;                  // DFS floor; APB (UART, timers) stays at 80 MHz
+    static constexpr uint32_t IDLE_LOOP_INTERVAL = 1000;      // Loop wake-up period once idle
     
     // Security parameters
     static constexpr uint8_t PIN_LENGTH = 6;
+    static constexpr uint16_t PIN_HASH_ROUNDS = 2048;        // SHA-256 stretch applied to every PIN check
     static constexpr uint8_t STAR_THRESHOLD = 12;
     static constexpr uint8_t AUTH_MODE_ADDR = 10;
     static constexpr uint8_t MAX_WRONG_ATTEMPTS = 5;         // Maximum wrong attempts before lockout
-    static constexpr char DEFAULT_PIN[7] = "123456";  // More secure default
+    static constexpr char DEFAULT_PIN[PIN_LENGTH + 1] = "123456";
     
     enum AuthMode {
         SINGLE_FACTOR = 0,
@@ -48,11 +178,111 @@ struct Config {
 };
 
 // Define the static constexpr member
-constexpr char Config::DEFAULT_PIN[7];
+constexpr char Config::DEFAULT_PIN[Config::PIN_LENGTH + 1];
+
+// Task layout: sensor I/O runs on core 0 so a UART match round trip never
+// stalls keypad scanning; UI and the auth loop share core 1. The network
+// build's task also sits on core 0, below the sensor, beside the Wi-Fi stack.
+// The relay and buzzer run off esp_timer callbacks and need no task of their own.
+struct TaskConfig {
+    static constexpr uint32_t FP_STACK = 4096;
+    static constexpr uint32_t KEYPAD_STACK = 2048;
+    static constexpr uint32_t DISPLAY_STACK = 3072;
+    static constexpr uint32_t NET_STACK = 8192;          // HTTP and the ECDSA check for updates
+    static constexpr UBaseType_t FP_PRIORITY = 2;
+    static constexpr UBaseType_t KEYPAD_PRIORITY = 3;
+    static constexpr UBaseType_t DISPLAY_PRIORITY = 1;
+    static constexpr UBaseType_t NET_PRIORITY = 1;
+    static constexpr BaseType_t SENSOR_CORE = 0;
+    static constexpr BaseType_t UI_CORE = 1;
+    static constexpr UBaseType_t INPUT_QUEUE_LEN = 16;
+    static constexpr UBaseType_t DISPLAY_QUEUE_LEN = 8;
+    static constexpr UBaseType_t FP_COMMAND_QUEUE_LEN = 4;
+    static constexpr UBaseType_t NET_QUEUE_LEN = 32;
+};
+
+// Power-management lock that callers simply restate on every pass. A no-op
+// when power management is unavailable and the lock was never created.
+struct PowerLock {
+    esp_pm_lock_handle_t handle = nullptr;
+    bool held = false;
+
+    void create(esp_pm_lock_type_t type, const char *name) {
+        if (esp_pm_lock_create(type, 0, name, &handle) != ESP_OK) handle = nullptr;
+    }
+
+    void hold(bool want) {
+        if (!handle || want == held) return;
+        want ? esp_pm_lock_acquire(handle) : esp_pm_lock_release(handle);
+        held = want;
+    }
+};
+
+// Each task keeps the chip out of light sleep only while it needs clocks running
+PowerLock cpu_power;        // Loop task: full CPU clock while the lock is in use
+PowerLock keypad_power;     // Matrix scan timer running
+PowerLock fp_power;         // UART exchange in flight or a poll due
+PowerLock display_power;    // I2C traffic queued
+PowerLock buzzer_power;     // Tone playing (LEDC stops in light sleep); taken by the sequencer
+
+// Where the time goes on the unlock path, one histogram per stage. esp_timer
+// rather than the cycle counter: CCOUNT rate follows the DFS clock.
+enum PerfStage : uint8_t {
+    PERF_TOUCH_TO_IMAGE,   // Touch edge to a usable image (includes retries)
+    PERF_EXTRACT,          // Img2Tz round trip
+    PERF_SEARCH,           // Both search passes
+    PERF_DECISION,         // Search result posted to the loop's verdict
+    PERF_PIN_CHECK,        // checkPassword()
+    PERF_DISPLAY,          // Display command posted to cells on the glass
+    PERF_RELAY,            // Grant to the relay driven
+    PERF_STAGE_COUNT
+};
+const char *const perf_names[PERF_STAGE_COUNT] = {
+    "touch>image", "extract", "search", "decision", "pin-check", "display", "relay"
+};
+LatencyHistogram perf[PERF_STAGE_COUNT];  // Each stage is recorded by one task only
+
+// Also read in onFingerTouch: always inlined, so the ISR never calls into flash
+inline __attribute__((always_inline)) uint32_t perfNow() {
+    return static_cast<uint32_t>(esp_timer_get_time());
+}
+
+inline void perfRecord(PerfStage stage, uint32_t sinceUs) {
+    perf[stage].record(perfNow() - sinceUs);
+}
+
+// Records the enclosing scope
+struct PerfScope {
+    PerfStage stage;
+    uint32_t start;
+    bool active;
+    explicit PerfScope(PerfStage stage, uint32_t start = perfNow(), bool active = true)
+        : stage(stage), start(start), active(active) {}
+    ~PerfScope() {
+        if (active) perfRecord(stage, start);
+    }
+};
 
-LCD_I2C lcd(PinConfig::I2C_ADDR, 16, 2);
+LCD_I2C lcd(PinConfig::I2C_ADDR, Board::LCD_COLS, Board::LCD_ROWS);
+LcdFrameBuffer<LCD_I2C, Board::LCD_COLS, Board::LCD_ROWS> screen(lcd);  // Display task draws here; update() sends only changed cells
+RTC_DATA_ATTR LcdGlyphCache lcd_glyphs;      // CGRAM survives deep sleep along with the LCD's power
+
+// The LCD and sensor stay powered through deep sleep and keep their
+// configuration, so a wake can skip setting them up again. Zeroed at power-up.
+struct WarmBootState {
+    bool valid;               // A cold boot has configured everything once
+    bool fp_ready;            // Sensor answered and was configured
+    uint32_t fp_baud;         // Rate the sensor talks at
+    uint16_t fp_capacity;
+    uint16_t fp_packet_len;   // Data packet size, for template transfers
+    uint32_t wakes;           // Deep-sleep wakes since power-up
+};
+RTC_DATA_ATTR WarmBootState warm_boot;
+bool warm_start = false;           // This boot is a deep-sleep wake with warm_boot valid
+bool wake_capture_pending = false; // The touch line woke us: time the first capture
 HardwareSerial fingerprintSerial(2);
 Adafruit_Fingerprint finger(&fingerprintSerial);
+FingerprintLink fp_link;  // Non-blocking match pipeline on the same UART
 
 // Custom characters
 byte lockChar[8] = {0b01110,0b10001,0b10001,0b11111,0b11011,0b11011,0b11111,0b00000};
@@ -66,64 +296,321 @@ byte emptyCircle[8] = {0b00000,0b01110,0b10001,0b10001,0b10001,0b10001,0b01110,0
 byte filledCircle[8] = {0b00000,0b01110,0b11111,0b11111,0b11111,0b11111,0b01110,0b00000}; // Filled circle
 
 // Keypad setup
-const byte ROWS = 4, COLS = 3;
-char keys[ROWS * COLS] = {'1','2','3','4','5','6','7','8','9','*','0','#'};
-byte rowPins[ROWS] = {32,33,25,26}, colPins[COLS] = {27,14,12};
-SimpleKeypad keypad(keys, rowPins, colPins, ROWS, COLS);
+const byte ROWS = Board::KEYPAD_ROWS, COLS = Board::KEYPAD_COLS;
+const char (&keys)[ROWS * COLS] = Board::KEYS;
+const byte (&rowPins)[ROWS] = Board::ROW_PINS, (&colPins)[COLS] = Board::COL_PINS;
 
 // Add scanning delay configuration
-const unsigned long KEY_SCAN_INTERVAL = 50; // 50ms between scans
+const unsigned long KEY_SCAN_INTERVAL = 50; // Longest idle wait of the loop task
+
+MatrixKeypad<ROWS, COLS, Config::KEYPAD_DEBOUNCE_SCANS> matrix_keypad;
+uint32_t wake_key_held = 0;  // Matrix bit of the key that woke us, already reported
+#ifdef LOCKER_BENCHMARK
+SampleSet<256> bench_scan_cycles;  // CPU cycles per scan tick, filled by the timer ISR
+void benchmarkPeripherals();
+void benchmarkAfterBoot();
+#endif
+UlpKeypadMonitor<ROWS, COLS> ulp_keypad;
+uint8_t wake_keys[UlpKeypadMonitor<ROWS, COLS>::BUFFER_LEN];  // Typed before the main core was up
+uint8_t wake_key_count = 0;
+
+// Events reported to the loop task, which owns all authentication state
+struct InputEvent {
+    enum Type : uint8_t {
+        KEY,             // key went down
+        FINGER_DOWN,     // A finger landed on the sensor
+        FP_MATCH,        // id/confidence of the matched template
+        FP_NO_MATCH,
+        FP_IMAGE_ERROR,
+        FP_ENROLL_DONE,  // status holds an EnrollResult
+        FP_DELETE_DONE,  // status holds the sensor's confirmation code
+        FP_TRANSFER_DONE,// id holds the number of templates moved; fp_transfer_pages is back
+        DOOR,            // status holds a RelayController::Event
+        REMOTE           // Verified network command: status the action, id its argument
+    };
+    Type type;
+    char key;
+    uint8_t status;
+    uint16_t id;
+    uint16_t confidence;
+    uint32_t stamp_us;   // perfNow() when posted
+};
+
+// Fixed-size text buffers: the UI and auth paths never allocate
+using LineBuffer = char[Board::LCD_COLS + 1];     // One LCD line plus terminator
+using PinBuffer = char[Config::PIN_LENGTH + 1];
+using PinHash = PinCredential<PinPolicy<Config::PIN_LENGTH, Config::PIN_HASH_ROUNDS>>;
+using Users = UserTable<PinHash, Config::USER_SLOTS, Config::FP_MAX_TEMPLATES>;
+static_assert(Config::PIN_LENGTH <= Board::LCD_COLS - 4, "PIN entry draws one circle per digit from column 4");
+static_assert(Board::LCD_COLS >= 16 && Board::LCD_ROWS >= 2, "screens are laid out for at least 16x2");  // Drawn on the top two rows
+static_assert(Config::DEFAULT_PIN[Config::PIN_LENGTH - 1] != '\0', "DEFAULT_PIN needs PIN_LENGTH digits");
+
+// Render requests for the display task, the only code that talks to the LCD
+struct DisplayCommand {
+    enum Type : uint8_t {
+        MESSAGE,    // line1/line2 as text
+        READY,      // Ready screen: glyph plus optional 2FA progress
+        PIN_ENTRY,  // line1 prompt, count digits (line2 shown when not masked)
+        UNLOCKED,   // Unlock glyph in the top-right corner
+        BACKLIGHT,  // on
+        SLEEP       // Backlight and display off before deep sleep
+    };
+    Type type;
+    LineBuffer line1;
+    LineBuffer line2;
+    uint8_t glyph;
+    uint8_t count;
+    bool masked;
+    bool two_factor;
+    bool pin_done;
+    bool fp_done;
+    bool on;
+    uint32_t stamp_us;
+};
+
+struct FingerprintCommand {
+    enum Type : uint8_t { SET_MODE, ENROLL, DELETE, TRANSFER, SET_LEVEL };  // SET_LEVEL: id holds the level
+    enum Mode : uint8_t {
+        MATCH,        // Capture, extract and search on every touch
+        DETECT_ONLY   // Report touches only (lockout, modal menus)
+    };
+    Type type;
+    Mode mode;
+    uint16_t id;
+};
+
+enum EnrollResult : uint8_t {
+    ENROLL_OK,
+    ENROLL_IMAGE_ERROR,
+    ENROLL_TIMEOUT,
+    ENROLL_MODEL_FAILED,
+    ENROLL_STORE_FAILED
+};
+
+using FingerprintIndex = TemplateIndex<Config::FP_MAX_TEMPLATES, 16>;
+using EventLog = AccessLog<Config::LOG_RAM_RECORDS>;
+
+QueueHandle_t input_queue;
+QueueHandle_t display_queue;
+QueueHandle_t fp_command_queue;
+QueueHandle_t fp_plan_queue;         // Mailbox: the latest search plan, overwritten by the loop task
+TaskHandle_t fingerprint_task;
+TaskHandle_t keypad_task;
+TaskHandle_t display_task;
+#ifdef LOCKER_NETWORK
+QueueHandle_t net_queue = nullptr;
+TaskHandle_t net_task = nullptr;
+#endif
+
+// Queue and stack memory is static, so the footprint is fixed at link time;
+// what the heap serves is the core, the drivers and (network build) the radio
+QueueStorage<InputEvent, TaskConfig::INPUT_QUEUE_LEN> input_queue_storage;
+QueueStorage<DisplayCommand, TaskConfig::DISPLAY_QUEUE_LEN> display_queue_storage;
+QueueStorage<FingerprintCommand, TaskConfig::FP_COMMAND_QUEUE_LEN> fp_command_queue_storage;
+QueueStorage<FingerprintIndex::Plan, 1> fp_plan_queue_storage;
+TaskStorage<TaskConfig::FP_STACK> fingerprint_task_storage;
+TaskStorage<TaskConfig::KEYPAD_STACK> keypad_task_storage;
+TaskStorage<TaskConfig::DISPLAY_STACK> display_task_storage;
+#ifdef LOCKER_NETWORK
+QueueStorage<EventLog::Record, TaskConfig::NET_QUEUE_LEN> net_queue_storage;
+TaskStorage<TaskConfig::NET_STACK> net_task_storage;
+#endif
+
+// Persistent settings, loaded once at boot. Owned by the loop task.
+struct Settings {
+    uint8_t auth_mode;                  // Config::AuthMode
+    uint8_t fp_security_level;          // Applied to the sensor at every cold start
+};
+PersistentBlock<Settings> settings;
+
+// PINs, roles and who owns each template, read in place from the "users"
+// partition. Owned by the loop task.
+Users users;
+
+// Who got in, who was turned away and when; held in RAM and written to the
+// "events" partition a page at a time. Owned by the loop task.
+EventLog access_log;
+uint32_t log_export_next = 0;      // Next record the console export prints
+uint32_t log_export_end = 0;       // Export finished once log_export_next reaches it
+
+// Version 3 had no sensor security level
+struct SettingsV3 {
+    uint8_t auth_mode;
+};
+
+// Version 2 held the one PIN hash, which becomes the first admin
+struct SettingsV2 {
+    PinHash::Record pin;
+    uint8_t auth_mode;
+};
+
+// Version 1 kept the PIN in the clear; read once to migrate
+struct SettingsV1 {
+    char pin[7];
+    uint8_t auth_mode;
+};
 
-// State variables using fixed buffer for better memory management
-char input_password[Config::PIN_LENGTH + 1];  // +1 for null terminator
-uint8_t input_length = 0;
-int wrong_attempts = 0;
+// The PIN being typed at the keypad; digits go into its hash as they arrive
+PinHash::Entry pin_entry;
 unsigned long last_activity = 0;
 int star_count = 0;
 int hash_count = 0;  // Counter for # presses
 
-// Memory management globals
-static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
-
-// Add these state variables after other globals
-bool pin_verified = false;
-bool fingerprint_verified = false;
-uint8_t verified_fingerprint_id = 0;
-
-// Add after other state variables
-int wrong_pin_attempts = 0;
-int wrong_fp_attempts = 0;
-unsigned long pin_lockout_start = 0;
-unsigned long fp_lockout_start = 0;
-bool is_pin_locked_out = false;
-bool is_fp_locked_out = false;
+// Authentication state. Owned by the loop task: the sensor and keypad tasks
+// only report events, so nothing here needs a critical section. Kept in RTC
+// memory so strikes and lockouts survive deep sleep; the lockout start times
+// are on the rtcMillis() base, which keeps counting while the CPU is off.
+struct AuthState {
+    bool pin_verified = false;
+    bool fingerprint_verified = false;
+    uint16_t verified_fingerprint_id = 0;
+    uint16_t pin_user = 0;              // Whose PIN was verified, waiting for their finger
+    uint16_t verified_confidence = 0;   // Sensor score for verified_fingerprint_id
+    uint16_t pin_lockouts = 0;          // Since power-up, for the health report
+    uint16_t fp_lockouts = 0;
+    int wrong_pin_attempts = 0;
+    int wrong_fp_attempts = 0;
+    uint32_t pin_lockout_start = 0;
+    uint32_t fp_lockout_start = 0;
+    bool is_pin_locked_out = false;
+    bool is_fp_locked_out = false;
+};
+RTC_DATA_ATTR AuthState auth;
+
+// Cooperative timer queue for the loop task: message holds, lockout expiry and
+// the deep-sleep notice are scheduled here so loop() never blocks on a delay()
+EventScheduler<12> scheduler;
+TimerHandle ready_screen_timer = NO_TIMER;
+TimerHandle pin_lockout_timer = NO_TIMER;
+TimerHandle fp_lockout_timer = NO_TIMER;
+TimerHandle sleep_timer = NO_TIMER;
+bool ready_screen_active = false;  // Ready screen is what's currently on the LCD
+bool backlight_on = true;
+bool menu_active = false;          // Admin menu or PIN change flow owns the keypad
+
+// Where the menu is; see menu_screens for what each state shows and accepts
+enum MenuState : uint8_t {
+    MENU_CLOSED,
+    MENU_ADMIN_PIN,    // PIN before the admin menu (12 presses of '#')
+    MENU_MAIN,
+    MENU_FP,
+    MENU_ENROLL_ID,
+    MENU_ENROLL_OWNER, // User the new template belongs to
+    MENU_ENROLL_WAIT,  // Fingerprint task enrolling
+    MENU_DELETE_ID,
+    MENU_DELETE_WAIT,
+    MENU_PIN_CURRENT,  // PIN change (STAR_THRESHOLD presses of '*')
+    MENU_PIN_NEW,
+    MENU_PIN_CONFIRM,
+    MENU_STATE_COUNT
+};
+MenuState menu_state = MENU_CLOSED;
+TimerHandle menu_timer = NO_TIMER;
+PinBuffer menu_input;              // What an entry screen has typed so far
+uint8_t menu_input_length = 0;
+PinBuffer menu_new_pin;            // Carried from the new PIN to the confirm screen
+uint16_t menu_id = 0;              // Template being enrolled or deleted
+uint16_t menu_user = 0;            // Who proved their PIN to open the menu
+uint16_t menu_owner = 0;           // User the template being enrolled goes to
+
+// Lock relay and buzzer, both driven from esp_timer callbacks
+RelayController relay;
+ToneSequencer tones;
+
+// Fingerprint task state
+FingerprintCommand::Mode fp_mode = FingerprintCommand::MATCH;
+bool fp_await_lift = false;        // Finger must leave the sensor before the next capture
+uint32_t fp_next_capture = 0;      // Earliest millis() for the next capture attempt
+uint16_t fp_capacity = 0xA3;       // Library size searched; replaced by the sensor's own figure
+uint16_t fp_packet_len = 128;      // Sensor data packet size; replaced by the sensor's own figure
+volatile bool serial_transfer = false;  // Fingerprint task owns Serial for a binary template session
+SerialConsole console;             // Line commands on Serial, polled by the loop task
+uint16_t console_user = 0;         // Admin logged in on the console
+uint16_t console_enroll_owner = 0; // User a console enrollment goes to
+
+// Which pages hold templates and which IDs match most, so a search can start
+// with the regulars and stop at the last enrollment. Owned by the loop task,
+// which applies what the fingerprint task reports and hands it back only the
+// plan, through fp_plan_queue.
+PersistentBlock<FingerprintIndex> fp_index;
+FingerprintIndex::Plan fp_plan;    // Searches for the capture in flight
+
+// Occupied pages, lent to the fingerprint task with a TRANSFER command and
+// returned with FP_TRANSFER_DONE: what a backup visits, and what a restore filled
+struct TemplatePages {
+    bool known;                    // false: visit every page
+    uint8_t enrolled[sizeof(FingerprintIndex::enrolled)];
+} fp_transfer_pages;
+uint8_t fp_retries = 0;            // Silent re-captures spent on the touch in flight
+
+// Where touches are lost and how well each user matches, for tuning the
+// security level. Owned by the loop task.
+using FingerprintStats = MatchStats<Config::FP_STATS_USERS>;
+PersistentBlock<FingerprintStats> fp_stats;
+uint32_t fp_stage_us = 0;           // Start of the pipeline stage in flight
+volatile uint32_t fp_touch_us = 0; // Touch edge not yet turned into an image; 0 = none
 
 // Function declarations
 void showReadyScreen();
-void IRAM_ATTR unlockDoor();
-void displayMessage(String line1, String line2, int delayTime = 0);
-void IRAM_ATTR checkPassword();
-void enrollFingerprint();
-void deleteFingerprint();
-String getInput(String prompt, char confirmKey, char clearKey, bool maskInput = true);
+void unlockDoor();
+void displayMessage(const char *line1, const char *line2, int holdTime = 0);
+const char *formatLine(LineBuffer &line, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void checkPassword();
+void pinStrike(uint16_t user);
 void setupPins();
 void setupLCD();
 void setupFingerprintSensor();
-void IRAM_ATTR handleFingerprint();
-void IRAM_ATTR handleKeypad();
+void publishSearchPlan();
+void updateTemplateIndex(const InputEvent &event);
+void startTasks();
+int8_t decodeWakeKey(uint64_t rowMask);
+void postInput(const InputEvent &event);
+void setupPowerManagement();
+void handleFingerprint(const InputEvent &event);
+void handleKeypad(char key);
 void handleInactivity();
 void displayMaskedInput();
-void setPassword(const String &newPassword);
-String getPassword();
-void changePassword();
-bool getFingerprintEnroll(uint8_t id);
-uint8_t getFingerprintID();
+void loadSettings();
+const Users::User *enabledUser(const char *pin);
+const char *userResultName(Users::Result result);
+EnrollResult getFingerprintEnroll(uint16_t id);
+bool onFingerprintStage(const FingerprintLink::Reply &reply);
 bool initFingerprint();
-void playTone(const uint16_t freq, const uint32_t dur);
-void noTone();
 void setAuthMode(Config::AuthMode mode);
 Config::AuthMode getAuthMode();
+uint8_t fpSecurityLevel();
 void soundBuzzer(int pattern);
+void onRelayEvent(RelayController::Event event);
+void handleDoor(RelayController::Event event);
+void onLockoutExpired();
+uint32_t rtcMillis();
+uint32_t rtcSeconds();
+void logEvent(EventLog::Type type, uint16_t user = 0, uint16_t finger = 0, uint16_t confidence = 0);
+void exportLog(HardwareSerial &port);
+void startNetwork(bool reportNow);
+bool networkIdle();
+void armNetworkWake();
+void restartIfStaged();
+void handleRemote(const InputEvent &event);
+void startHealthWindow();
+void confirmFirmware();
+#ifdef LOCKER_NETWORK
+void netPost(const EventLog::Record &record);
+void printNetworkStatus(Print &out);
+#endif
+uint32_t lockoutRemaining(uint32_t start);
+void restoreAuthState();
+void enterDeepSleep();
+void setBacklight(bool on);
+void checkHeapWatermark();
+void setupConsole();
+void setFingerprintMode(FingerprintCommand::Mode mode);
+void postFingerprintCommand(FingerprintCommand::Type type, FingerprintCommand::Mode mode, uint16_t id = 0);
+void enterMenu(MenuState state);
+void handleMenuKey(char key);
+void handleMenuResult(const InputEvent &event);
+void onMenuTimeout();
+void printMemoryReport(Print &out);
 
 void setup() {
     // Initialize Serial communication
@@ -132,117 +619,189 @@ void setup() {
     
     // Check wake-up cause and print detailed debug info
     esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
+    warm_start = wakeup_reason != ESP_SLEEP_WAKEUP_UNDEFINED && warm_boot.valid;
+    if (warm_start) warm_boot.wakes++;
+    wake_capture_pending = wakeup_reason == ESP_SLEEP_WAKEUP_EXT0;
+    startHealthWindow();
     uint64_t ext1_wakeup_pins = 0;
     
     if (wakeup_reason != ESP_SLEEP_WAKEUP_UNDEFINED) {
         switch(wakeup_reason) {
             case ESP_SLEEP_WAKEUP_EXT0:
-                Serial.println("Wake up from EXT0 (GPIO23)");
+                Serial.printf("Wake up from EXT0 (GPIO%u)\n", PinConfig::WAKE_PIN);
+                break;
+            case ESP_SLEEP_WAKEUP_TIMER:
+                Serial.println("Wake up from timer");
                 break;
             case ESP_SLEEP_WAKEUP_EXT1:
                 ext1_wakeup_pins = esp_sleep_get_ext1_wakeup_status();
-                Serial.printf("Wake up from EXT1 (Keypad). Pin mask: 0x%llx\n", ext1_wakeup_pins);
+                // Probe before anything else runs, while the key is still down
+                {
+                    int8_t key = decodeWakeKey(ext1_wakeup_pins);
+                    if (key >= 0) wake_keys[wake_key_count++] = key;
+                    Serial.printf("Wake up from EXT1 (Keypad). Pin mask: 0x%" PRIx64 ", key: %c\n", ext1_wakeup_pins,
+                                  key >= 0 ? keys[key] : '?');
+                }
+                break;
+            case ESP_SLEEP_WAKEUP_ULP:
+                {
+                    // The ULP is still sampling; stop it before the scanner takes the pins
+                    int8_t held;
+                    wake_key_count = ulp_keypad.collect(wake_keys, sizeof(wake_keys), held);
+                    if (held >= 0 && held < ROWS * COLS) wake_key_held = 1UL << held;
+                    for (uint8_t i = 0; i < wake_key_count; i++) {
+                        if (wake_keys[i] == ulp_keypad.TOUCH) wake_capture_pending = true;
+                    }
+                    Serial.printf("Wake up from ULP, %u event(s) buffered\n", wake_key_count);
+                }
                 break;
             default:
                 Serial.printf("Wake up from other source: %d\n", wakeup_reason);
                 break;
         }
     }
+
+    // Queues exist before anything renders; the tasks drain them once started
+    input_queue = input_queue_storage.create();
+    display_queue = display_queue_storage.create();
+    fp_command_queue = fp_command_queue_storage.create();
+    fp_plan_queue = fp_plan_queue_storage.create();
     
-    // Initialize EEPROM with minimal size needed
-    EEPROM.begin(Config::EEPROM_SIZE);
+    loadSettings();
+    if (!access_log.begin("events", Config::LOG_FLUSH_DELAY)) Serial.println("No events partition: access log kept in RAM");
+    if (!warm_start) logEvent(EventLog::BOOT);
+    setupConsole();
     
     setupPins();
     
-    // Configure GPIO23 as input with strong pull-down for wake-up
-    pinMode(PinConfig::WAKE_PIN, INPUT_PULLDOWN);
-    rtc_gpio_pulldown_en((gpio_num_t)PinConfig::WAKE_PIN);
+    // GPIO36 has no pulls of its own; the board's pull-down holds the touch line low
+    pinMode(PinConfig::WAKE_PIN, INPUT);
     
     // Configure keypad pins with pull-down
-    const byte allPins[] = {32, 33, 25, 26, 27, 14, 12};  // All keypad pins
-    for (byte pin : allPins) {
+    for (byte pin : rowPins) {
+        pinMode(pin, INPUT_PULLDOWN);
+        rtc_gpio_pulldown_en((gpio_num_t)pin);
+    }
+    for (byte pin : colPins) {
         pinMode(pin, INPUT_PULLDOWN);
         rtc_gpio_pulldown_en((gpio_num_t)pin);
     }
     
     // Initialize I2C and LCD
     Wire.begin();
-    delay(100);  // Give I2C bus time to stabilize
+    if (!warm_start) delay(100);  // Give I2C bus time to stabilize after power-up
     
     setupLCD();  // This will now handle all LCD initialization including custom chars
     
     setupFingerprintSensor();
+    publishSearchPlan();
+    warm_boot.valid = true;
     
-    // Initialize default password if EEPROM is empty
-    if (EEPROM.read(0) == 0xFF) {
-        setPassword("123456");
-        EEPROM.commit();
-    }
-    
-    // Display wake-up source if from deep sleep
-    if (wakeup_reason != ESP_SLEEP_WAKEUP_UNDEFINED) {
-        String wakeMsg = "Wake: ";
-        wakeMsg += (wakeup_reason == ESP_SLEEP_WAKEUP_EXT0) ? "GPIO23" : 
-                   (wakeup_reason == ESP_SLEEP_WAKEUP_EXT1) ? "Keypad" : "Other";
-        displayMessage(wakeMsg, "", 1000);
+    setupPowerManagement();
+    tones.begin(PinConfig::BUZZER_CHANNEL, PinConfig::BUZZER_RESOLUTION, buzzer_power.handle);
+
+#ifdef LOCKER_BENCHMARK
+    benchmarkPeripherals();  // While the LCD and the sensor are still ours alone
+#endif
+
+    // Hardware is configured; from here on each peripheral belongs to its task.
+    // After a touch wake the finger is already on the glass, and the
+    // fingerprint task starts its first capture as soon as it runs.
+    startTasks();
+    startNetwork(wakeup_reason == ESP_SLEEP_WAKEUP_TIMER);
+    restoreAuthState();
+
+    // Boot notices hold the screen and hand over to the ready screen on their own;
+    // a sensor failure notice takes precedence. The wake source only goes to serial:
+    // the lock is usable the moment the ready screen is up.
+    if (!scheduler.pending(ready_screen_timer)) {
+        showReadyScreen();
     }
-    
-    showReadyScreen();
     last_activity = millis();
+#ifdef LOCKER_NETWORK
+    // A timer wake is only for the network report: sleep again once it is sent
+    if (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) last_activity -= Config::INACTIVITY_TIME + 5000;
+#endif
+
+    // Keys typed before we were up count as the first digits; the scanner was
+    // told about one still held, so it won't be reported twice
+    for (uint8_t i = 0; i < wake_key_count; i++) {
+        if (wake_keys[i] >= ROWS * COLS) continue;  // Touch, already handed to the sensor task
+        InputEvent event = {};
+        event.type = InputEvent::KEY;
+        event.key = keys[wake_keys[i]];
+        postInput(event);
+    }
+    Serial.printf("%s boot ready %lu ms after reset\n", warm_start ? "Warm" : "Cold", millis());
+    if (!warm_start) printMemoryReport(Serial);  // Kept off warm boots, where wake latency counts
+#ifdef LOCKER_BENCHMARK
+    benchmarkAfterBoot();
+#endif
 }
 
-void IRAM_ATTR loop() {
-    // Critical section for state management
+void loop() {
     static uint32_t lastInactivityCheck = 0;
     uint32_t now = millis();
     
-    // Serial handling non-critical, move outside critical section
-    if (Serial.available()) {
-        String command = Serial.readStringUntil('\n');
-        command.trim();
-        if (command == "readpass") {
-            Serial.println("Stored password: " + getPassword());
+    // Console input is parsed as it arrives; a template transfer owns Serial meanwhile
+    if (!serial_transfer) console.poll(now);
+
+    // Sleep on the input queue until an event arrives or the next timed action
+    // is due; the keypad and sensor tasks keep scanning meanwhile
+    // Governor tier 1: full clock while someone is using the lock, DFS down
+    // (and light sleep, once the other tasks allow it) when idle
+    bool active = menu_active || now - last_activity < Config::POWER_ACTIVE_HOLD;
+    cpu_power.hold(active);
+
+    InputEvent event;
+    uint32_t wait = scheduler.nextDelay(now, active ? KEY_SCAN_INTERVAL : Config::IDLE_LOOP_INTERVAL);
+    if (xQueueReceive(input_queue, &event, pdMS_TO_TICKS(wait)) == pdTRUE) {
+        updateTemplateIndex(event);
+        if (event.type == InputEvent::KEY) {
+            handleKeypad(event.key);
+        } else if (event.type == InputEvent::DOOR) {
+            handleDoor(static_cast<RelayController::Event>(event.status));
+        } else if (event.type == InputEvent::REMOTE) {
+            handleRemote(event);
+        } else if (menu_active) {
+            handleMenuResult(event);
+        } else {
+            handleFingerprint(event);
         }
     }
 
-    // Handle time-sensitive tasks first
-    handleKeypad();
-    handleFingerprint();
+    // Fire due timed actions (message holds, lockout expiry, sleep)
+    now = millis();
+    scheduler.run(now);
+    if (log_export_next < log_export_end && !serial_transfer) exportLog(Serial);
     
     // Less critical tasks with optimized timing
     if (now - lastInactivityCheck >= 1000) {
         handleInactivity();
+        checkHeapWatermark();
+        settings.service(now);
+        fp_index.service(now);
+        fp_stats.service(now);
+        access_log.service(now);
         lastInactivityCheck = now;
     }
-
-    // Use shorter delay to improve responsiveness while maintaining power efficiency
-    delayMicroseconds(100);
 }
 
 void setupPins() {
-    pinMode(PinConfig::RELAY, OUTPUT);
-    digitalWrite(PinConfig::RELAY, HIGH);
+    // Relay is active low: locked from the first instruction that drives it
+    relay.begin({PinConfig::RELAY, LOW, PinConfig::DOOR_SENSOR, PinConfig::DOOR_OPEN_LEVEL,
+                 Config::DOOR_POLL_INTERVAL, Config::RELAY_EXTEND_ON_REGRANT, Config::RELOCK_ON_CLOSE},
+                onRelayEvent);
 
     // Configure buzzer pin for digital output
     pinMode(PinConfig::BUZZER, OUTPUT);
     digitalWrite(PinConfig::BUZZER, LOW);
 
-    // Configure wake pin with pull-down only
+    // Wake pin: input only, pulled down on the board
     pinMode(PinConfig::WAKE_PIN, INPUT);
-    gpio_set_pull_mode((gpio_num_t)PinConfig::WAKE_PIN, GPIO_PULLDOWN_ONLY);
     gpio_wakeup_enable((gpio_num_t)PinConfig::WAKE_PIN, GPIO_INTR_HIGH_LEVEL);
 
-    // Configure keypad rows as outputs
-    for(byte i = 0; i < ROWS; i++) {
-        pinMode(rowPins[i], OUTPUT);
-        digitalWrite(rowPins[i], HIGH);
-    }
-    
-    // Configure keypad columns with pull-up only
-    for(byte i = 0; i < COLS; i++) {
-        pinMode(colPins[i], INPUT);
-        gpio_set_pull_mode((gpio_num_t)colPins[i], GPIO_PULLUP_ONLY);
-    }
+    // Keypad rows and columns are claimed by the scanner when the keypad task starts
 
     // Configure buzzer pin for PWM output using LEDC
     ledcSetup(PinConfig::BUZZER_CHANNEL, PinConfig::BUZZER_BASE_FREQ, PinConfig::BUZZER_RESOLUTION);
@@ -251,34 +810,158 @@ void setupPins() {
 }
 
 void setupLCD() {
-    Wire.begin();
-    lcd.begin();
+    if (warm_start) {
+        // The controller kept its mode, DDRAM and CGRAM through the sleep: switch it
+        // back on and let the first flush repaint over the old contents
+        lcd.display();
+        lcd.backlight();
+        screen.invalidate();
+        return;
+    }
+
+    lcd.begin(false);  // Wire is already up
     lcd.backlight();  // Ensure backlight is on after wake-up
+    screen.assumeCleared();
     
-    // Create all custom characters in one place
-    lcd.createChar(0, lockChar);
-    lcd.createChar(1, unlockChar);
-    lcd.createChar(2, fingerChar);
-    lcd.createChar(3, halfLockChar);    // Half-lock for 2FA waiting
-    lcd.createChar(4, errorLockChar);   // Error lock for lockout
-    lcd.createChar(5, emptyCircle);     // Empty circle for PIN input and progress
-    lcd.createChar(6, filledCircle);    // Filled circle for PIN input and progress
+    // Create all custom characters in one place; after a deep-sleep wake the
+    // controller still holds them and nothing is re-sent
+    screen.defineGlyph(lcd_glyphs, 0, lockChar);
+    screen.defineGlyph(lcd_glyphs, 1, unlockChar);
+    screen.defineGlyph(lcd_glyphs, 2, fingerChar);
+    screen.defineGlyph(lcd_glyphs, 3, halfLockChar);    // Half-lock for 2FA waiting
+    screen.defineGlyph(lcd_glyphs, 4, errorLockChar);   // Error lock for lockout
+    screen.defineGlyph(lcd_glyphs, 5, emptyCircle);     // Empty circle for PIN input and progress
+    screen.defineGlyph(lcd_glyphs, 6, filledCircle);    // Filled circle for PIN input and progress
 
     displayMessage("  Waking Up...","");
     last_activity = millis();  // Reset activity timer after wake-up
 }
 
+// Receive events from the UART driver wake the fingerprint task to parse replies
+void onFingerprintRx() {
+    if (fingerprint_task) xTaskNotifyGive(fingerprint_task);
+}
+
+// The module persists a baud change, so after the first boot the fast probe
+// succeeds straight away and the 57600 fallback is only ever paid once
+bool raiseFingerprintBaud() {
+    finger.begin(Config::FP_FAST_BAUD_RATE);
+    if (finger.verifyPassword()) return true;
+
+    fingerprintSerial.updateBaudRate(Config::UART_BAUD_RATE);
+    if (!initFingerprint()) return false;
+    if (finger.setBaudRate(Config::FP_FAST_BAUD_RATE / 9600) != FINGERPRINT_OK) return true;
+
+    delay(50);  // Module switches rate after acknowledging at the old one
+    fingerprintSerial.updateBaudRate(Config::FP_FAST_BAUD_RATE);
+    if (finger.verifyPassword()) return true;
+
+    fingerprintSerial.updateBaudRate(Config::UART_BAUD_RATE);  // Didn't take; stay slow
+    return finger.verifyPassword();
+}
+
+// ReadIndexTable: one 32-byte occupancy bitmap per bank of 256 pages
+bool syncTemplateIndex() {
+    static constexpr uint8_t CMD_READ_INDEX = 0x1F;
+    FingerprintIndex &index = fp_index.data;
+    bool wasKnown = index.known;
+    uint8_t before[sizeof(index.enrolled)];
+    memcpy(before, index.enrolled, sizeof(before));
+
+    index.resetLayout();
+    uint16_t pages = fp_capacity < Config::FP_MAX_TEMPLATES ? fp_capacity : Config::FP_MAX_TEMPLATES;
+    for (uint16_t bank = 0; bank * 256 < pages; bank++) {
+        uint8_t request[2] = {CMD_READ_INDEX, static_cast<uint8_t>(bank)};
+        Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(request), request);
+        finger.writeStructuredPacket(packet);
+        if (finger.getStructuredPacket(&packet) != FINGERPRINT_OK ||
+            packet.type != FINGERPRINT_ACKPACKET || packet.data[0] != FINGERPRINT_OK) {
+            return false;  // Layout stays unknown: searches cover the whole library
+        }
+        for (uint16_t i = 0; i < 256 && bank * 256 + i < pages; i++) {
+            index.setEnrolled(bank * 256 + i, packet.data[1 + i / 8] & (1 << (i % 8)));
+        }
+    }
+    index.known = true;
+    if (!wasKnown || memcmp(before, index.enrolled, sizeof(before)) != 0) fp_index.changed(millis());
+    return true;
+}
+
+// Hand the fingerprint task the searches for its next capture
+void publishSearchPlan() {
+    FingerprintIndex::Plan plan = fp_index.data.plan(fp_capacity);
+    xQueueOverwrite(fp_plan_queue, &plan);
+}
+
+// The fingerprint task reports matches, enrollments, deletions and restores;
+// the index only changes here, on the loop task
+void updateTemplateIndex(const InputEvent &event) {
+    switch (event.type) {
+        case InputEvent::FP_MATCH:
+            fp_index.data.hit(event.id);
+            break;
+        case InputEvent::FP_ENROLL_DONE:
+            if (event.status != ENROLL_OK) return;
+            fp_index.data.setEnrolled(event.id, true);
+            break;
+        case InputEvent::FP_DELETE_DONE:
+            if (event.status != FINGERPRINT_OK) return;
+            fp_index.data.setEnrolled(event.id, false);
+            break;
+        case InputEvent::FP_TRANSFER_DONE:
+            for (uint16_t id = 0; id < Config::FP_MAX_TEMPLATES; id++) {
+                if (fp_transfer_pages.enrolled[id / 8] & (1 << (id % 8))) fp_index.data.setEnrolled(id, true);
+            }
+            break;
+        default:
+            return;
+    }
+    fp_index.changed(millis());
+    publishSearchPlan();
+}
+
 void setupFingerprintSensor() {
-    fingerprintSerial.begin(Config::UART_BAUD_RATE, SERIAL_8N1, PinConfig::FP_RX, PinConfig::FP_TX);
+    fp_index.begin("locker", "fpindex", Config::FP_INDEX_VERSION, Config::FP_INDEX_COMMIT_DELAY);
+
+    if (warm_start && warm_boot.fp_ready) {
+        // Still powered at the negotiated rate, with its settings stored on the
+        // module: no boot delay, handshake or parameter reads needed
+        fingerprintSerial.begin(warm_boot.fp_baud, SERIAL_8N1, PinConfig::FP_RX, PinConfig::FP_TX);
+        fp_capacity = warm_boot.fp_capacity;
+        fp_packet_len = warm_boot.fp_packet_len;
+        fingerprintSerial.onReceive(onFingerprintRx);
+        fp_link.begin(fingerprintSerial, onFingerprintStage, Config::FP_REPLY_TIMEOUT);
+        return;
+    }
+
+    uint32_t baud = Config::FP_RAISE_BAUD ? Config::FP_FAST_BAUD_RATE : Config::UART_BAUD_RATE;
+    fingerprintSerial.begin(baud, SERIAL_8N1, PinConfig::FP_RX, PinConfig::FP_TX);
     delay(50);
-    finger.begin(Config::UART_BAUD_RATE);
 
-    if (initFingerprint()) {
-        // Set high security level for better accuracy
-        finger.setSecurityLevel(4);
+    bool ready;
+    if (Config::FP_RAISE_BAUD) {
+        ready = raiseFingerprintBaud() && finger.getParameters() == FINGERPRINT_OK;
+    } else {
+        finger.begin(Config::UART_BAUD_RATE);
+        ready = initFingerprint();
+    }
+
+    if (ready) {
+        finger.setSecurityLevel(fpSecurityLevel());
+        if (finger.capacity > 0) fp_capacity = finger.capacity;
+        if (finger.packet_len > 0) fp_packet_len = finger.packet_len;
+        // Templates may have been added or removed by another host since we last ran
+        if (!syncTemplateIndex()) Serial.println("Template index unavailable; full searches");
     } else {
         displayMessage("Sensor Failed!","System limited",2000);
     }
+    warm_boot.fp_ready = ready;
+    warm_boot.fp_baud = fingerprintSerial.baudRate();
+    warm_boot.fp_capacity = fp_capacity;
+    warm_boot.fp_packet_len = fp_packet_len;
+
+    fingerprintSerial.onReceive(onFingerprintRx);
+    fp_link.begin(fingerprintSerial, onFingerprintStage, Config::FP_REPLY_TIMEOUT);
 }
 
 void displaySensorParameters() {
@@ -302,148 +985,486 @@ void displaySensorParameters() {
     }
 }
 
-void IRAM_ATTR handleFingerprint() {
-    static uint32_t lastCheck = 0;
-    const uint32_t minCheckInterval = 100; // 100ms between checks for power efficiency
+// ---------------------------------------------------------------------------
+// Tasks
+// ---------------------------------------------------------------------------
     
+void postInput(const InputEvent &event) {
+    InputEvent stamped = event;
+    stamped.stamp_us = perfNow();
+    xQueueSend(input_queue, &stamped, pdMS_TO_TICKS(20));
+}
+
+void postDisplay(const DisplayCommand &cmd) {
+    DisplayCommand stamped = cmd;
+    stamped.stamp_us = perfNow();
+    xQueueSend(display_queue, &stamped, pdMS_TO_TICKS(50));
+}
+
+// Called on the esp_timer task, which must not block: a full queue drops the event
+void onRelayEvent(RelayController::Event event) {
+    InputEvent posted = {};
+    posted.type = InputEvent::DOOR;
+    posted.status = event;
+    posted.stamp_us = perfNow();
+    xQueueSend(input_queue, &posted, 0);
+}
+
+void postFingerprintCommand(FingerprintCommand::Type type, FingerprintCommand::Mode mode, uint16_t id) {
+    FingerprintCommand cmd = {type, mode, id};
+    xQueueSend(fp_command_queue, &cmd, pdMS_TO_TICKS(50));
+    xTaskNotifyGive(fingerprint_task);  // The task sleeps on notifications, not the queue
+}
+
+// Template IDs for enroll and delete, from the menus and the console alike:
+// page 0 is never used, and the sensor's library ends at fp_capacity
+bool parseTemplateId(const char *text, uint16_t &id) {
+    char *end = nullptr;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || value == 0 || value >= fp_capacity) return false;
+    id = value;
+    return true;
+}
+
+// Records who a new template belongs to. Until that lands the page keeps its
+// previous owner, who the finger would open for, so a failed write deletes it
+Users::Result bindEnrolled(uint16_t page, uint16_t owner) {
+    Users::Result result = users.bind(page, owner);
+    if (result != Users::OK) postFingerprintCommand(FingerprintCommand::DELETE, FingerprintCommand::DETECT_ONLY, page);
+    return result;
+}
+
+// Touch output of the sensor: both edges wake the fingerprint task, which then
+// samples the line level to decide whether the sensor needs querying
+// Level-triggered so the touch line can also wake the chip from light sleep;
+// flipping the level on every interrupt makes it behave like CHANGE
+void IRAM_ATTR onFingerTouch() {
+    bool landed = GPIO.pin[PinConfig::WAKE_PIN].int_type == GPIO_INTR_HIGH_LEVEL;
+    GPIO.pin[PinConfig::WAKE_PIN].int_type = landed ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+    if (landed) fp_touch_us = perfNow();
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(fingerprint_task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+bool fingerOnSensor() {
+    return !Config::FP_TOUCH_INTERRUPT || digitalRead(PinConfig::WAKE_PIN) == HIGH;
+}
+
+// With a touch line the sensor is only queried while a finger is on it: retry
+// at the poll interval until a usable image comes back, then sleep until the
+// next edge. Without one, fall back to polling getImage(). While an exchange
+// is in flight the task sleeps until the reply arrives or its deadline passes.
+TickType_t fingerprintIdleWait() {
     uint32_t now = millis();
-    if (now - lastCheck < minCheckInterval) return;
-    lastCheck = now;
-    
-    portENTER_CRITICAL(&mux);
-    bool isPinVerified = pin_verified;
-    Config::AuthMode mode = getAuthMode();
-    bool isPinLockedOut = is_pin_locked_out;
-    portEXIT_CRITICAL(&mux);
-    
-    uint8_t fingerprintID = getFingerprintID();
-    if (fingerprintID != 0) {
-        if (mode == Config::TWO_FACTOR) {
-            if (isPinVerified) {
-                portENTER_CRITICAL(&mux);
-                wrong_attempts = 0;
-                pin_verified = false;
-                fingerprint_verified = false;
-                portEXIT_CRITICAL(&mux);
-                
-                displayMessage("ID #" + String(fingerprintID), "Access Granted");
-                unlockDoor();
-            } else {
-                portENTER_CRITICAL(&mux);
-                fingerprint_verified = true;
-                verified_fingerprint_id = fingerprintID;
-                portEXIT_CRITICAL(&mux);
-                
-                if (isPinLockedOut) {
-                    displayMessage("Finger Verified", "Wait for PIN");
-                    delay(2000);
-                } else {
-                    displayMessage("Fingerprint OK", "Enter PIN", 2000);
-                }
+    if (fp_link.busy()) return pdMS_TO_TICKS(fp_link.msUntilDeadline(now));
+    if (Config::FP_TOUCH_INTERRUPT && (!fingerOnSensor() || fp_await_lift)) return portMAX_DELAY;
+    int32_t untilCapture = static_cast<int32_t>(fp_next_capture - now);
+    return untilCapture > 0 ? pdMS_TO_TICKS(untilCapture) : 0;
+}
+
+// Backup only visits pages the index says are occupied (all of them if it doesn't know)
+bool templatePresent(uint16_t id) {
+    return !fp_transfer_pages.known || (fp_transfer_pages.enrolled[id / 8] & (1 << (id % 8)));
+}
+
+void templateStored(uint16_t id) {
+    if (id < Config::FP_MAX_TEMPLATES) fp_transfer_pages.enrolled[id / 8] |= 1 << (id % 8);
+}
+
+// Binary backup/restore session over USB serial; see TemplateTransfer.h for the framing
+uint16_t runTemplateTransfer() {
+    static TemplateTransfer transfer(Serial, finger, fingerprintSerial);
+    Serial.println("TRANSFER READY");
+    Serial.flush();
+    uint16_t moved = transfer.run(fp_packet_len, Config::TRANSFER_IDLE_TIMEOUT, templatePresent, templateStored);
+    Serial.printf("\nTransfer finished: %u templates\n", moved);
+    return moved;
+}
+
+void runFingerprintCommand(const FingerprintCommand &cmd) {
+    InputEvent done = {};
+    switch (cmd.type) {
+        case FingerprintCommand::SET_MODE:
+            fp_mode = cmd.mode;
+            break;
+        case FingerprintCommand::ENROLL:
+            done.type = InputEvent::FP_ENROLL_DONE;
+            done.id = cmd.id;
+            done.status = getFingerprintEnroll(cmd.id);
+            fp_await_lift = true;
+            postInput(done);
+            break;
+        case FingerprintCommand::DELETE:
+            done.type = InputEvent::FP_DELETE_DONE;
+            done.id = cmd.id;
+            done.status = finger.deleteModel(cmd.id);
+            postInput(done);
+            break;
+        case FingerprintCommand::TRANSFER:
+            done.type = InputEvent::FP_TRANSFER_DONE;
+            done.id = runTemplateTransfer();
+            fp_await_lift = true;
+            postInput(done);
+            break;
+        case FingerprintCommand::SET_LEVEL:
+            if (finger.setSecurityLevel(cmd.id) != FINGERPRINT_OK) Serial.println("Sensor refused the security level");
+            break;
+    }
+}
+
+void renderDisplayCommand(const DisplayCommand &cmd);
+
+// Owns the sensor UART: polls for touches, runs the match pipeline and carries
+// out enroll/delete requests so the loop task never waits on a round trip
+void fingerprintTaskMain(void *) {
+    FingerprintCommand cmd;
+    for (;;) {
+        // Touch edges, UART receive events and queued commands all arrive as
+        // task notifications. Only an indefinite wait for the touch line may
+        // light-sleep: a reply in flight or a pending poll needs the UART clocked.
+        TickType_t wait = fingerprintIdleWait();
+        fp_power.hold(wait != portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, wait);
+        fp_power.hold(true);
+
+        // Reply bytes (or an expired deadline) advance the pipeline in flight
+        fp_link.service(millis());
+        if (fp_link.busy()) continue;
+
+        while (xQueueReceive(fp_command_queue, &cmd, 0) == pdTRUE) {
+            runFingerprintCommand(cmd);
+        }
+
+        if (!fingerOnSensor()) {
+            fp_await_lift = false;  // Touch line dropped: the finger is gone
+            continue;
+        }
+        if (Config::FP_TOUCH_INTERRUPT && fp_await_lift) continue;
+
+        uint32_t now = millis();
+        if (static_cast<int32_t>(now - fp_next_capture) < 0) continue;
+        fp_next_capture = now + Config::FP_POLL_INTERVAL;
+        xQueuePeek(fp_plan_queue, &fp_plan, 0);
+        fp_link.startMatch(fp_plan.firstStart, fp_plan.firstCount);
+        if (wake_capture_pending) {
+            wake_capture_pending = false;
+            Serial.printf("First capture %" PRIu32 " ms after wake\n", now);
+        }
+    }
+}
+
+void IRAM_ATTR onKeypadTimer() {
+#ifdef LOCKER_BENCHMARK
+    uint32_t start = ESP.getCycleCount();
+    matrix_keypad.scanISR();
+    bench_scan_cycles.add(ESP.getCycleCount() - start);
+#else
+    matrix_keypad.scanISR();
+#endif
+}
+
+void IRAM_ATTR onKeypadWake() {
+    matrix_keypad.wakeISR();
+}
+
+// The scan itself runs in the timer ISR; this task only turns debounced edges
+// into input events. Releases are dropped: the loop acts on key-down only.
+// After KEYPAD_PARK_AFTER with nothing pressed the scan is parked, which lets
+// the chip light-sleep; a keypress wakes it and scanning picks up within one
+// debounce window.
+void keypadTaskMain(void *) {
+    matrix_keypad.seed(wake_key_held);
+    matrix_keypad.begin(rowPins, colPins, Config::KEYPAD_TIMER, Config::KEYPAD_ROW_PERIOD_US,
+                        onKeypadTimer, xTaskGetCurrentTaskHandle());
+    matrix_keypad.enableWake(onKeypadWake);
+    keypad_power.hold(true);
+
+    MatrixKeypad<ROWS, COLS, Config::KEYPAD_DEBOUNCE_SCANS>::Event edge;
+    uint32_t lastEdge = millis();
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, matrix_keypad.parked() ? portMAX_DELAY : pdMS_TO_TICKS(Config::KEYPAD_PARK_AFTER));
+        uint32_t now = millis();
+
+        if (matrix_keypad.parked()) {
+            // A column went low: clocks back up and scan to find the key
+            keypad_power.hold(true);
+            matrix_keypad.resume();
+            lastEdge = now;
+            continue;
+        }
+
+        while (matrix_keypad.read(edge)) {
+            lastEdge = now;
+            if (!edge.pressed) continue;
+            InputEvent event = {};
+            event.type = InputEvent::KEY;
+            event.key = keys[edge.key];
+            postInput(event);
+        }
+
+        if (matrix_keypad.held() == 0 && now - lastEdge >= Config::KEYPAD_PARK_AFTER) {
+            matrix_keypad.park();
+            keypad_power.hold(false);
+        }
+    }
+}
+
+void displayTaskMain(void *) {
+    DisplayCommand cmd;
+    for (;;) {
+        display_power.hold(uxQueueMessagesWaiting(display_queue) > 0);
+        if (xQueueReceive(display_queue, &cmd, portMAX_DELAY) == pdTRUE) {
+            display_power.hold(true);
+            renderDisplayCommand(cmd);
+            if (cmd.type != DisplayCommand::BACKLIGHT && cmd.type != DisplayCommand::SLEEP) {
+                perfRecord(PERF_DISPLAY, cmd.stamp_us);
             }
-        } else {
-            portENTER_CRITICAL(&mux);
-            wrong_attempts = 0;
-            portEXIT_CRITICAL(&mux);
-            
-            displayMessage("ID #" + String(fingerprintID), "Access Granted");
-            unlockDoor();
         }
-        last_activity = now;
-        showReadyScreen();
     }
 }
 
-char scanKeypad() {
-    static char lastKey = 0;
-    static uint32_t lastDebounceTime = 0;
-    const uint32_t debounceDelay = 50;
-    
-    // Set all rows to input with pull-up to start
-    for(byte r = 0; r < ROWS; r++) {
-        pinMode(rowPins[r], INPUT_PULLUP);
+// Tiered power: DFS and automatic light sleep (tickless idle) while awake but
+// idle, deep sleep as the last tier. Falls back to DFS alone when the build
+// has tickless idle disabled, and to fixed clocks if power management is off.
+void setupPowerManagement() {
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = getCpuFrequencyMhz();
+    pm.min_freq_mhz = Config::POWER_MIN_MHZ;
+    pm.light_sleep_enable = true;
+    esp_err_t err = esp_pm_configure(&pm);
+    if (err != ESP_OK) {
+        pm.light_sleep_enable = false;
+        err = esp_pm_configure(&pm);
     }
-    
-    // Set all columns to input with pull-up
-    for(byte c = 0; c < COLS; c++) {
-        pinMode(colPins[c], INPUT_PULLUP);
+    if (err != ESP_OK) {
+        Serial.printf("Power management unavailable: %s\n", esp_err_to_name(err));
+        return;
     }
+    Serial.printf("Power: %d-%d MHz, light sleep %s\n", pm.min_freq_mhz, pm.max_freq_mhz,
+                  pm.light_sleep_enable ? "on" : "off");
+
+    // Keypad columns and the touch line wake the chip from light sleep
+    esp_sleep_enable_gpio_wakeup();
+
+    cpu_power.create(ESP_PM_CPU_FREQ_MAX, "ui");
+    keypad_power.create(ESP_PM_NO_LIGHT_SLEEP, "keypad");
+    fp_power.create(ESP_PM_NO_LIGHT_SLEEP, "fingerprint");
+    display_power.create(ESP_PM_NO_LIGHT_SLEEP, "display");
+    buzzer_power.create(ESP_PM_NO_LIGHT_SLEEP, "buzzer");
+}
+
+void startTasks() {
+    fingerprint_task = fingerprint_task_storage.create(fingerprintTaskMain, "fingerprint", TaskConfig::FP_PRIORITY,
+                                                       TaskConfig::SENSOR_CORE);
+    keypad_task = keypad_task_storage.create(keypadTaskMain, "keypad", TaskConfig::KEYPAD_PRIORITY, TaskConfig::UI_CORE);
+    display_task = display_task_storage.create(displayTaskMain, "display", TaskConfig::DISPLAY_PRIORITY,
+                                               TaskConfig::UI_CORE);
+
+    // The same touch line that wakes us from deep sleep triggers captures at runtime
+    if (Config::FP_TOUCH_INTERRUPT) {
+        attachInterrupt(digitalPinToInterrupt(PinConfig::WAKE_PIN), onFingerTouch,
+                        fingerOnSensor() ? ONLOW : ONHIGH);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Authentication (loop task)
+// ---------------------------------------------------------------------------
+
+void setFingerprintMode(FingerprintCommand::Mode mode) {
+    static FingerprintCommand::Mode requested = FingerprintCommand::MATCH;
+    if (mode == requested) return;
+    requested = mode;
+    postFingerprintCommand(FingerprintCommand::SET_MODE, mode);
+}
+
+// Searching is pointless while the sensor is locked out or a menu owns the UI
+void updateFingerprintMode() {
+    setFingerprintMode((auth.is_fp_locked_out || menu_active) ? FingerprintCommand::DETECT_ONLY
+                                                              : FingerprintCommand::MATCH);
+}
+
+// A finger that matched no template, or one whose owner may not open the lock
+// now; both look the same from outside
+void rejectFingerprint() {
+    LineBuffer line;
+    auth.wrong_fp_attempts++;
+    int remaining_attempts = Config::MAX_WRONG_ATTEMPTS - auth.wrong_fp_attempts;
+
+    if (auth.wrong_fp_attempts >= Config::MAX_WRONG_ATTEMPTS) {
+        auth.is_fp_locked_out = true;
+        auth.fp_lockout_start = rtcMillis();
+        auth.fp_lockouts++;
+        scheduler.arm(fp_lockout_timer, millis(), Config::LOCKOUT_TIME, onLockoutExpired);
+        updateFingerprintMode();
+        logEvent(EventLog::FINGER_LOCKOUT);
+        displayMessage("FP Locked 30s", "FP Locked 30s", 2000);
+        soundBuzzer(3); // Use alarm sound
+    } else {
+        displayMessage("No Match", formatLine(line, "%d tries left", remaining_attempts), 2000);
+        soundBuzzer(1);
+    }
+}
+
+void handleFingerprint(const InputEvent &event) {
+    uint32_t now = millis();
+    LineBuffer line;
+    PerfScope decision(PERF_DECISION, event.stamp_us,
+                       event.type == InputEvent::FP_MATCH || event.type == InputEvent::FP_NO_MATCH);
     
-    // Scan each row
-    for(byte r = 0; r < ROWS; r++) {
-        // Set current row as OUTPUT LOW
-        pinMode(rowPins[r], OUTPUT);
-        digitalWrite(rowPins[r], LOW);
-        delayMicroseconds(10);  // Small delay for signal to stabilize
-        
-        // Check each column
-        for(byte c = 0; c < COLS; c++) {
-            if(digitalRead(colPins[c]) == LOW) {  // Key is pressed
-                uint32_t now = millis();
-                // If enough time has passed, treat this as a new keypress
-                if((now - lastDebounceTime) > debounceDelay) {
-                    lastDebounceTime = now;
-                    char key = keys[r * COLS + c];
-                    if(key != lastKey) {
-                        lastKey = key;
-                        // Reset the row pin back to input pull-up
-                        pinMode(rowPins[r], INPUT_PULLUP);
-                        return key;
-                    }
+    switch (event.type) {
+        case InputEvent::FINGER_DOWN:
+            last_activity = now;
+            setBacklight(true);
+            // Check if fingerprint is locked out but still allow PIN input in 2FA mode
+            if (auth.is_fp_locked_out) {
+                uint32_t remaining = lockoutRemaining(auth.fp_lockout_start);
+                if (remaining > 0) {
+                    // Only show lockout message if actively trying to use fingerprint
+                    unsigned long remainingTime = remaining / 1000;
+                    displayMessage("FP Locked Out", formatLine(line, "%lus", remainingTime), 2000);
+                    soundBuzzer(1);
+                } else {
+                    onLockoutExpired();
                 }
-                // Reset the row pin back to input pull-up
-                pinMode(rowPins[r], INPUT_PULLUP);
-                return 0;
+                return;
+            }
+            displayMessage("  Processing...","");
+            return;
+    
+        case InputEvent::FP_IMAGE_ERROR:
+            fp_stats.data.touch(event.status);
+            fp_stats.data.imageError();
+            fp_stats.changed(now);
+            displayMessage("Image Error","Try again", 1500);
+            return;
+                
+        case InputEvent::FP_NO_MATCH:
+            fp_stats.data.touch(event.status);
+            fp_stats.data.miss();
+            fp_stats.changed(now);
+            logEvent(EventLog::FINGER_DENIED);
+            rejectFingerprint();
+            return;
+                
+        case InputEvent::FP_MATCH:
+            break;
+
+        // Only reaches here when the console started the operation; the menus wait for their own
+        case InputEvent::FP_ENROLL_DONE:
+            if (event.status != ENROLL_OK) {
+                Serial.printf("Enroll ID %u: failed\n", event.id);
+            } else {
+                Users::Result result = bindEnrolled(event.id, console_enroll_owner);
+                Serial.printf("Enroll ID %u: %s%s\n", event.id, userResultName(result),
+                              result == Users::OK ? "" : ", template deleted");
+            }
+            return;
+
+        case InputEvent::FP_DELETE_DONE:
+            if (event.status != FINGERPRINT_OK) {
+                Serial.printf("Delete ID %u: failed\n", event.id);
+            } else {
+                Serial.printf("Delete ID %u: %s\n", event.id, userResultName(users.bind(event.id, Users::NONE)));
+            }
+            return;
+
+        case InputEvent::FP_TRANSFER_DONE:
+            serial_transfer = false;
+            last_activity = now;
+            displayMessage("Transfer Done", formatLine(line, "%u templates", event.id), 2000);
+            return;
+
+        default:
+            return;
+    }
+
+    // The template must belong to an enabled user, and after a PIN to that PIN's user
+    uint16_t fingerprintID = event.id;
+    uint16_t owner = users.owner(fingerprintID);
+    const Users::User *user = users.user(owner);
+    fp_stats.data.touch(event.status);
+    fp_stats.data.match(owner, event.confidence);
+    fp_stats.changed(now);
+    bool accepted = user && user->enabled;
+    if (getAuthMode() == Config::TWO_FACTOR && auth.pin_verified) accepted = accepted && owner == auth.pin_user;
+    if (!accepted) {
+        logEvent(EventLog::FINGER_DENIED, owner, fingerprintID, event.confidence);
+        rejectFingerprint();
+        return;
+    }
+
+    // Reset wrong attempts on successful match
+    auth.wrong_fp_attempts = 0;
+
+    if (getAuthMode() == Config::TWO_FACTOR) {
+        if (auth.pin_verified) {
+            auth.pin_verified = false;
+            auth.fingerprint_verified = false;
+            auth.pin_user = Users::NONE;
+            
+            logEvent(EventLog::GRANTED, owner, fingerprintID, event.confidence);
+            displayMessage(formatLine(line, "ID #%u", fingerprintID), "Access Granted", Config::UNLOCK_TIME);
+            unlockDoor();
+        } else {
+            auth.fingerprint_verified = true;
+            auth.verified_fingerprint_id = fingerprintID;
+            auth.verified_confidence = event.confidence;
+            logEvent(EventLog::FINGER_OK, owner, fingerprintID, event.confidence);
+
+            if (auth.is_pin_locked_out) {
+                displayMessage("Finger Verified", "Wait for PIN", 2000);
+            } else {
+                displayMessage("Fingerprint OK", "Enter PIN", 2000);
             }
         }
-        // Reset the row pin back to input pull-up
-        pinMode(rowPins[r], INPUT_PULLUP);
+    } else {
+        logEvent(EventLog::GRANTED, owner, fingerprintID, event.confidence);
+        displayMessage(formatLine(line, "ID #%u", fingerprintID), "Access Granted", Config::UNLOCK_TIME);
+        unlockDoor();
     }
-    lastKey = 0;
-    return 0;
+    last_activity = now;
 }
 
-void IRAM_ATTR handleKeypad() {
-    static uint32_t lastKeyCheck = 0;
+void handleKeypad(char key) {
     uint32_t now = millis();
     
-    // Throttle scanning rate
-    if(now - lastKeyCheck < KEY_SCAN_INTERVAL) return;
-    lastKeyCheck = now;
-    
-    char key = scanKeypad();  // Use our custom scanning function
-    if(!key) return;
-    
     last_activity = now;
-    lcd.backlight();
+    setBacklight(true);
+    if (key >= 'A' && key <= 'D') return;  // 4x4 keypads: the letter keys only wake the screen
+
+    if (menu_active) {
+        handleMenuKey(key);
+        return;
+    }
 
     // Check for PIN lockout status immediately
-    if (is_pin_locked_out) {
-        if (millis() - pin_lockout_start < Config::LOCKOUT_TIME) {
-            unsigned long remainingTime = (Config::LOCKOUT_TIME - (millis() - pin_lockout_start)) / 1000;
+    if (auth.is_pin_locked_out) {
+        uint32_t remaining = lockoutRemaining(auth.pin_lockout_start);
+        if (remaining > 0) {
+            unsigned long remainingTime = remaining / 1000;
+            LineBuffer line;
             // In 2FA mode, show that fingerprint is still available
-            if (getAuthMode() == Config::TWO_FACTOR && !is_fp_locked_out) {
-                displayMessage("PIN Locked Out", String(remainingTime) + "s");
+            if (getAuthMode() == Config::TWO_FACTOR && !auth.is_fp_locked_out) {
+                displayMessage("PIN Locked Out", formatLine(line, "%lus", remainingTime), 2000);
             } else {
-                displayMessage("PIN Locked " + String(remainingTime) + "s", "");
+                displayMessage(formatLine(line, "PIN Locked %lus", remainingTime), "", 2000);
             }
             soundBuzzer(1);
-            delay(2000);
-            showReadyScreen();
             return;
         } else {
-            is_pin_locked_out = false;
-            wrong_pin_attempts = 0;
+            auth.is_pin_locked_out = false;
+            auth.wrong_pin_attempts = 0;
         }
     }
     
     // Rest of the existing handleKeypad code...
     if(key == '*') {
         if(++star_count >= Config::STAR_THRESHOLD) {
-            changePassword();
-            star_count = 0;
+            enterMenu(MENU_PIN_CURRENT);
         } else {
-            input_length = 0;
+            pin_entry.clear();
             showReadyScreen();
         }
         return;
@@ -452,67 +1473,21 @@ void IRAM_ATTR handleKeypad() {
     if (key == '#') {
         hash_count++;
         if (hash_count >= 12) {
-            // First verify PIN
-            String verifyPin = getInput("  PIN Required", '#', '*', true);
-            
-            if (verifyPin != getPassword()) {
-                displayMessage("Access Denied", "", 2000);
-                showReadyScreen();
-                hash_count = 0;
-                input_length = 0;
-                return;
-            }
-            
-            displayMessage("Menu:", "1:FP 2:Auth *:Exit");
-            while (true) {
-                char choice = keypad.getKey();
-                if (choice == '1') {
-                    // Show FP submenu
-                    displayMessage("1:Enroll 2:Del", "*:Back");
-                    while (true) {
-                        char fpChoice = keypad.getKey();
-                        if (fpChoice == '1') {
-                            enrollFingerprint();
-                            break;
-                        } else if (fpChoice == '2') {
-                            deleteFingerprint();
-                            break;
-                        } else if (fpChoice == '*') {
-                            displayMessage("Menu:", "1:FP 2:Auth *:Exit");
-                            break;
-                        }
-                        delay(10);
-                    }
-                    break;
-                } else if (choice == '2') {
-                    // Toggle authentication mode
-                    Config::AuthMode currentMode = getAuthMode();
-                    Config::AuthMode newMode = currentMode == Config::SINGLE_FACTOR ? Config::TWO_FACTOR : Config::SINGLE_FACTOR;
-                    setAuthMode(newMode);
-                    displayMessage(newMode == Config::TWO_FACTOR ? "2FA Enabled" : "2FA Disabled", "", 2000);
-                    showReadyScreen();
-                    break;
-                } else if (choice == '*') {
-                    showReadyScreen();
-                    break;
-                }
-                delay(10);
-            }
-            hash_count = 0;
+            enterMenu(MENU_ADMIN_PIN);
             return;
         }
-        if (input_length > 0) {
+        if (pin_entry.length() > 0) {
             checkPassword();
         }
-        input_length = 0;
+        pin_entry.clear();
         return;
     }
 
     hash_count = 0;  // Reset hash counter on any other key
-    if (input_length < Config::PIN_LENGTH) {
-        input_password[input_length++] = key;
+    if (pin_entry.length() < Config::PIN_LENGTH) {
+        bool complete = pin_entry.add(users.salt(), key);
         displayMaskedInput();
-        if (input_length >= Config::PIN_LENGTH) {
+        if (complete) {
             checkPassword();
         }
     }
@@ -520,362 +1495,1153 @@ void IRAM_ATTR handleKeypad() {
 }
 
 void handleInactivity() {
+    if (serial_transfer) last_activity = millis();  // A host is provisioning; stay up
+    if (relay.unlocked() || relay.doorIsOpen()) last_activity = millis();  // Door events need us awake
+    if (menu_active) last_activity = millis();  // The menu's own timeout closes it first
     if (millis() - last_activity > Config::INACTIVITY_TIME) {
         // First dim the LCD
-        lcd.noBacklight();
+        setBacklight(false);
         
         // If another 5 seconds pass with no activity, go to deep sleep
-        if (millis() - last_activity > Config::INACTIVITY_TIME + 5000) {
+        if (millis() - last_activity > Config::INACTIVITY_TIME + 5000 && !scheduler.pending(sleep_timer) &&
+            networkIdle()) {
             displayMessage("Enter Sleep", "Mode...");
-            delay(1000);
-            lcd.noBacklight();
-            lcd.noDisplay();
-            
-            // Configure column pins as outputs driving HIGH and enable hold
-            for (uint8_t pin : {27, 14, 12}) {  // Column pins
-                pinMode(pin, OUTPUT);
-                digitalWrite(pin, HIGH);
-                rtc_gpio_init((gpio_num_t)pin);
-                rtc_gpio_set_direction((gpio_num_t)pin, RTC_GPIO_MODE_OUTPUT_ONLY);
-                rtc_gpio_set_level((gpio_num_t)pin, 1);
-                rtc_gpio_hold_en((gpio_num_t)pin);
-            }
+            sleep_timer = scheduler.schedule(millis(), 1000, enterDeepSleep);
+        }
+    } else {
+        setBacklight(true);
+    }
+}
 
-            // Configure row pins for keypad wake-up
-            const uint64_t row_pin_mask = (1ULL << 32) | (1ULL << 33) | (1ULL << 25) | (1ULL << 26);
-            for (uint8_t pin : {32, 33, 25, 26}) {
-                rtc_gpio_init((gpio_num_t)pin);
-                rtc_gpio_set_direction((gpio_num_t)pin, RTC_GPIO_MODE_INPUT_ONLY);
-                rtc_gpio_pulldown_en((gpio_num_t)pin);
-                rtc_gpio_pullup_dis((gpio_num_t)pin);
-                rtc_gpio_hold_en((gpio_num_t)pin);
+// With the EXT1 fallback the columns sleep driven high and EXT1 fires on the
+// row a key connects them to. That names the row; driving one column at a time
+// names the column. Returns the matrix index, or -1 if the key was already
+// released (or the mask matches no row).
+int8_t decodeWakeKey(uint64_t rowMask) {
+    for (byte r = 0; r < ROWS; r++) pinMode(rowPins[r], INPUT_PULLDOWN);
+    for (byte c = 0; c < COLS; c++) pinMode(colPins[c], INPUT_PULLDOWN);
+
+    int8_t index = -1;
+    for (byte c = 0; c < COLS && index < 0; c++) {
+        pinMode(colPins[c], OUTPUT);
+        digitalWrite(colPins[c], HIGH);
+        delayMicroseconds(10);  // Small delay for signal to stabilize
+        for (byte r = 0; r < ROWS; r++) {
+            if ((rowMask & (1ULL << rowPins[r])) && digitalRead(rowPins[r]) == HIGH) {
+                index = r * COLS + c;
+                break;
             }
-            
-            // Enable both wake-up sources: GPIO23 (EXT0) and keypad rows (EXT1)
-            esp_sleep_enable_ext0_wakeup((gpio_num_t)PinConfig::WAKE_PIN, 1); // GPIO23 wake on HIGH
-            esp_sleep_enable_ext1_wakeup(row_pin_mask, ESP_EXT1_WAKEUP_ANY_HIGH); // Keypad wake on ANY HIGH
-            
-            esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
-            
-            Serial.println("Entering deep sleep...");
-            Serial.flush();
-            
-            // Release all RTC GPIO holds before sleep
-            rtc_gpio_hold_dis((gpio_num_t)27);
-            rtc_gpio_hold_dis((gpio_num_t)14);
-            rtc_gpio_hold_dis((gpio_num_t)12);
-            for (uint8_t pin : {32, 33, 25, 26}) {
-                rtc_gpio_hold_dis((gpio_num_t)pin);
-            }
-            
-            delay(100);
-            esp_deep_sleep_start();
         }
+        pinMode(colPins[c], INPUT_PULLDOWN);
+    }
+
+    if (index >= 0) wake_key_held = 1UL << index;
+    return index;
+}
+
+void enterDeepSleep() {
+    // Someone touched the keypad or sensor while the sleep notice was showing
+    if (millis() - last_activity <= Config::INACTIVITY_TIME + 5000) {
+        showReadyScreen();
+        return;
+    }
+
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::SLEEP;
+    postDisplay(cmd);
+    while (uxQueueMessagesWaiting(display_queue) > 0) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+
+    // A PIN or mode change still waiting out its commit delay must not be lost
+    settings.flush();
+    fp_index.flush();
+    fp_stats.flush();
+    access_log.flush();
+    restartIfStaged();
+
+    // The keypad pins are about to be handed to the RTC domain; their light-sleep
+    // wake configuration must not leak into deep sleep
+    matrix_keypad.stop();
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+    vTaskSuspend(keypad_task);
+    
+    // Columns go to the RTC domain as outputs. The ULP raises them one at a
+    // time and wants them idling low; the EXT1 fallback drives them all high
+    // so any key raises its row.
+    for (uint8_t pin : colPins) {
+        rtc_gpio_init((gpio_num_t)pin);
+        rtc_gpio_set_direction((gpio_num_t)pin, RTC_GPIO_MODE_OUTPUT_ONLY);
+        rtc_gpio_set_level((gpio_num_t)pin, 0);
+    }
+
+    // Rows read the key through their pull-downs
+    for (uint8_t pin : rowPins) {
+        rtc_gpio_init((gpio_num_t)pin);
+        rtc_gpio_set_direction((gpio_num_t)pin, RTC_GPIO_MODE_INPUT_ONLY);
+        rtc_gpio_pulldown_en((gpio_num_t)pin);
+        rtc_gpio_pullup_dis((gpio_num_t)pin);
+    }
+
+    // The touch line is read from the RTC domain too, by the ULP or by EXT0
+    rtc_gpio_init((gpio_num_t)PinConfig::WAKE_PIN);
+    rtc_gpio_set_direction((gpio_num_t)PinConfig::WAKE_PIN, RTC_GPIO_MODE_INPUT_ONLY);
+
+    // The ULP debounces and buffers keys and wakes us only for a real press
+    bool ulp_wake = Config::ULP_KEYPAD &&
+                    ulp_keypad.start(rowPins, colPins, PinConfig::WAKE_PIN, Config::ULP_DEBOUNCE_SAMPLES,
+                                     Config::ULP_SAMPLE_PERIOD_US) == ESP_OK;
+    if (ulp_wake) {
+        esp_sleep_enable_ulp_wakeup();
     } else {
-        lcd.backlight();
+        for (uint8_t pin : colPins) rtc_gpio_set_level((gpio_num_t)pin, 1);
+        esp_sleep_enable_ext1_wakeup(PinConfig::KEYPAD_ROW_PINS, ESP_EXT1_WAKEUP_ANY_HIGH); // Keypad wake on ANY HIGH
     }
+
+    // The ULP watches the touch line alongside the keys; without it EXT0 does
+    if (!ulp_wake || !ulp_keypad.touchWatched()) {
+        esp_err_t err = esp_sleep_enable_ext0_wakeup((gpio_num_t)PinConfig::WAKE_PIN, 1); // Wake on HIGH
+        if (err != ESP_OK) Serial.printf("No touch wake from deep sleep: %s\n", esp_err_to_name(err));
+    }
+    
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    armNetworkWake();
+    
+    Serial.printf("Entering deep sleep (%s keypad wake)...\n", ulp_wake ? "ULP" : "EXT1");
+    Serial.flush();
+    
+    delay(100);
+    esp_deep_sleep_start();
 }
 
 void displayMaskedInput() {
-    static String lastInput = "";
-    String currentInput = String(input_password).substring(0, input_length);
-    if (currentInput != lastInput) {
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("      PIN:");
-        lcd.setCursor(4, 1);
-        // Display empty circles for remaining spaces
-        for(int i = 0; i < Config::PIN_LENGTH; i++) {
-            if (i < input_length) {
-                lcd.write(6);  // Filled circle character
-            } else {
-                lcd.write(5);  // Empty circle character
-            }
-        }
-        lastInput = currentInput;
-    }
+    // PIN entry takes over the screen from any held message
+    scheduler.cancel(ready_screen_timer);
+    ready_screen_active = false;
+
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::PIN_ENTRY;
+    strncpy(cmd.line1, "      PIN:", sizeof(cmd.line1) - 1);
+    cmd.count = pin_entry.length();
+    cmd.masked = true;
+    postDisplay(cmd);
 }
 
-void playTone(const uint16_t freq, const uint32_t dur) {
-    ledcSetup(PinConfig::BUZZER_CHANNEL, static_cast<uint32_t>(freq), PinConfig::BUZZER_RESOLUTION);
-    ledcWrite(PinConfig::BUZZER_CHANNEL, 127); // 50% duty cycle
-    delay(dur);
-    ledcWrite(PinConfig::BUZZER_CHANNEL, 0);
+// Patterns for soundBuzzer(), indexed by its argument
+constexpr ToneSequencer::Step successTones[] = {{1800, 100, 100}, {2000, 100, 0}};  // Ascending
+constexpr ToneSequencer::Step errorTones[] = {{400, 200, 100}, {350, 200, 100}, {300, 200, 0}};  // Falling, low
+constexpr ToneSequencer::Step warningTones[] = {{1800, 150, 200}, {1200, 150, 0}};  // Alternating
+// SOS at a low pitch: 3 short, 3 long, 3 short
+constexpr ToneSequencer::Step alarmTones[] = {
+    {800, 100, 100}, {800, 100, 100}, {800, 100, 300},
+    {800, 300, 100}, {800, 300, 100}, {800, 300, 300},
+    {800, 100, 100}, {800, 100, 100}, {800, 100, 0}
+};
+constexpr ToneSequencer::Pattern tone_patterns[] = {
+    ToneSequencer::pattern(successTones),
+    ToneSequencer::pattern(errorTones),
+    ToneSequencer::pattern(warningTones),
+    ToneSequencer::pattern(alarmTones),
+};
+
+// Callable from any task; returns at once while the pattern plays on the
+// esp_timer task. A new pattern pre-empts whatever is still playing.
+void soundBuzzer(int pattern) {
+    if (pattern < 0 || pattern >= static_cast<int>(sizeof(tone_patterns) / sizeof(tone_patterns[0]))) return;
+    tones.play(tone_patterns[pattern]);
 }
 
-void noTone() {
-    ledcWrite(PinConfig::BUZZER_CHANNEL, 0);
+// Messages are literals in flash or formatted into a LineBuffer on the caller's
+// stack; either way they are copied into the command, never onto the heap
+void displayMessage(const char *line1, const char *line2, int holdTime) {
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::MESSAGE;
+    strncpy(cmd.line1, line1, sizeof(cmd.line1) - 1);
+    strncpy(cmd.line2, line2, sizeof(cmd.line2) - 1);
+    postDisplay(cmd);
+
+    ready_screen_active = false;
+    // A held message returns to the ready screen by itself; anything drawn over
+    // it in the meantime cancels the pending restore
+    if (holdTime > 0) {
+        scheduler.arm(ready_screen_timer, millis(), holdTime, showReadyScreen);
+    } else {
+        scheduler.cancel(ready_screen_timer);
+    }
 }
 
-void soundBuzzer(int pattern) {
-    struct BuzzerPattern {
-        uint16_t frequency;  // Frequency in Hz
-        uint16_t duration;   // Duration in ms
-        uint16_t pause;      // Pause after beep in ms
-        uint8_t count;       // Number of beeps
-    };
-    
-    static const BuzzerPattern patterns[] = {
-        {2000, 100, 100, 2},  // Success - high pitched ascending beeps
-        {400, 200, 100, 3},   // Error - very low pitched beeps (changed from 1000 to 400 Hz)
-        {1500, 150, 200, 2},  // Warning - medium pitched alternating beeps
-        {800, 100, 50, 9}     // Alarm - SOS pattern with low pitch
+const char *formatLine(LineBuffer &line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    return line;
+}
+
+// ---------------------------------------------------------------------------
+// Menus (loop task)
+// ---------------------------------------------------------------------------
+
+// The admin menu and the PIN change flow are one table of screens. Keys and
+// sensor results reach them through the loop like any other event, so timed
+// actions, inactivity and the relay keep running, and a menu left alone closes
+// after its timeout.
+struct MenuScreen {
+    enum Kind : uint8_t {
+        CHOICE,  // Single keys, looked up in menu_choices
+        ENTRY,   // Digits until '#', '*' clears
+        WAIT     // A fingerprint task result, or the timeout
     };
-    
-    switch(pattern) {
-        case 0: // Success - ascending beeps
-            playTone(1800, patterns[0].duration);
-            delay(patterns[0].pause);
-            playTone(2000, patterns[0].duration);
-            break;
-            
-        case 1: // Error - low pitched beeps
-            for(int i = 0; i < patterns[1].count; i++) {
-                playTone(400 - (i * 50), patterns[1].duration); // Starting at 400Hz and going lower
-                delay(patterns[1].pause);
-            }
-            break;
-            
-        // ...existing warning and alarm cases...
-        case 2: // Warning - alternating beeps
-            for(int i = 0; i < patterns[2].count; i++) {
-                playTone(i % 2 ? 1200 : 1800, patterns[2].duration);
-                delay(patterns[2].pause);
+    Kind kind;
+    const char *line1;
+    const char *line2;                                  // CHOICE only
+    bool masked;                                        // ENTRY only
+    InputEvent::Type awaits;                            // WAIT only
+    uint32_t timeout;                                   // Idle time before the menu gives up
+    MenuState (*entered)(const char *input);            // ENTRY: '#' pressed
+    MenuState (*finished)(const InputEvent *result);    // WAIT: result, or null on timeout
+};
+
+struct MenuChoice {
+    MenuState state;
+    char key;
+    MenuState next;
+    void (*action)();                                   // Runs before the move, may be null
+};
+
+MenuState onAdminPin(const char *pin) {
+    const Users::User *user = enabledUser(pin);
+    if (!user) {
+        pinStrike(Users::NONE);
+        return MENU_CLOSED;
+    }
+    auth.wrong_pin_attempts = 0;
+    if (user->role == Users::ADMIN) {
+        menu_user = user->id;
+        logEvent(EventLog::ADMIN_MENU, user->id);
+        return MENU_MAIN;
+    }
+    logEvent(EventLog::PIN_DENIED, user->id);
+    displayMessage("Access Denied", "", 2000);
+    return MENU_CLOSED;
+}
+
+void toggleAuthMode() {
+    Config::AuthMode mode = getAuthMode() == Config::SINGLE_FACTOR ? Config::TWO_FACTOR : Config::SINGLE_FACTOR;
+    setAuthMode(mode);
+    displayMessage(mode == Config::TWO_FACTOR ? "2FA Enabled" : "2FA Disabled", "", 2000);
+}
+
+// Both ID screens close on an ID the sensor has no page for
+bool menuTemplateId(const char *input) {
+    LineBuffer line;
+    if (parseTemplateId(input, menu_id)) return true;
+    displayMessage("Invalid ID!", formatLine(line, "Use 1..%u", fp_capacity - 1), 2000);
+    return false;
+}
+
+MenuState onEnrollId(const char *input) {
+    return menuTemplateId(input) ? MENU_ENROLL_OWNER : MENU_CLOSED;
+}
+
+// Empty: the admin at the keypad
+MenuState onEnrollOwner(const char *input) {
+    LineBuffer line;
+    menu_owner = input[0] ? atoi(input) : menu_user;
+    if (!users.user(menu_owner)) {
+        displayMessage("No Such User", "Try Again", 2000);
+        return MENU_CLOSED;
+    }
+    displayMessage(formatLine(line, "Enrolling ID:%u", menu_id), "Place Finger");
+    postFingerprintCommand(FingerprintCommand::ENROLL, FingerprintCommand::DETECT_ONLY, menu_id);
+    return MENU_ENROLL_WAIT;
+}
+
+MenuState onEnrollDone(const InputEvent *result) {
+    LineBuffer line;
+    switch (result ? result->status : static_cast<uint8_t>(ENROLL_TIMEOUT)) {
+        case ENROLL_OK:
+            if (bindEnrolled(menu_id, menu_owner) != Users::OK) {
+                displayMessage("Storage Failed!", "Not Enrolled", 2000);
+                break;
             }
+            displayMessage("Success!", formatLine(line, "ID #%u", menu_id), 2000);
             break;
-            
-        case 3: // Alarm - SOS pattern
-            // 3 short beeps
-            for(int i = 0; i < 3; i++) {
-                playTone(800, 100);
-                delay(100);
+        case ENROLL_IMAGE_ERROR:  displayMessage("Image Error", "Try Again", 2000); break;
+        case ENROLL_TIMEOUT:      displayMessage("Timeout!", "Try Again", 2000); break;
+        case ENROLL_MODEL_FAILED: displayMessage("Failed!", "Try Again", 2000); break;
+        default:                  displayMessage("Storage Failed!", "Try Again", 2000); break;
+    }
+    return MENU_CLOSED;
+}
+
+MenuState onDeleteId(const char *input) {
+    if (!menuTemplateId(input)) return MENU_CLOSED;
+    postFingerprintCommand(FingerprintCommand::DELETE, FingerprintCommand::DETECT_ONLY, menu_id);
+    return MENU_DELETE_WAIT;
+}
+
+MenuState onDeleteDone(const InputEvent *result) {
+    LineBuffer line;
+    if (result && result->status == FINGERPRINT_OK) {
+        // The template is gone either way; a stale owner is overwritten by the next enroll
+        if (users.bind(menu_id, Users::NONE) != Users::OK) displayMessage("Storage Failed!", formatLine(line, "ID %u Deleted", menu_id), 2000);
+        else displayMessage("Deleted ID:", formatLine(line, "%u", menu_id), 2000);
+    } else {
+        displayMessage("Failed to Delete", "Try Again", 2000);
+    }
+    return MENU_CLOSED;
+}
+
+// The PIN change is for whoever's PIN this is
+MenuState onCurrentPin(const char *pin) {
+    const Users::User *user = enabledUser(pin);
+    if (!user) {
+        pinStrike(Users::NONE);
+        return MENU_CLOSED;
+    }
+    auth.wrong_pin_attempts = 0;
+    menu_user = user->id;
+    return MENU_PIN_NEW;
+}
+
+// The keypad only accepts a full-length PIN, so a shorter one would lock everyone out
+MenuState onNewPin(const char *pin) {
+    if (!PinHash::wellFormed(pin)) {
+        displayMessage("   PIN Error", "   No Change", 2000);
+        return MENU_CLOSED;
+    }
+    memcpy(menu_new_pin, pin, sizeof(menu_new_pin));
+    return MENU_PIN_CONFIRM;
+}
+
+MenuState onConfirmPin(const char *pin) {
+    if (strcmp(pin, menu_new_pin) != 0) {
+        displayMessage("PINs Don't Match", "No Change", 2000);
+        return MENU_CLOSED;
+    }
+    switch (users.setPin(menu_user, menu_new_pin)) {
+        case Users::OK:         displayMessage("  PIN Updated", "", 2000); break;
+        case Users::PIN_IN_USE: displayMessage("   PIN In Use", "   No Change", 2000); break;
+        default:                displayMessage("Storage Failed!", "   No Change", 2000); break;
+    }
+    return MENU_CLOSED;
+}
+
+constexpr uint32_t MENU_SENSOR_TIMEOUT = 2UL * Config::FINGERPRINT_TIMEOUT_MS + 10000;  // Two captures and a store
+
+// Indexed by MenuState
+const MenuScreen menu_screens[MENU_STATE_COUNT] = {
+    /* CLOSED */       {MenuScreen::CHOICE, nullptr, nullptr, false, InputEvent::KEY, 0, nullptr, nullptr},
+    /* ADMIN_PIN */    {MenuScreen::ENTRY, "  PIN Required", nullptr, true, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onAdminPin, nullptr},
+    /* MAIN */         {MenuScreen::CHOICE, "Menu:", "1:FP 2:Auth *:Exit", false, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, nullptr, nullptr},
+    /* FP */           {MenuScreen::CHOICE, "1:Enroll 2:Del", "*:Back", false, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, nullptr, nullptr},
+    /* ENROLL_ID */    {MenuScreen::ENTRY, "Enroll ID:", nullptr, false, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onEnrollId, nullptr},
+    /* ENROLL_OWNER */ {MenuScreen::ENTRY, "Owner (#=me):", nullptr, false, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onEnrollOwner, nullptr},
+    /* ENROLL_WAIT */  {MenuScreen::WAIT, nullptr, nullptr, false, InputEvent::FP_ENROLL_DONE, MENU_SENSOR_TIMEOUT, nullptr, onEnrollDone},
+    /* DELETE_ID */    {MenuScreen::ENTRY, "Delete ID:", nullptr, false, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onDeleteId, nullptr},
+    /* DELETE_WAIT */  {MenuScreen::WAIT, nullptr, nullptr, false, InputEvent::FP_DELETE_DONE, MENU_SENSOR_TIMEOUT, nullptr, onDeleteDone},
+    /* PIN_CURRENT */  {MenuScreen::ENTRY, "  Current PIN:", nullptr, true, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onCurrentPin, nullptr},
+    /* PIN_NEW */      {MenuScreen::ENTRY, "    New PIN:", nullptr, true, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onNewPin, nullptr},
+    /* PIN_CONFIRM */  {MenuScreen::ENTRY, "Confirm New PIN:", nullptr, true, InputEvent::KEY, Config::MENU_IDLE_TIMEOUT, onConfirmPin, nullptr},
+};
+
+const MenuChoice menu_choices[] = {
+    {MENU_MAIN, '1', MENU_FP, nullptr},
+    {MENU_MAIN, '2', MENU_CLOSED, toggleAuthMode},
+    {MENU_MAIN, '*', MENU_CLOSED, showReadyScreen},
+    {MENU_FP, '1', MENU_ENROLL_ID, nullptr},
+    {MENU_FP, '2', MENU_DELETE_ID, nullptr},
+    {MENU_FP, '*', MENU_MAIN, nullptr},
+};
+
+void drawMenuEntry() {
+    const MenuScreen &page = menu_screens[menu_state];
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::PIN_ENTRY;
+    strncpy(cmd.line1, page.line1, sizeof(cmd.line1) - 1);
+    cmd.count = menu_input_length;
+    cmd.masked = page.masked;
+    if (!page.masked) strncpy(cmd.line2, menu_input, sizeof(cmd.line2) - 1);
+    postDisplay(cmd);
+}
+
+// Opening, moving within and closing the menu all come through here
+void enterMenu(MenuState state) {
+    // The PIN prompts are as locked out as the keypad
+    if ((state == MENU_ADMIN_PIN || state == MENU_PIN_CURRENT) && auth.is_pin_locked_out &&
+        lockoutRemaining(auth.pin_lockout_start) > 0) {
+        LineBuffer line;
+        displayMessage(formatLine(line, "PIN Locked %" PRIu32 "s", lockoutRemaining(auth.pin_lockout_start) / 1000), "", 2000);
+        soundBuzzer(1);
+        state = MENU_CLOSED;
+    }
+    bool wasOpen = menu_active;
+    menu_state = state;
+    menu_active = state != MENU_CLOSED;
+    memset(menu_input, 0, sizeof(menu_input));
+    menu_input_length = 0;
+    if (!menu_active) {
+        memset(menu_new_pin, 0, sizeof(menu_new_pin));
+        menu_user = Users::NONE;
+        scheduler.cancel(menu_timer);
+        pin_entry.clear();
+        star_count = hash_count = 0;
+        last_activity = millis();
+        if (wasOpen) updateFingerprintMode();
+        return;
+    }
+    if (!wasOpen) updateFingerprintMode();
+
+    const MenuScreen &page = menu_screens[state];
+    scheduler.arm(menu_timer, millis(), page.timeout, onMenuTimeout);
+    if (page.kind == MenuScreen::CHOICE) {
+        displayMessage(page.line1, page.line2);
+    } else if (page.kind == MenuScreen::ENTRY) {
+        scheduler.cancel(ready_screen_timer);
+        ready_screen_active = false;
+        drawMenuEntry();
+    }
+    // WAIT screens keep whatever the step before them put up
+}
+
+void handleMenuKey(char key) {
+    const MenuScreen &page = menu_screens[menu_state];
+    switch (page.kind) {
+        case MenuScreen::CHOICE:
+            scheduler.arm(menu_timer, millis(), page.timeout, onMenuTimeout);
+            for (const MenuChoice &choice : menu_choices) {
+                if (choice.state == menu_state && choice.key == key) {
+                    if (choice.action) choice.action();
+                    enterMenu(choice.next);
+                    return;
+                }
             }
-            delay(200);
-            
-            // 3 long beeps
-            for(int i = 0; i < 3; i++) {
-                playTone(800, 300);
-                delay(100);
+            return;
+
+        case MenuScreen::ENTRY:
+            scheduler.arm(menu_timer, millis(), page.timeout, onMenuTimeout);
+            if (key == '#') {
+                enterMenu(page.entered(menu_input));
+                return;
             }
-            delay(200);
-            
-            // 3 short beeps
-            for(int i = 0; i < 3; i++) {
-                playTone(800, 100);
-                delay(100);
+            if (key == '*') {
+                menu_input_length = 0;
+            } else if (menu_input_length < Config::PIN_LENGTH) {
+                menu_input[menu_input_length++] = key;
+            } else {
+                return;
             }
-            break;
+            menu_input[menu_input_length] = '\0';
+            drawMenuEntry();
+            return;
+
+        case MenuScreen::WAIT:
+            return;  // Nothing to type until the sensor answers
     }
-    ledcWrite(PinConfig::BUZZER_CHANNEL, 0); // Ensure buzzer is off after pattern
 }
 
-void displayMessage(String line1, String line2, int delayTime) {
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(line1);
-    lcd.setCursor(0, 1);
-    lcd.print(line2);
-    delayTime > 0 ? delay(delayTime) : (void)0;
+// Sensor reports while a menu is open: only the result a WAIT screen expects counts
+void handleMenuResult(const InputEvent &event) {
+    const MenuScreen &page = menu_screens[menu_state];
+    if (page.kind == MenuScreen::WAIT && event.type == page.awaits) {
+        enterMenu(page.finished(&event));
+    }
 }
 
-bool initFingerprint() {
-    return finger.verifyPassword() ? (finger.getParameters(), true) :
-           (displayMessage("Sensor Error!", "Trying alt pass..."),
-            finger.setPassword(0x00000000),
-            finger.verifyPassword() ? (finger.getParameters(), true) : false);
+void onMenuTimeout() {
+    const MenuScreen &page = menu_screens[menu_state];
+    if (page.kind == MenuScreen::WAIT) {
+        enterMenu(page.finished(nullptr));
+        return;
+    }
+    displayMessage("  Menu Closed", "", 2000);
+    enterMenu(MENU_CLOSED);
 }
 
-void showReadyScreen() {
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    
-    if (is_pin_locked_out || is_fp_locked_out) {
-        lcd.write(4);  // Error lock character
-    } else if (pin_verified && !fingerprint_verified && getAuthMode() == Config::TWO_FACTOR) {
-        lcd.write(3);  // Half-lock character for 2FA waiting state
+// ---------------------------------------------------------------------------
+// Serial console (loop task)
+// ---------------------------------------------------------------------------
+
+bool parseTemplateId(Print &out, uint8_t argc, char **argv, uint16_t &id) {
+    if (argc < 2 || !parseTemplateId(argv[1], id)) {
+        out.printf("ERR id must be 1..%u\n", fp_capacity - 1);
+        return false;
+    }
+    return true;
+}
+
+void cmdStatus(Print &out, uint8_t, char **) {
+    LineBuffer line;
+    out.printf("uptime %lus (%s boot)\n", millis() / 1000, warm_start ? "warm" : "cold");
+    out.printf("auth mode: %s\n", getAuthMode() == Config::TWO_FACTOR ? "2fa" : "single");
+    out.printf("pin strikes: %d%s\n", auth.wrong_pin_attempts,
+               auth.is_pin_locked_out ? formatLine(line, ", locked %" PRIu32 "s", lockoutRemaining(auth.pin_lockout_start) / 1000) : "");
+    out.printf("fp strikes: %d%s\n", auth.wrong_fp_attempts,
+               auth.is_fp_locked_out ? formatLine(line, ", locked %" PRIu32 "s", lockoutRemaining(auth.fp_lockout_start) / 1000) : "");
+    out.printf("relay: %s, %u grants%s\n", relay.unlocked() ? "open" : "locked", relay.grants(),
+               PinConfig::DOOR_SENSOR < 0 ? "" : relay.doorIsOpen() ? ", door open" : ", door shut");
+    out.printf("sensor: %s, capacity %u\n", warm_boot.fp_ready ? "ready" : "not responding", fp_capacity);
+#ifdef LOCKER_NETWORK
+    printNetworkStatus(out);
+#endif
+    if (fp_index.data.known) {
+        out.printf("templates: pages below %u in use\n", fp_index.data.span());
     } else {
-        lcd.write(0);  // Normal lock character
+        out.println("templates: layout unknown");
     }
-    lcd.print("    Ready");
+}
 
-    // In 2FA mode, show verification status with progress bars
-    if (getAuthMode() == Config::TWO_FACTOR) {
-        lcd.setCursor(0, 1);
-        lcd.print("P:");
-        // Display three segments for PIN progress
-        for (int i = 0; i < 3; i++) {
-            lcd.write(pin_verified ? 6 : 5);  // filled or empty circle for progress indicator
+void cmdStats(Print &out, uint8_t, char **) {
+    out.printf("keypad overruns: %u\n", matrix_keypad.overruns());
+    out.printf("flash commits: settings %u, template index %u, users %u\n", settings.commitCount(),
+               fp_index.commitCount(), users.commitCount());
+    out.printf("matches recorded: %u\n", fp_index.data.clock);
+    out.printf("access log: %" PRIu32 " events, %u unwritten, %" PRIu32 " dropped, %" PRIu32 " page writes\n", access_log.newest(),
+               access_log.unwritten(), access_log.dropped(), access_log.pageWrites());
+}
+
+// Section bounds from the linker script
+extern "C" char _iram_start[], _iram_end[], _data_start[], _heap_start[];
+
+void printStack(Print &out, const char *name, TaskHandle_t task, uint32_t size) {
+    if (task) out.printf("  %-12s %6" PRIu32 " %6u\n", name, size, unsigned(uxTaskGetStackHighWaterMark(task)));
+}
+
+// Where the memory goes. Printed at cold start and by the mem command; the
+// stack figures are low-water marks, so they only shrink as paths get used.
+void printMemoryReport(Print &out) {
+    out.printf("heap: %u free of %u, %u lowest, largest block %u\n", ESP.getFreeHeap(), ESP.getHeapSize(),
+               ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+    out.printf("iram: %u bytes of ISR and system code\n", unsigned(_iram_end - _iram_start));
+    out.printf("dram: %u bytes static\n", unsigned(_heap_start - _data_start));
+    size_t queues = input_queue_storage.BYTES + display_queue_storage.BYTES + fp_command_queue_storage.BYTES +
+                    fp_plan_queue_storage.BYTES;
+    size_t stacks = fingerprint_task_storage.BYTES + keypad_task_storage.BYTES + display_task_storage.BYTES;
+#ifdef LOCKER_NETWORK
+    queues += net_queue_storage.BYTES;
+    stacks += net_task_storage.BYTES;
+#endif
+    out.printf("  task stacks %u, queues %u, access log %u, template index %u, match stats %u, lcd %u\n",
+               unsigned(stacks), unsigned(queues), unsigned(sizeof(access_log)), unsigned(sizeof(fp_index)),
+               unsigned(sizeof(fp_stats)), unsigned(sizeof(screen)));
+    out.println("stack          size unused");
+    printStack(out, "fingerprint", fingerprint_task, TaskConfig::FP_STACK);
+    printStack(out, "keypad", keypad_task, TaskConfig::KEYPAD_STACK);
+    printStack(out, "display", display_task, TaskConfig::DISPLAY_STACK);
+#ifdef LOCKER_NETWORK
+    printStack(out, "net", net_task, TaskConfig::NET_STACK);
+#endif
+    printStack(out, "loop", xTaskGetCurrentTaskHandle(), getArduinoLoopTaskStackSize());
+}
+
+void cmdMem(Print &out, uint8_t, char **) {
+    printMemoryReport(out);
+}
+
+// Milliseconds with one decimal from microseconds
+void printMs(Print &out, uint32_t us) {
+    out.printf(" %6" PRIu32 ".%01" PRIu32, us / 1000, (us % 1000) / 100);
+}
+
+// perf: summary table; perf <stage>: its buckets; perf reset, after a login
+void cmdPerf(Print &out, uint8_t argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        if (!console.loggedIn(millis())) {
+            out.println("ERR login required");
+            return;
         }
-        lcd.print(" F:");
-        // Display three segments for Fingerprint progress
-        for (int i = 0; i < 3; i++) {
-            lcd.write(fingerprint_verified ? 6 : 5);  // filled or empty circle for progress indicator
+        for (LatencyHistogram &h : perf) h.reset();
+        out.println("OK");
+        return;
+    }
+    if (argc > 1) {
+        for (uint8_t s = 0; s < PERF_STAGE_COUNT; s++) {
+            if (strcmp(argv[1], perf_names[s]) != 0) continue;
+            for (uint8_t n = 0; n < LatencyHistogram::BUCKETS; n++) {
+                if (perf[s].bucket(n)) out.printf("< %8lu us: %" PRIu32 "\n", 2UL << n, perf[s].bucket(n));
+            }
+            return;
         }
+        out.println("ERR unknown stage");
+        return;
+    }
+    out.printf("cpu %u MHz; times in ms, percentiles to a power of two\n", getCpuFrequencyMhz());
+    out.println("stage          count     min     p50     p90     max    mean");
+    for (uint8_t s = 0; s < PERF_STAGE_COUNT; s++) {
+        const LatencyHistogram &h = perf[s];
+        out.printf("%-12s %7" PRIu32, perf_names[s], h.count());
+        printMs(out, h.fastest());
+        printMs(out, h.percentile(50));
+        printMs(out, h.percentile(90));
+        printMs(out, h.slowest());
+        printMs(out, h.mean());
+        out.println();
     }
 }
 
-uint8_t getFingerprintID() {
-    // Check if fingerprint is locked out but still allow PIN input in 2FA mode
-    if (is_fp_locked_out) {
-        if (millis() - fp_lockout_start < Config::LOCKOUT_TIME) {
-            // Only show lockout message if actively trying to use fingerprint
-            if (finger.getImage() == FINGERPRINT_OK) {
-                unsigned long remainingTime = (Config::LOCKOUT_TIME - (millis() - fp_lockout_start)) / 1000;
-                displayMessage("FP Locked Out", String(remainingTime) + "s");
-                soundBuzzer(1);
-                delay(2000);
-                showReadyScreen();
-            }
-            return 0;
-        } else {
-            is_fp_locked_out = false;
-            wrong_fp_attempts = 0;
+// enroll <id> [user]: the template goes to user, or to the admin logged in
+void cmdEnroll(Print &out, uint8_t argc, char **argv) {
+    uint16_t id;
+    if (!parseTemplateId(out, argc, argv, id)) return;
+    uint16_t owner = argc > 2 ? atoi(argv[2]) : console_user;
+    if (!users.user(owner)) {
+        out.println("ERR no such user");
+        return;
+    }
+    console_enroll_owner = owner;
+    postFingerprintCommand(FingerprintCommand::ENROLL, FingerprintCommand::DETECT_ONLY, id);
+    out.printf("Enrolling ID %u: place finger on the sensor\n", id);
+}
+
+void cmdDelete(Print &out, uint8_t argc, char **argv) {
+    uint16_t id;
+    if (!parseTemplateId(out, argc, argv, id)) return;
+    postFingerprintCommand(FingerprintCommand::DELETE, FingerprintCommand::DETECT_ONLY, id);
+}
+
+void cmdSetMode(Print &out, uint8_t argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "single") == 0) {
+        setAuthMode(Config::SINGLE_FACTOR);
+    } else if (argc > 1 && strcmp(argv[1], "2fa") == 0) {
+        setAuthMode(Config::TWO_FACTOR);
+    } else {
+        out.println("ERR usage: set-mode single|2fa");
+        return;
+    }
+    out.println("OK");
+}
+
+void cmdDumpConfig(Print &out, uint8_t, char **) {
+    out.printf("pin length %u, max wrong attempts %u, lockout %lus\n",
+               Config::PIN_LENGTH, Config::MAX_WRONG_ATTEMPTS, Config::LOCKOUT_TIME / 1000);
+    out.printf("unlock %lums, inactivity %lums\n", Config::UNLOCK_TIME, Config::INACTIVITY_TIME);
+    out.printf("sensor baud %u (fast %u), reply timeout %ums\n",
+               Config::UART_BAUD_RATE, Config::FP_FAST_BAUD_RATE, Config::FP_REPLY_TIMEOUT);
+    out.printf("keypad row period %" PRIu32 "us, debounce %u passes\n",
+               Config::KEYPAD_ROW_PERIOD_US, Config::KEYPAD_DEBOUNCE_SCANS);
+    out.printf("ulp keypad %s, sample %" PRIu32 "us\n", Config::ULP_KEYPAD ? "on" : "off", Config::ULP_SAMPLE_PERIOD_US);
+    out.printf("power min %d MHz, active hold %" PRIu32 "ms\n", Config::POWER_MIN_MHZ, Config::POWER_ACTIVE_HOLD);
+}
+
+void cmdTransfer(Print &out, uint8_t, char **) {
+    // Binary frames follow; Serial belongs to the fingerprint task until it reports back
+    serial_transfer = true;
+    fp_transfer_pages.known = fp_index.data.known;
+    memcpy(fp_transfer_pages.enrolled, fp_index.data.enrolled, sizeof(fp_transfer_pages.enrolled));
+    displayMessage("Template", "Transfer...");
+    postFingerprintCommand(FingerprintCommand::TRANSFER, FingerprintCommand::DETECT_ONLY);
+}
+
+const char *userResultName(Users::Result result) {
+    switch (result) {
+        case Users::OK:          return "OK";
+        case Users::BAD_PIN:     return "ERR pin must be digits";
+        case Users::PIN_IN_USE:  return "ERR pin in use";
+        case Users::FULL:        return "ERR table full";
+        case Users::NO_USER:     return "ERR no such user";
+        case Users::LAST_ADMIN:  return "ERR last admin";
+        default:                 return "ERR flash write failed";
+    }
+}
+
+bool parseUserId(Print &out, const char *arg, uint16_t &id) {
+    id = atoi(arg);
+    if (users.user(id)) return true;
+    out.println("ERR no such user");
+    return false;
+}
+
+void cmdUsers(Print &out, uint8_t, char **) {
+    out.printf("%u users, %u slots\n", users.size(), Config::USER_SLOTS);
+    if (!users.ready()) return;
+    for (const Users::User &user : users.data().users) {
+        if (user.id == Users::NONE) continue;
+        uint16_t pages = 0;
+        for (uint16_t page = 1; page < fp_capacity && page < Config::FP_MAX_TEMPLATES; page++) {
+            if (fp_index.data.isEnrolled(page) && users.owner(page) == user.id) pages++;
         }
+        out.printf("%5u %-5s %-3s %u templates\n", user.id, user.role == Users::ADMIN ? "admin" : "user",
+                   user.enabled ? "on" : "off", pages);
     }
+}
 
-    if (finger.getImage() != FINGERPRINT_OK) return 0;
+// user-add <pin> [admin]
+void cmdUserAdd(Print &out, uint8_t argc, char **argv) {
+    if (argc < 2) {
+        out.println("ERR usage: user-add <pin> [admin]");
+        return;
+    }
+    uint16_t id = 0;
+    bool admin = argc > 2 && strcmp(argv[2], "admin") == 0;
+    Users::Result result = users.add(argv[1], admin ? Users::ADMIN : Users::USER, id);
+    memset(argv[1], 0, strlen(argv[1]));
+    if (result == Users::OK) {
+        out.printf("OK id %u\n", id);
+    } else {
+        out.println(userResultName(result));
+    }
+}
 
-    displayMessage("  Processing...","");
-    last_activity = millis();
+void cmdUserPin(Print &out, uint8_t argc, char **argv) {
+    uint16_t id;
+    if (argc < 3) {
+        out.println("ERR usage: user-pin <id> <pin>");
+        return;
+    }
+    if (!parseUserId(out, argv[1], id)) return;
+    out.println(userResultName(users.setPin(id, argv[2])));
+    memset(argv[2], 0, strlen(argv[2]));
+}
 
-    if (finger.image2Tz() != FINGERPRINT_OK) {
-        displayMessage("Image Error","Try again", 1500);
-        showReadyScreen();
-        return 0;
+void cmdUserEnable(Print &out, uint8_t argc, char **argv) {
+    uint16_t id;
+    if (argc < 3 || (strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0)) {
+        out.println("ERR usage: user-enable <id> on|off");
+        return;
     }
+    if (!parseUserId(out, argv[1], id)) return;
+    out.println(userResultName(users.setEnabled(id, strcmp(argv[2], "on") == 0)));
+}
 
-    if (finger.fingerFastSearch() != FINGERPRINT_OK) {
-        portENTER_CRITICAL(&mux);
-        wrong_fp_attempts++;
-        int remaining_attempts = Config::MAX_WRONG_ATTEMPTS - wrong_fp_attempts;
-        
-        if (wrong_fp_attempts >= Config::MAX_WRONG_ATTEMPTS) {
-            is_fp_locked_out = true;
-            fp_lockout_start = millis();
-            portEXIT_CRITICAL(&mux);
-            displayMessage("FP Locked 30s", "FP Locked 30s");
-            soundBuzzer(3); // Use alarm sound
-            delay(2000);
-        } else {
-            portEXIT_CRITICAL(&mux);
-            displayMessage("No Match", String(remaining_attempts) + " tries left");
-            soundBuzzer(1);
-            delay(2000);
+// The user's templates stay on the sensor but open nothing
+void cmdUserDelete(Print &out, uint8_t argc, char **argv) {
+    uint16_t id;
+    if (argc < 2) {
+        out.println("ERR usage: user-del <id>");
+        return;
+    }
+    if (!parseUserId(out, argv[1], id)) return;
+    Users::Result result = users.remove(id);
+    if (result == Users::OK) {
+        fp_stats.data.forget(id);
+        fp_stats.changed(millis());
+    }
+    out.println(userResultName(result));
+}
+
+// bind <page> <id|none>: hand an enrolled template to a user
+void cmdBind(Print &out, uint8_t argc, char **argv) {
+    uint16_t page;
+    uint16_t id = Users::NONE;
+    if (!parseTemplateId(out, argc, argv, page)) return;
+    if (argc < 3) {
+        out.println("ERR usage: bind <page> <id|none>");
+        return;
+    }
+    if (strcmp(argv[2], "none") != 0 && !parseUserId(out, argv[2], id)) return;
+    out.println(userResultName(users.bind(page, id)));
+}
+
+// fp-level [1-5]: show or set the sensor's security level. Higher refuses
+// more strangers and more poorly placed fingers; check fpstats before raising it.
+void cmdFpLevel(Print &out, uint8_t argc, char **argv) {
+    if (argc < 2) {
+        out.printf("security level %u\n", fpSecurityLevel());
+        return;
+    }
+    uint8_t level = atoi(argv[1]);
+    if (level < 1 || level > 5) {
+        out.println("ERR usage: fp-level [1-5]");
+        return;
+    }
+    settings.data.fp_security_level = level;
+    settings.changed(millis());
+    postFingerprintCommand(FingerprintCommand::SET_LEVEL, FingerprintCommand::MATCH, level);
+    out.println("OK");
+}
+
+// fpstats [reset]: where touches go and how well each user matches
+void cmdFpStats(Print &out, uint8_t argc, char **argv) {
+    FingerprintStats &stats = fp_stats.data;
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        stats = {};
+        fp_stats.changed(millis());
+        out.println("OK");
+        return;
+    }
+    uint32_t matched = 0;
+    for (uint32_t band : stats.bands) matched += band;
+    out.printf("security level %u; %" PRIu32 " touches: %" PRIu32 " matched, %" PRIu32 " missed, %" PRIu32 " image errors, %" PRIu32 " silent retries\n",
+               fpSecurityLevel(), stats.touches, matched, stats.misses, stats.imageErrors, stats.retries);
+    out.print("confidence");
+    for (uint8_t i = 0; i < sizeof(stats.bands) / sizeof(stats.bands[0]); i++) {
+        out.printf(" %u+:%" PRIu32, i * 50, stats.bands[i]);
+    }
+    out.println();
+    out.println(" user matches lowest mean highest");
+    for (const FingerprintStats::User &user : stats.users) {
+        if (!user.id) continue;
+        out.printf("%5u %7u %6u %4" PRIu32 " %7u\n", user.id, user.matches, user.lowest, user.total / user.matches,
+                   user.highest);
+    }
+}
+
+// log [count]: the newest count events, oldest first, or all that flash still
+// holds. The loop prints them a few at a time so Serial never backs up.
+void cmdLog(Print &out, uint8_t argc, char **argv) {
+    uint32_t newest = access_log.newest();
+    uint32_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : newest;
+    uint32_t from = newest - (count < newest ? count : newest);
+    log_export_next = from > access_log.oldest() ? from : access_log.oldest();
+    log_export_end = newest;
+    out.println("seq time type user finger confidence");
+    if (log_export_next == log_export_end) out.println("end");
+}
+
+void exportLog(HardwareSerial &port) {
+    EventLog::Record record;
+    for (uint8_t i = 0; i < Config::LOG_EXPORT_BURST && log_export_next < log_export_end; i++) {
+        if (port.availableForWrite() < 64) return;
+        if (access_log.read(log_export_next++, record)) {
+            port.printf("%" PRIu32 " %" PRIu32 " %s %u %u %u\n", record.sequence, record.time, EventLog::name(record.type),
+                       record.user, record.finger, record.confidence);
         }
-        showReadyScreen();
-        return 0;
     }
+    if (log_export_next == log_export_end) port.println("end");
+}
 
-    // Reset wrong attempts on successful match
-    portENTER_CRITICAL(&mux);
-    wrong_fp_attempts = 0;
-    portEXIT_CRITICAL(&mux);
-    
-    return finger.fingerID;
+// The console login is an admin's PIN
+bool consoleLogin(const char *secret) {
+    const Users::User *user = enabledUser(secret);
+    console_user = user && user->role == Users::ADMIN ? user->id : Users::NONE;
+    logEvent(console_user ? EventLog::CONSOLE_LOGIN : EventLog::CONSOLE_DENIED, user ? user->id : Users::NONE);
+    return console_user != Users::NONE;
 }
 
-void IRAM_ATTR unlockDoor() {
-    lcd.setCursor(15, 0);
-    lcd.write(1);
-    soundBuzzer(0);
-    digitalWrite(PinConfig::RELAY, LOW);
-    delay(Config::UNLOCK_TIME);
-    digitalWrite(PinConfig::RELAY, HIGH);
+const SerialConsole::Command console_commands[] = {
+    {"status", "status", false, cmdStatus},
+    {"stats", "stats", false, cmdStats},
+    {"mem", "mem", false, cmdMem},
+    {"perf", "perf [reset|<stage>]", false, cmdPerf},  // reset checks the login itself
+    {"dump-config", "dump-config", false, cmdDumpConfig},
+    {"enroll", "enroll <id> [user]", true, cmdEnroll},
+    {"delete", "delete <id>", true, cmdDelete},
+    {"set-mode", "set-mode single|2fa", true, cmdSetMode},
+    {"transfer", "transfer", true, cmdTransfer},
+    {"users", "users", true, cmdUsers},
+    {"user-add", "user-add <pin> [admin]", true, cmdUserAdd},
+    {"user-pin", "user-pin <id> <pin>", true, cmdUserPin},
+    {"user-enable", "user-enable <id> on|off", true, cmdUserEnable},
+    {"user-del", "user-del <id>", true, cmdUserDelete},
+    {"bind", "bind <page> <id|none>", true, cmdBind},
+    {"log", "log [count]", true, cmdLog},
+    {"fpstats", "fpstats [reset]", true, cmdFpStats},
+    {"fp-level", "fp-level [1-5]", true, cmdFpLevel},
+};
+
+void setupConsole() {
+    console.begin(Serial, console_commands, sizeof(console_commands) / sizeof(console_commands[0]), consoleLogin,
+                  Config::CONSOLE_SESSION_TIME, Config::CONSOLE_MAX_FAILURES, Config::LOCKOUT_TIME);
+}
+
+// Steady-state operation must not allocate. The first check (a second after
+// boot, once every task has claimed its resources) sets the baseline; any
+// later drop of the heap low-water mark is reported.
+void checkHeapWatermark() {
+    static uint32_t baseline = 0;
+    uint32_t watermark = ESP.getMinFreeHeap();
+    if (baseline == 0) {
+        baseline = watermark;
+    } else if (watermark < baseline) {
+        Serial.printf("Heap watermark dropped: %u -> %u bytes\n", baseline, watermark);
+        baseline = watermark;
+    }
+}
+
+void setBacklight(bool on) {
+    if (on == backlight_on) return;
+    backlight_on = on;
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::BACKLIGHT;
+    cmd.on = on;
+    postDisplay(cmd);
 }
 
-String getInput(String prompt, char confirmKey, char clearKey, bool maskInput) {
-    String input = "";
-    lcd.clear();
-    lcd.print(prompt);
-    lcd.setCursor(4, 1);
+bool initFingerprint() {
+    return finger.verifyPassword() ? (finger.getParameters(), true) :
+           (displayMessage("Sensor Error!", "Trying alt pass..."),
+            finger.setPassword(0x00000000),
+            finger.verifyPassword() ? (finger.getParameters(), true) : false);
+}
+
+void showReadyScreen() {
+    confirmFirmware();
+    scheduler.cancel(ready_screen_timer);
+    ready_screen_active = true;
     
-    if (maskInput) {
-        // Display initial empty circles for PIN entry
-        for(int i = 0; i < Config::PIN_LENGTH; i++) {
-            lcd.write(5);  // Empty circle character
-        }
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::READY;
+    if (auth.is_pin_locked_out || auth.is_fp_locked_out) {
+        cmd.glyph = 4;  // Error lock character
+    } else if (auth.pin_verified && !auth.fingerprint_verified && getAuthMode() == Config::TWO_FACTOR) {
+        cmd.glyph = 3;  // Half-lock character for 2FA waiting state
+    } else {
+        cmd.glyph = 0;  // Normal lock character
     }
+    cmd.two_factor = getAuthMode() == Config::TWO_FACTOR;
+    cmd.pin_done = auth.pin_verified;
+    cmd.fp_done = auth.fingerprint_verified;
+    postDisplay(cmd);
+}
 
-    while (true) {
-        char key = keypad.getKey();
-        if (key) {
-            if (key == confirmKey) break;
-            if (key == clearKey) {
-                input = "";
-                lcd.setCursor(4, 1);
-                if (maskInput) {
-                    // Reset to empty circles for PIN
-                    for(int i = 0; i < Config::PIN_LENGTH; i++) {
-                        lcd.write(5);  // Empty circle character
-                    }
-                } else {
-                    // Clear the line for fingerprint ID
-                    lcd.print("      ");
+// ---------------------------------------------------------------------------
+// Rendering (display task)
+// ---------------------------------------------------------------------------
+
+// Every command redraws its part of the frame; the flush at the end works out
+// which cells actually differ from the glass
+void renderDisplayCommand(const DisplayCommand &cmd) {
+    switch (cmd.type) {
+        case DisplayCommand::MESSAGE:
+            screen.clear();
+            screen.setCursor(0, 0);
+            screen.print(cmd.line1);
+            screen.setCursor(0, 1);
+            screen.print(cmd.line2);
+            break;
+
+        case DisplayCommand::READY:
+            screen.clear();
+            screen.setCursor(0, 0);
+            screen.write(cmd.glyph);
+            screen.print("    Ready");
+
+            // In 2FA mode, show verification status with progress bars
+            if (cmd.two_factor) {
+                screen.setCursor(0, 1);
+                screen.print("P:");
+                // Display three segments for PIN progress
+                for (int i = 0; i < 3; i++) {
+                    screen.write(cmd.pin_done ? 6 : 5);  // filled or empty circle for progress indicator
                 }
-                lcd.setCursor(4, 1);
-            } else if (input.length() < Config::PIN_LENGTH) {
-                input += key;
-                lcd.setCursor(4, 1);
-                if (maskInput) {
-                    // Update display with filled and empty circles for PIN
-                    for(int i = 0; i < Config::PIN_LENGTH; i++) {
-                        if (i < input.length()) {
-                            lcd.write(6);  // Filled circle character
-                        } else {
-                            lcd.write(5);  // Empty circle character
-                        }
-                    }
-                } else {
-                    // Show actual number for fingerprint ID
-                    lcd.print(input);
+                screen.print(" F:");
+                // Display three segments for Fingerprint progress
+                for (int i = 0; i < 3; i++) {
+                    screen.write(cmd.fp_done ? 6 : 5);  // filled or empty circle for progress indicator
                 }
             }
-        }
-        delay(10);
+            break;
+
+        case DisplayCommand::PIN_ENTRY:
+            // Redrawn in full; with the prompt unchanged only the new digit reaches the LCD
+            screen.clear();
+            screen.print(cmd.line1);
+            screen.setCursor(4, 1);
+            if (cmd.masked) {
+                // Display empty circles for remaining spaces
+                for (int i = 0; i < Config::PIN_LENGTH; i++) {
+                    screen.write(i < cmd.count ? 6 : 5);  // Filled / empty circle character
+                }
+            } else {
+                // Show actual number for fingerprint ID
+                screen.print(cmd.line2);
+            }
+            break;
+
+        case DisplayCommand::UNLOCKED:
+            screen.setCursor(Board::LCD_COLS - 1, 0);
+            screen.write(1);
+            break;
+
+        case DisplayCommand::BACKLIGHT:
+            cmd.on ? lcd.backlight() : lcd.noBacklight();
+            return;
+
+        case DisplayCommand::SLEEP:
+            lcd.noBacklight();
+            lcd.noDisplay();
+            return;
+    }
+    screen.update();
+}
+
+// ---------------------------------------------------------------------------
+// Sensor (fingerprint task)
+// ---------------------------------------------------------------------------
+
+// Drives the match pipeline from each completed exchange; returning true lets
+// the link issue the next command packet
+bool onFingerprintStage(const FingerprintLink::Reply &reply) {
+    InputEvent event = {};
+
+    switch (reply.stage) {
+        case FingerprintLink::CAPTURE:
+            // One capture per touch: a finger left on the glass after a result has to
+            // be lifted before it is processed (or counted as a strike) again
+            if (fp_retries) {
+                // A re-capture of the same touch; lifting now gets the image error
+                if (reply.status == FINGERPRINT_OK) return true;
+                event.type = InputEvent::FP_IMAGE_ERROR;
+                break;
+            }
+            if (fp_await_lift) {
+                if (reply.status == FINGERPRINT_NOFINGER) fp_await_lift = false;
+                return false;
+            }
+            if (reply.status != FINGERPRINT_OK) return false;
+            fp_await_lift = true;
+            if (fp_touch_us) {
+                perfRecord(PERF_TOUCH_TO_IMAGE, fp_touch_us);
+                fp_touch_us = 0;
+            }
+            fp_stage_us = perfNow();
+
+            event.type = InputEvent::FINGER_DOWN;
+            postInput(event);
+            return fp_mode == FingerprintCommand::MATCH;
+
+        case FingerprintLink::EXTRACT:
+            perfRecord(PERF_EXTRACT, fp_stage_us);
+            if (reply.status == FINGERPRINT_OK) {
+                fp_stage_us = perfNow();
+                return true;
+            }
+            // A smudged or partial image: take another while the finger is still
+            // down, with no message and no strike, before giving up on the touch
+            if (fp_retries < Config::FP_CAPTURE_RETRIES && reply.status != FingerprintLink::TIMEOUT &&
+                fp_mode == FingerprintCommand::MATCH) {
+                fp_retries++;
+                fp_stage_us = perfNow();
+                fp_link.startMatch(fp_plan.firstStart, fp_plan.firstCount);
+                return false;
+            }
+            event.type = InputEvent::FP_IMAGE_ERROR;
+            break;
+
+        case FingerprintLink::SEARCH:
+            // Missed among the regulars: go over the rest of the library
+            if (reply.status == FINGERPRINT_NOTFOUND && fp_plan.secondCount > 0) {
+                uint16_t start = fp_plan.secondStart, count = fp_plan.secondCount;
+                fp_plan.secondCount = 0;
+                fp_link.search(start, count);
+                return false;
+            }
+            perfRecord(PERF_SEARCH, fp_stage_us);
+            if (reply.status == FINGERPRINT_OK) {
+                event.type = InputEvent::FP_MATCH;
+                event.id = reply.id;
+                event.confidence = reply.score;
+            } else {
+                event.type = InputEvent::FP_NO_MATCH;
+            }
+            break;
+
+        default:
+            return false;
     }
-    return input;
+    event.status = fp_retries;
+    fp_retries = 0;
+    postInput(event);
+    return false;
 }
 
-int getIDFromInput() {
-    String idStr = getInput("Enter ID:", '#', '*', false);  // false means don't mask input
-    return idStr.toInt();
+void unlockDoor() {
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::UNLOCKED;
+    postDisplay(cmd);
+    soundBuzzer(0);
+    PerfScope driven(PERF_RELAY);
+    relay.grant(Config::UNLOCK_TIME);
 }
 
-void enrollFingerprint() {
-    displayMessage("Enrollment Mode", "Enter ID:#");
-    int id = getIDFromInput();
+// Relay and door reports, delivered through the input queue
+void handleDoor(RelayController::Event event) {
+    static const char *const names[] = {"relocked", "door opened", "door closed"};
+    Serial.printf("Relay: %s\n", names[event]);
+    last_activity = millis();
+    // Repaint a ready screen that still shows the unlock; modal flows redraw themselves
+    if (event == RelayController::RELOCKED && ready_screen_active && !menu_active) showReadyScreen();
+}
 
-    if (id == 0) {
-        displayMessage("ID #0 Invalid!", "Try Again", 2000);
-        showReadyScreen();
-    } else {
-        displayMessage("Enrolling ID:" + String(id), "Place Finger");
-        getFingerprintEnroll(id);
+// Milliseconds on the RTC slow clock. Unlike millis() it keeps running through
+// deep sleep and only restarts at power-up, together with RTC memory.
+uint32_t rtcMillis() {
+    return rtc_time_slowclk_to_us(rtc_time_get(), esp_clk_slowclk_cal_get()) / 1000;
+}
+
+// Timestamps for the access log: keeps counting through deep sleep, starts
+// over when power is lost
+uint32_t rtcSeconds() {
+    return rtc_time_slowclk_to_us(rtc_time_get(), esp_clk_slowclk_cal_get()) / 1000000;
+}
+
+void logEvent(EventLog::Type type, uint16_t user, uint16_t finger, uint16_t confidence) {
+    const EventLog::Record &record = access_log.record(type, rtcSeconds(), user, finger, confidence, millis());
+#ifdef LOCKER_NETWORK
+    netPost(record);
+#else
+    (void)record;
+#endif
+}
+
+// Time left on a lockout that began at start (rtcMillis() base); 0 once over
+uint32_t lockoutRemaining(uint32_t start) {
+    uint32_t elapsed = rtcMillis() - start;
+    return elapsed < Config::LOCKOUT_TIME ? Config::LOCKOUT_TIME - elapsed : 0;
+}
+
+// Lockout windows end on their own; refresh the lock glyph if nobody is mid-entry.
+// The expiry events run on millis(), so one that fires a little ahead of the
+// RTC clock (or a lockout carried over a sleep) is re-armed for what is left.
+void onLockoutExpired() {
+    uint32_t now = millis();
+    if (auth.is_pin_locked_out) {
+        uint32_t remaining = lockoutRemaining(auth.pin_lockout_start);
+        if (remaining == 0) {
+            auth.is_pin_locked_out = false;
+            auth.wrong_pin_attempts = 0;
+        } else {
+            scheduler.arm(pin_lockout_timer, now, remaining, onLockoutExpired);
+        }
     }
+    if (auth.is_fp_locked_out) {
+        uint32_t remaining = lockoutRemaining(auth.fp_lockout_start);
+        if (remaining == 0) {
+            auth.is_fp_locked_out = false;
+            auth.wrong_fp_attempts = 0;
+            updateFingerprintMode();
+        } else {
+            scheduler.arm(fp_lockout_timer, now, remaining, onLockoutExpired);
+        }
+    }
+    if (ready_screen_active) showReadyScreen();
+}
+
+// After a deep-sleep wake the counters and lockouts are already in place; only
+// half-finished 2FA progress is dropped so no factor carries over a sleep
+void restoreAuthState() {
+    auth.pin_verified = false;
+    auth.fingerprint_verified = false;
+    onLockoutExpired();
+    updateFingerprintMode();
+}
 
-    last_activity = millis();  // Reset activity timer after enrollment
-    showReadyScreen();
+// Progress prompts during enrollment come straight from the fingerprint task
+void showEnrollPrompt(const char *line1, const char *line2) {
+    DisplayCommand cmd = {};
+    cmd.type = DisplayCommand::MESSAGE;
+    strncpy(cmd.line1, line1, sizeof(cmd.line1) - 1);
+    strncpy(cmd.line2, line2, sizeof(cmd.line2) - 1);
+    postDisplay(cmd);
 }
 
-bool captureFingerprintImage(uint8_t bufferID) {
+EnrollResult captureFingerprintImage(uint8_t bufferID) {
     unsigned long startTime = millis();
-    uint8_t p;
     while ((millis() - startTime) < Config::FINGERPRINT_TIMEOUT_MS) {
-        if ((p = finger.getImage()) == FINGERPRINT_OK) {
-            return (finger.image2Tz(bufferID) == FINGERPRINT_OK) ? 
-                   true : 
-                   (displayMessage("Image Error", "Try Again", 2000), false);
+        if (finger.getImage() == FINGERPRINT_OK) {
+            return (finger.image2Tz(bufferID) == FINGERPRINT_OK) ? ENROLL_OK : ENROLL_IMAGE_ERROR;
         }
         delay(100);
     }
-    displayMessage("Timeout!", "Try Again", 2000);
-    return false;
+    return ENROLL_TIMEOUT;
 }
 
-bool getFingerprintEnroll(uint8_t id) {
-    if (!captureFingerprintImage(1)) return false;
+EnrollResult getFingerprintEnroll(uint16_t id) {
+    EnrollResult result = captureFingerprintImage(1);
+    if (result != ENROLL_OK) return result;
 
-    displayMessage("Got Image!", "Remove Finger");
+    showEnrollPrompt("Got Image!", "Remove Finger");
     
     // Wait for finger removal
     unsigned long startTime = millis();
@@ -887,170 +2653,761 @@ bool getFingerprintEnroll(uint8_t id) {
         delay(100);
     }
 
-    displayMessage("Place Same", "Finger Again");
-    return !captureFingerprintImage(2) ? false :
-           (displayMessage("Processing...", "Please Wait"),
-            finger.createModel() != FINGERPRINT_OK ? 
-            (displayMessage("Failed!", "Try Again", 2000), false) :
-            finger.storeModel(id) != FINGERPRINT_OK ? 
-            (displayMessage("Storage Failed!", "Try Again", 2000), false) :
-            (displayMessage("Success!", "ID #" + String(id), 2000), true));
-}
+    showEnrollPrompt("Place Same", "Finger Again");
+    result = captureFingerprintImage(2);
+    if (result != ENROLL_OK) return result;
 
-void deleteFingerprint() {
-    int id = getIDFromInput();
-    (finger.deleteModel(id) == FINGERPRINT_OK) ? 
-        displayMessage("Deleted ID:", String(id), 2000) : 
-        displayMessage("Failed to Delete", "Try Again", 2000);
-    showReadyScreen();
+    showEnrollPrompt("Processing...", "Please Wait");
+    return finger.createModel() != FINGERPRINT_OK ? ENROLL_MODEL_FAILED :
+           finger.storeModel(id) != FINGERPRINT_OK ? ENROLL_STORE_FAILED : ENROLL_OK;
 }
 
-void IRAM_ATTR checkPassword() {
+void checkPassword() {
+    PerfScope timing(PERF_PIN_CHECK);
+
     // Check if PIN is locked out
-    if (is_pin_locked_out) {
-        if (millis() - pin_lockout_start < Config::LOCKOUT_TIME) {
-            unsigned long remainingTime = (Config::LOCKOUT_TIME - (millis() - pin_lockout_start)) / 1000;
+    if (auth.is_pin_locked_out) {
+        uint32_t remaining = lockoutRemaining(auth.pin_lockout_start);
+        if (remaining > 0) {
+            unsigned long remainingTime = remaining / 1000;
+            LineBuffer line;
             // In 2FA mode, show that fingerprint is still available
-            if (getAuthMode() == Config::TWO_FACTOR && !is_fp_locked_out) {
-                displayMessage("PIN Locked Out", String(remainingTime) + "s");
+            if (getAuthMode() == Config::TWO_FACTOR && !auth.is_fp_locked_out) {
+                displayMessage("PIN Locked Out", formatLine(line, "%lus", remainingTime), 2000);
             } else {
-                displayMessage("PIN Locked " + String(remainingTime) + "s", "");
+                displayMessage(formatLine(line, "PIN Locked %lus", remainingTime), "", 2000);
             }
             soundBuzzer(1);
-            delay(2000);
-            showReadyScreen();
+            pin_entry.clear();
             return;
         } else {
-            is_pin_locked_out = false;
-            wrong_pin_attempts = 0;
+            auth.is_pin_locked_out = false;
+            auth.wrong_pin_attempts = 0;
         }
     }
 
-    char storedPass[Config::PIN_LENGTH + 1];
-    memset(storedPass, 0, sizeof(storedPass));
-    
-    portENTER_CRITICAL(&mux);
-    for (int i = 0; i < Config::PIN_LENGTH; i++) {
-        storedPass[i] = EEPROM.read(i);
+    // One hash and a fixed probe window: the same cost for any PIN, or a short
+    // entry after '#'. A disabled user's PIN, or one that isn't the owner of
+    // the finger already verified, fails like a wrong one.
+    const Users::User *user = users.match(pin_entry);
+    bool accepted = user && user->enabled;
+    if (getAuthMode() == Config::TWO_FACTOR && auth.fingerprint_verified) {
+        accepted = accepted && users.owner(auth.verified_fingerprint_id) == user->id;
     }
-    portEXIT_CRITICAL(&mux);
-    
-    bool match = true;
-    for (int i = 0; i < input_length && i < Config::PIN_LENGTH; i++) {
-        match = (input_password[i] == storedPass[i]) ? match : false;
-    }
-    
-    if (match && input_length == Config::PIN_LENGTH) {
+    if (accepted) {
         if (getAuthMode() == Config::TWO_FACTOR) {
-            if (fingerprint_verified) {
+            if (auth.fingerprint_verified) {
                 // Fingerprint was already verified, grant access
-                portENTER_CRITICAL(&mux);
-                wrong_pin_attempts = 0;
-                pin_verified = false;
-                fingerprint_verified = false;
-                portEXIT_CRITICAL(&mux);
-                displayMessage(" PIN Verified", " Access Granted");
+                auth.wrong_pin_attempts = 0;
+                auth.pin_verified = false;
+                auth.fingerprint_verified = false;
+                logEvent(EventLog::GRANTED, user->id, auth.verified_fingerprint_id, auth.verified_confidence);
+                displayMessage(" PIN Verified", " Access Granted", Config::UNLOCK_TIME);
                 unlockDoor();
-            } else if (is_fp_locked_out) {
+            } else if (auth.is_fp_locked_out) {
                 // If fingerprint is locked out, still allow PIN verification
-                pin_verified = true;
+                auth.pin_verified = true;
+                auth.pin_user = user->id;
+                logEvent(EventLog::PIN_OK, user->id);
                 displayMessage("PIN Verified", "Wait for FP", 2000);
-                showReadyScreen();
             } else {
-                pin_verified = true;
+                auth.pin_verified = true;
+                auth.pin_user = user->id;
+                logEvent(EventLog::PIN_OK, user->id);
                 displayMessage("PIN Verified", "Place Finger", 2000);
-                showReadyScreen();
             }
         } else {
             // In single factor mode, correct PIN always grants access
-            portENTER_CRITICAL(&mux);
-            wrong_pin_attempts = 0;
-            portEXIT_CRITICAL(&mux);
-            displayMessage("     Access","    Granted");
+            auth.wrong_pin_attempts = 0;
+            logEvent(EventLog::GRANTED, user->id);
+            displayMessage("     Access","    Granted", Config::UNLOCK_TIME);
             unlockDoor();
         }
     } else {
-        portENTER_CRITICAL(&mux);
-        wrong_pin_attempts++;
-        int remaining_attempts = Config::MAX_WRONG_ATTEMPTS - wrong_pin_attempts;
-        
-        if (wrong_pin_attempts >= Config::MAX_WRONG_ATTEMPTS) {
-            is_pin_locked_out = true;
-            pin_lockout_start = millis();
-            portEXIT_CRITICAL(&mux);
-            // Even when PIN is locked, show a message indicating fingerprint is still available
-            if (getAuthMode() == Config::TWO_FACTOR && !is_fp_locked_out) {
-                displayMessage("PIN Locked 30s", "");
-            } else {
-                displayMessage("PIN Locked 30s", "");
+        pinStrike(user ? user->id : Users::NONE);
+    }
+}
+
+// A wrong PIN at the keypad or in a menu prompt: counts toward the lockout
+void pinStrike(uint16_t user) {
+    logEvent(EventLog::PIN_DENIED, user);
+    auth.wrong_pin_attempts++;
+    int remaining_attempts = Config::MAX_WRONG_ATTEMPTS - auth.wrong_pin_attempts;
+
+    if (auth.wrong_pin_attempts >= Config::MAX_WRONG_ATTEMPTS) {
+        auth.is_pin_locked_out = true;
+        auth.pin_lockout_start = rtcMillis();
+        auth.pin_lockouts++;
+        scheduler.arm(pin_lockout_timer, millis(), Config::LOCKOUT_TIME, onLockoutExpired);
+        logEvent(EventLog::PIN_LOCKOUT);
+        displayMessage("PIN Locked 30s", "", 2000);
+        soundBuzzer(3); // Use alarm sound
+    } else {
+        LineBuffer line;
+        displayMessage("Invalid PIN", formatLine(line, "%d tries left", remaining_attempts), 2000);
+        soundBuzzer(1);
+    }
+}
+
+// The user a typed-in PIN belongs to, if they may use it
+const Users::User *enabledUser(const char *pin) {
+    const Users::User *user = users.match(pin);
+    return user && user->enabled ? user : nullptr;
+}
+
+void setAuthMode(Config::AuthMode mode) {
+    settings.data.auth_mode = mode;
+    settings.changed(millis());
+}
+
+Config::AuthMode getAuthMode() {
+    return (settings.data.auth_mode == Config::TWO_FACTOR) ? Config::TWO_FACTOR : Config::SINGLE_FACTOR;
+}
+
+uint8_t fpSecurityLevel() {
+    uint8_t level = settings.data.fp_security_level;
+    return level >= 1 && level <= 5 ? level : Config::FP_SECURITY_LEVEL;
+}
+
+// Settings live in NVS as one versioned, CRC-checked blob; the PINs live in
+// the user table. An install from before the table had one PIN, which becomes
+// admin 1: version 2 of the settings held its hash, while version 1 and the
+// EEPROM bytes before it held it in the clear. Clear copies are hashed and the
+// EEPROM is wiped once the table is safely written.
+void loadSettings() {
+    settings.data.fp_security_level = Config::FP_SECURITY_LEVEL;
+    bool loaded = settings.begin("locker", "settings", Config::SETTINGS_VERSION, Config::SETTINGS_COMMIT_DELAY);
+    PersistentBlock<SettingsV3> v3;
+    if (!loaded && v3.begin("locker", "settings", 3, 0)) {
+        settings.data.auth_mode = v3.data.auth_mode;
+        loaded = settings.commit();
+    }
+    fp_stats.begin("locker", "fpstats", Config::FP_STATS_VERSION, Config::FP_INDEX_COMMIT_DELAY);
+    if (!users.begin("users", Config::USER_TABLE_VERSION)) {
+        Serial.println("No user table partition: PINs are refused");
+    }
+    if (loaded && !users.fresh()) return;
+
+    PinHash::Record legacy;
+    char legacyPin[sizeof(SettingsV1::pin)] = {};
+    bool hashed = false;
+    bool fromEeprom = false;
+    PersistentBlock<SettingsV2> v2;
+    PersistentBlock<SettingsV1> v1;
+    if (loaded) {
+        // Settings survived but the table did not: back to DEFAULT_PIN
+    } else if (v2.begin("locker", "settings", 2, 0)) {
+        legacy = v2.data.pin;
+        hashed = true;
+        settings.data.auth_mode = v2.data.auth_mode;
+    } else if (v1.begin("locker", "settings", 1, 0)) {
+        memcpy(legacyPin, v1.data.pin, sizeof(legacyPin));
+        settings.data.auth_mode = v1.data.auth_mode;
+    } else {
+        settings.data.auth_mode = Config::SINGLE_FACTOR;
+        EEPROM.begin(Config::EEPROM_SIZE);
+        fromEeprom = EEPROM.read(0) != 0xFF;
+        if (fromEeprom) {
+            for (uint8_t i = 0; i < sizeof(legacyPin) - 1; i++) {
+                legacyPin[i] = EEPROM.read(i);
             }
-            soundBuzzer(3); // Use alarm sound
-            delay(2000);
-        } else {
-            portEXIT_CRITICAL(&mux);
-            displayMessage("Invalid PIN", String(remaining_attempts) + " tries left");
-            soundBuzzer(1);
-            delay(2000);
+            settings.data.auth_mode = EEPROM.read(Config::AUTH_MODE_ADDR);
         }
     }
-    
-    memset(storedPass, 0, sizeof(storedPass));
-    input_length = 0;
-    showReadyScreen();
+    legacyPin[sizeof(legacyPin) - 1] = '\0';
+
+    if (!hashed) PinHash::create(legacy, PinHash::wellFormed(legacyPin) ? legacyPin : Config::DEFAULT_PIN);
+    memset(legacyPin, 0, sizeof(legacyPin));
+    bool seeded = !users.fresh() || users.seed(legacy) == Users::OK;
+    memset(&legacy, 0, sizeof(legacy));
+    v2.data = {};
+    if (!loaded) seeded = settings.commit() && seeded;
+    if (seeded && fromEeprom) {
+        for (uint16_t i = 0; i < Config::EEPROM_SIZE; i++) EEPROM.write(i, 0xFF);
+        EEPROM.commit();
+    }
+    EEPROM.end();
 }
 
-void setPassword(const String &newPassword) {
-    for (int i = 0; i < Config::PIN_LENGTH; i++) {
-        EEPROM.write(i, i < newPassword.length() ? newPassword[i] : 0);
+// ---------------------------------------------------------------------------
+// Network (net task, core 0)
+// ---------------------------------------------------------------------------
+
+// Only in the network build (pio run -e esp32dev-net). The net task collects
+// access events while the radio is off. Every REPORT_INTERVAL, once a batch
+// fills, or before the lock sleeps with events unsent, it opens a window:
+// join Wi-Fi, publish the events and a health report over MQTT, take any
+// commands the broker queued, and switch the radio off again. Deep sleep
+// wakes on a timer for the same window. Nothing on the keypad or sensor path
+// waits for it: events are posted with no wait, and commands reach the loop
+// as input events once their signature has been checked.
+#ifdef LOCKER_NETWORK
+// Set from the environment by platformio.ini; unset leaves the network off
+#ifndef LOCKER_WIFI_SSID
+#define LOCKER_WIFI_SSID ""
+#endif
+#ifndef LOCKER_WIFI_PASSWORD
+#define LOCKER_WIFI_PASSWORD ""
+#endif
+#ifndef LOCKER_MQTT_HOST
+#define LOCKER_MQTT_HOST ""
+#endif
+#ifndef LOCKER_MQTT_PORT
+#define LOCKER_MQTT_PORT 1883
+#endif
+#ifndef LOCKER_MQTT_USER
+#define LOCKER_MQTT_USER ""
+#endif
+#ifndef LOCKER_MQTT_PASSWORD
+#define LOCKER_MQTT_PASSWORD ""
+#endif
+#ifndef LOCKER_MQTT_TOPIC
+#define LOCKER_MQTT_TOPIC "locker"
+#endif
+#ifndef LOCKER_REMOTE_KEY
+#define LOCKER_REMOTE_KEY ""
+#endif
+#ifndef LOCKER_OTA_URL
+#define LOCKER_OTA_URL ""
+#endif
+#ifndef LOCKER_OTA_PUBLIC_KEY
+#define LOCKER_OTA_PUBLIC_KEY ""
+#endif
+
+struct NetConfig {
+    static constexpr const char *WIFI_SSID = LOCKER_WIFI_SSID;
+    static constexpr const char *WIFI_PASSWORD = LOCKER_WIFI_PASSWORD;
+    static constexpr const char *MQTT_HOST = LOCKER_MQTT_HOST;
+    static constexpr uint16_t MQTT_PORT = LOCKER_MQTT_PORT;
+    static constexpr const char *MQTT_USER = LOCKER_MQTT_USER;          // Empty: no broker login
+    static constexpr const char *MQTT_PASSWORD = LOCKER_MQTT_PASSWORD;
+    static constexpr const char *TOPIC = LOCKER_MQTT_TOPIC;       // <topic>/events, /health, /cmd, /ack
+    static constexpr const char *REMOTE_KEY = LOCKER_REMOTE_KEY;  // 64 hex digits shared with the backend
+    static constexpr uint32_t REPORT_INTERVAL = 300000;  // Window period, awake or asleep; bounds remote command delay
+    static constexpr uint32_t CONNECT_TIMEOUT = 10000;   // Give up on Wi-Fi or the broker after this long
+    static constexpr uint32_t LISTEN_WINDOW = 3000;      // Subscribed this long for queued commands
+    static constexpr uint8_t EVENT_BATCH = 16;           // Events held for a window; a full batch opens one early
+    static constexpr uint8_t EVENTS_PER_MESSAGE = 8;
+    static constexpr uint16_t MQTT_BUFFER = 768;
+    static constexpr const char *OTA_URL = LOCKER_OTA_URL;               // Image; its signature at OTA_URL.sig
+    static constexpr const char *OTA_PUBLIC_KEY = LOCKER_OTA_PUBLIC_KEY; // 130 hex digits: 04 || X || Y
+    static constexpr uint16_t OTA_CHUNK = 1024;          // Bytes in RAM at a time on the way to flash
+    static constexpr uint32_t OTA_TIMEOUT = 15000;       // Per read; a stalled download is abandoned
+    static constexpr uint32_t HEALTH_WINDOW = 60000;     // A new image must reach the ready screen in this
+};
+
+WiFiClient net_client;
+PubSubClient mqtt(net_client);
+RemoteCommand remote;
+uint8_t remote_key[RemoteCommand::KEY_BYTES];
+Preferences net_prefs;                  // Last accepted command counter; the net task's own namespace
+EventLog::Record net_batch[NetConfig::EVENT_BATCH];  // Net task only
+volatile uint8_t net_batched = 0;
+volatile bool net_window = false;       // Radio on, or a window about to start
+volatile bool net_online = true;        // Last window reached the broker
+volatile uint32_t net_windows = 0;
+volatile uint32_t net_dropped = 0;      // Events lost to a full queue or batch
+OtaUpdate ota;
+uint8_t ota_key[OtaUpdate::PUBLIC_KEY_BYTES];
+uint8_t ota_chunk[NetConfig::OTA_CHUNK];  // Net task only
+bool ota_requested = false;             // Net task only: an update command came in this window
+esp_timer_handle_t health_timer = nullptr;
+bool firmware_staged = false;           // Loop task: restart into it instead of sleeping
+
+void netPost(const EventLog::Record &record) {
+    if (net_queue && xQueueSend(net_queue, &record, 0) != pdTRUE) net_dropped++;
+}
+
+void printNetworkStatus(Print &out) {
+    out.printf("network: %s, %" PRIu32 " windows, %u events waiting, %" PRIu32 " dropped\n",
+               !net_task ? "off" : net_window ? "in a window" : net_online ? "idle" : "broker unreachable",
+               net_windows, net_batched, net_dropped);
+}
+
+const char *netTopic(char (&topic)[48], const char *leaf) {
+    snprintf(topic, sizeof(topic), "%s/%s", NetConfig::TOPIC, leaf);
+    return topic;
+}
+
+void publishHealth() {
+    char topic[48];
+    char json[256];
+    snprintf(json, sizeof(json),
+             "{\"up\":%" PRIu32 ",\"wakes\":%u,\"grants\":%u,\"pin_lockouts\":%u,\"fp_lockouts\":%u,"
+             "\"search_p50_us\":%" PRIu32 ",\"search_p90_us\":%" PRIu32 ",\"heap\":%u,\"log_dropped\":%" PRIu32 ",\"net_dropped\":%" PRIu32 ","
+             "\"fw\":\"%s\"}",
+             rtcSeconds(), warm_boot.wakes, relay.grants(), auth.pin_lockouts, auth.fp_lockouts,
+             perf[PERF_SEARCH].percentile(50), perf[PERF_SEARCH].percentile(90), ESP.getFreeHeap(),
+             access_log.dropped(), net_dropped, esp_ota_get_app_description()->version);
+    mqtt.publish(netTopic(topic, "health"), json, true);
+}
+
+// A few events per message; those sent leave the batch
+void publishEvents() {
+    char topic[48];
+    char json[NetConfig::MQTT_BUFFER - 64];
+    netTopic(topic, "events");
+    uint8_t sent = 0;
+    while (sent < net_batched) {
+        uint8_t count = net_batched - sent < NetConfig::EVENTS_PER_MESSAGE ? net_batched - sent
+                                                                           : NetConfig::EVENTS_PER_MESSAGE;
+        int length = snprintf(json, sizeof(json), "[");
+        for (uint8_t i = 0; i < count; i++) {
+            const EventLog::Record &r = net_batch[sent + i];
+            length += snprintf(json + length, sizeof(json) - length,
+                               "%s{\"seq\":%" PRIu32 ",\"t\":%" PRIu32 ",\"type\":\"%s\",\"user\":%u,\"finger\":%u,\"conf\":%u}",
+                               i ? "," : "", r.sequence, r.time, EventLog::name(r.type), r.user, r.finger,
+                               r.confidence);
+        }
+        snprintf(json + length, sizeof(json) - length, "]");
+        if (!mqtt.publish(topic, json)) break;
+        sent += count;
     }
-    EEPROM.commit();
+    memmove(net_batch, net_batch + sent, (net_batched - sent) * sizeof(EventLog::Record));
+    net_batched -= sent;
 }
 
-String getPassword() {
-    String password = "";
-    for (int i = 0; i < Config::PIN_LENGTH; i++) {
-        char c = EEPROM.read(0 + i);
-        if (c == 0) break;
-        password += c;
+// Net task: check the signature, keep the counter, hand the command to the loop
+void onNetMessage(char *, uint8_t *payload, unsigned int length) {
+    RemoteCommand::Parsed command;
+    RemoteCommand::Verdict verdict = remote.parse(payload, length, command);
+    char topic[48];
+    char ack[48];
+    snprintf(ack, sizeof(ack), "%" PRIu32 " %s", verdict == RemoteCommand::OK ? command.counter : remote.counter(),
+             RemoteCommand::name(verdict));
+    mqtt.publish(netTopic(topic, "ack"), ack);
+    if (verdict != RemoteCommand::OK) return;
+
+    net_prefs.putUInt("counter", remote.counter());
+    if (command.action == RemoteCommand::REPORT) {
+        publishHealth();
+        return;
     }
-    return password;
+    if (command.action == RemoteCommand::UPDATE) {
+        ota_requested = true;  // After the listen period, still inside this window
+        return;
+    }
+    InputEvent event = {};
+    event.type = InputEvent::REMOTE;
+    event.status = command.action;
+    event.id = command.arg;
+    postInput(event);
 }
 
-void changePassword() {
-    String currentPassword = getInput("  Current PIN:",'#','*', true);
-    if (currentPassword != getPassword()) {
-        displayMessage("   PIN Error","",2000);
-        showReadyScreen();
+// Net task, Wi-Fi up: signature first, then the image straight into the idle
+// app partition. Flash is erased a sector at a time as the image arrives, so
+// the other core is never held off the cache for long.
+OtaUpdate::Result fetchFirmware() {
+    if (!NetConfig::OTA_URL[0] || strlen(NetConfig::OTA_PUBLIC_KEY) != 2 * OtaUpdate::PUBLIC_KEY_BYTES) {
+        return OtaUpdate::NO_PARTITION;
+    }
+    WiFiClient client;
+    HTTPClient http;
+    http.setTimeout(NetConfig::OTA_TIMEOUT);
+    uint8_t signature[OtaUpdate::MAX_SIGNATURE_BYTES];
+    char url[160];
+    snprintf(url, sizeof(url), "%s.sig", NetConfig::OTA_URL);
+    if (!http.begin(client, url) || http.GET() != HTTP_CODE_OK) {
+        http.end();
+        return OtaUpdate::BAD_SIGNATURE;
+    }
+    int signatureLength = http.getSize();
+    if (signatureLength <= 0 || signatureLength > OtaUpdate::MAX_SIGNATURE_BYTES ||
+        http.getStreamPtr()->readBytes(signature, signatureLength) != size_t(signatureLength)) {
+        http.end();
+        return OtaUpdate::BAD_SIGNATURE;
+    }
+    http.end();
+
+    if (!http.begin(client, NetConfig::OTA_URL) || http.GET() != HTTP_CODE_OK || http.getSize() <= 0) {
+        http.end();
+        return OtaUpdate::SHORT_IMAGE;
+    }
+    OtaUpdate::Result result = ota.begin(http.getSize(), signature, signatureLength);
+    WiFiClient *stream = http.getStreamPtr();
+    uint32_t remaining = http.getSize();
+    while (result == OtaUpdate::OK && remaining) {
+        size_t want = remaining < sizeof(ota_chunk) ? remaining : sizeof(ota_chunk);
+        size_t got = stream->readBytes(ota_chunk, want);
+        if (got == 0) break;
+        result = ota.write(ota_chunk, got);
+        remaining -= got;
+    }
+    http.end();
+    if (result != OtaUpdate::OK) return result;
+    result = ota.finish();
+    Serial.printf("Firmware update: %s, %" PRIu32 " bytes\n", OtaUpdate::name(result), ota.progress());
+    return result;
+}
+
+void netWindow() {
+    net_window = true;
+    bool reached = false;
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(NetConfig::WIFI_SSID, NetConfig::WIFI_PASSWORD);
+    uint32_t start = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - start < NetConfig::CONNECT_TIMEOUT) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    char id[24];
+    char topic[48];
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(id, sizeof(id), "locker-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    // No clean session: the broker keeps commands sent while the radio was off
+    if (WiFi.status() == WL_CONNECTED &&
+        mqtt.connect(id, NetConfig::MQTT_USER[0] ? NetConfig::MQTT_USER : nullptr,
+                     NetConfig::MQTT_PASSWORD[0] ? NetConfig::MQTT_PASSWORD : nullptr, nullptr, 0, false, nullptr,
+                     false)) {
+        reached = true;
+        mqtt.subscribe(netTopic(topic, "cmd"), 1);
+        publishEvents();
+        publishHealth();
+        uint32_t listen = millis();
+        while (mqtt.connected() && millis() - listen < NetConfig::LISTEN_WINDOW) {
+            mqtt.loop();
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+        if (ota_requested) {
+            ota_requested = false;
+            OtaUpdate::Result result = fetchFirmware();
+            char ack[48];
+            snprintf(ack, sizeof(ack), "update %s", OtaUpdate::name(result));
+            mqtt.publish(netTopic(topic, "ack"), ack);
+            if (result == OtaUpdate::OK) {
+                InputEvent event = {};
+                event.type = InputEvent::REMOTE;
+                event.status = RemoteCommand::UPDATE;
+                postInput(event);
+            }
+        }
+        mqtt.disconnect();
+    }
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+    net_online = reached;
+    net_windows++;
+    net_window = false;
+}
+
+void netTaskMain(void *) {
+    uint32_t nextWindow = net_window ? millis() : millis() + NetConfig::REPORT_INTERVAL;
+    for (;;) {
+        EventLog::Record record;
+        int32_t wait = nextWindow - millis();
+        // Wake at least once a second for a window asked for by notification
+        if (xQueueReceive(net_queue, &record, pdMS_TO_TICKS(wait < 0 ? 0 : wait < 1000 ? wait : 1000)) == pdTRUE) {
+            if (net_batched < NetConfig::EVENT_BATCH) {
+                net_batch[net_batched++] = record;
+            } else {
+                net_dropped++;
+            }
+        }
+        bool asked = ulTaskNotifyTake(pdTRUE, 0) > 0;
+        if (!asked && net_batched < NetConfig::EVENT_BATCH && int32_t(millis() - nextWindow) < 0) continue;
+        while (net_batched < NetConfig::EVENT_BATCH && xQueueReceive(net_queue, &record, 0) == pdTRUE) {
+            net_batch[net_batched++] = record;
+        }
+        netWindow();
+        nextWindow = millis() + NetConfig::REPORT_INTERVAL;
+    }
+}
+#endif
+
+// Runs only when the build has credentials and a valid command key
+void startNetwork(bool reportNow) {
+#ifdef LOCKER_NETWORK
+    if (!NetConfig::WIFI_SSID[0] || !NetConfig::MQTT_HOST[0]) {
+        Serial.println("Network: not configured");
         return;
     }
-    
-    String newPassword = getInput("    New PIN:", '#', '*', true);
-    if (newPassword.length() == 0 || newPassword.length() > Config::PIN_LENGTH) {
-        displayMessage("   PIN Error","   No Change",2000);
-        showReadyScreen();
+    if (strlen(NetConfig::REMOTE_KEY) != 2 * RemoteCommand::KEY_BYTES ||
+        !RemoteCommand::fromHex(NetConfig::REMOTE_KEY, remote_key)) {
+        Serial.println("Network: LOCKER_REMOTE_KEY must be 64 hex digits");
         return;
     }
+    net_prefs.begin("net", false);
+    remote.begin(remote_key, net_prefs.getUInt("counter", 0));
+    if (strlen(NetConfig::OTA_PUBLIC_KEY) == 2 * OtaUpdate::PUBLIC_KEY_BYTES &&
+        RemoteCommand::fromHex(NetConfig::OTA_PUBLIC_KEY, ota_key, OtaUpdate::PUBLIC_KEY_BYTES)) {
+        ota.configure(ota_key);
+    }
+    mqtt.setServer(NetConfig::MQTT_HOST, NetConfig::MQTT_PORT);
+    mqtt.setCallback(onNetMessage);
+    mqtt.setBufferSize(NetConfig::MQTT_BUFFER);
+    net_queue = net_queue_storage.create();
+    net_window = reportNow;
+    net_task = net_task_storage.create(netTaskMain, "net", TaskConfig::NET_PRIORITY, TaskConfig::SENSOR_CORE);
+#else
+    (void)reportNow;
+#endif
+}
 
-    String confirmPassword = getInput("Confirm New PIN:", '#', '*', true);
-    if (newPassword != confirmPassword) {
-        displayMessage("PINs Don't Match", "No Change", 2000);
-        showReadyScreen();
+// Whether the network lets the lock sleep now. Unsent events get a window
+// first, unless the last one couldn't reach the broker.
+bool networkIdle() {
+#ifdef LOCKER_NETWORK
+    if (!net_task) return true;
+    if (net_window) return false;
+    if (net_online && (net_batched || uxQueueMessagesWaiting(net_queue))) {
+        xTaskNotifyGive(net_task);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void armNetworkWake() {
+#ifdef LOCKER_NETWORK
+    if (net_task) esp_sleep_enable_timer_wakeup(NetConfig::REPORT_INTERVAL * 1000ULL);
+#endif
+}
+
+// Loop task: a command from the net task, its signature and counter already checked
+void handleRemote(const InputEvent &event) {
+#ifdef LOCKER_NETWORK
+    switch (event.status) {
+        case RemoteCommand::UNLOCK:
+            logEvent(EventLog::REMOTE_UNLOCK);
+            last_activity = millis();
+            setBacklight(true);
+            displayMessage("  Remote Unlock", " Access Granted", Config::UNLOCK_TIME);
+            unlockDoor();
+            break;
+        case RemoteCommand::SET_MODE:
+            logEvent(EventLog::REMOTE_CONFIG);
+            setAuthMode(event.id ? Config::TWO_FACTOR : Config::SINGLE_FACTOR);
+            break;
+        case RemoteCommand::UPDATE:
+            logEvent(EventLog::FIRMWARE_STAGED);
+            firmware_staged = true;
+            break;
+        default:
+            break;
+    }
+#else
+    (void)event;
+#endif
+}
+
+// Restart rather than sleep when new firmware is waiting: the lock is idle
+// and its state is already flushed
+void restartIfStaged() {
+#ifdef LOCKER_NETWORK
+    if (!firmware_staged) return;
+    Serial.println("Restarting into new firmware");
+    Serial.flush();
+    ESP.restart();
+#endif
+}
+
+#ifdef LOCKER_NETWORK
+// The bootloader boots a new image once, as pending verify. Left unconfirmed,
+// the next reset goes back to the previous image; a crash or hang before the
+// ready screen is caught this way, or by the health window running out.
+void onHealthTimeout(void *) {
+    Serial.println("New firmware never reached the ready screen: rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+// Keep the Arduino core from confirming the image before our own check
+extern "C" bool verifyRollbackLater() {
+    return true;
+}
+#endif
+
+void startHealthWindow() {
+#ifdef LOCKER_NETWORK
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY) {
         return;
     }
-    
-    setPassword(newPassword);
-    displayMessage("  PIN Updated","",2000);
-    
-    last_activity = millis();
-    showReadyScreen();
+    Serial.printf("New firmware on trial for %" PRIu32 "s\n", NetConfig::HEALTH_WINDOW / 1000);
+    esp_timer_create_args_t args = {};
+    args.callback = onHealthTimeout;
+    args.name = "health";
+    esp_timer_create(&args, &health_timer);
+    esp_timer_start_once(health_timer, NetConfig::HEALTH_WINDOW * 1000ULL);
+#endif
 }
 
-void setAuthMode(Config::AuthMode mode) {
-    EEPROM.write(Config::AUTH_MODE_ADDR, mode);
-    EEPROM.commit();
+// Called on every ready screen; only the first one on a trial image does anything
+void confirmFirmware() {
+#ifdef LOCKER_NETWORK
+    if (!health_timer) return;
+    esp_timer_stop(health_timer);
+    esp_timer_delete(health_timer);
+    health_timer = nullptr;
+    esp_ota_mark_app_valid_cancel_rollback();
+    Serial.println("New firmware confirmed");
+#endif
 }
 
-Config::AuthMode getAuthMode() {
-    uint8_t mode = EEPROM.read(Config::AUTH_MODE_ADDR);
-    return (mode == Config::TWO_FACTOR) ? Config::TWO_FACTOR : Config::SINGLE_FACTOR;
+#ifdef LOCKER_BENCHMARK
+// ---------------------------------------------------------------------------
+// Benchmark build (pio run -e esp32dev-bench)
+// ---------------------------------------------------------------------------
+// First collects wake-to-ready times over a series of timer wakes from deep
+// sleep. The boot after the last of them times the LCD, NVS, PIN and sensor
+// paths before startTasks() hands the peripherals over, and the keypad scan
+// once the tasks run, then prints min/median/p99 of each. The lock then runs
+// normally; reset it to measure again.
+
+struct BenchConfig {
+    static constexpr uint8_t WAKE_CYCLES = 16;
+    static constexpr uint16_t ITERATIONS = 64;
+    static constexpr uint8_t SEARCH_ITERATIONS = 16;  // A full-library search takes up to a second
+    static constexpr uint32_t SLEEP_US = 200000;
+};
+
+RTC_DATA_ATTR uint32_t bench_wake_ms[BenchConfig::WAKE_CYCLES];
+RTC_DATA_ATTR uint8_t bench_wakes;
+
+// Full repaint, a new two-line message, a single PIN digit, and a flush with nothing to send
+void benchLcd() {
+    static SampleSet<BenchConfig::ITERATIONS> repaint, message, digit, unchanged;
+    for (uint16_t i = 0; i < BenchConfig::ITERATIONS; i++) {
+        screen.invalidate();
+        screen.clear();
+        screen.print("Benchmark");
+        uint32_t start = perfNow();
+        screen.update();
+        repaint.add(perfNow() - start);
+
+        screen.clear();
+        screen.print((i & 1) ? "Access Granted" : "Wrong PIN");
+        screen.setCursor(0, 1);
+        screen.print((i & 1) ? "Welcome" : "4 tries left");
+        start = perfNow();
+        screen.update();
+        message.add(perfNow() - start);
+
+        screen.setCursor(i % 6, 1);
+        screen.write('*');
+        start = perfNow();
+        screen.update();
+        digit.add(perfNow() - start);
+
+        start = perfNow();
+        screen.update();
+        unchanged.add(perfNow() - start);
+    }
+    repaint.report(Serial, "lcd full repaint", "us");
+    message.report(Serial, "lcd message", "us");
+    digit.report(Serial, "lcd one cell", "us");
+    unchanged.report(Serial, "lcd no change", "us");
+    screen.invalidate();  // The next real screen repaints everything
+}
+
+// Load and commit of a settings-sized block in a scratch namespace
+void benchSettings() {
+    static SampleSet<BenchConfig::ITERATIONS> load, commit;
+    for (uint16_t i = 0; i < BenchConfig::ITERATIONS; i++) {
+        PersistentBlock<Settings> block;
+        uint32_t start = perfNow();
+        block.begin("bench", "settings", Config::SETTINGS_VERSION, 0);
+        load.add(perfNow() - start);
+
+        block.data = settings.data;
+        block.data.auth_mode = i & 1;  // Every commit writes a changed image
+        start = perfNow();
+        block.commit();
+        commit.add(perfNow() - start);
+    }
+    Preferences scratch;
+    if (scratch.begin("bench", false)) {
+        scratch.clear();
+        scratch.end();
+    }
+    load.report(Serial, "nvs settings load", "us");
+    commit.report(Serial, "nvs settings commit", "us");
+}
+
+// One keypad digit going into the hash, and the verdict after the last one:
+// a right and a wrong PIN should cost the same
+void benchPin() {
+    static SampleSet<BenchConfig::ITERATIONS> digit, right, wrong;
+    PinHash::Record record;
+    PinHash::create(record, Config::DEFAULT_PIN);
+    PinHash::Entry entry;
+    for (uint16_t i = 0; i < BenchConfig::ITERATIONS; i++) {
+        for (uint8_t d = 0; d < Config::PIN_LENGTH; d++) {
+            uint32_t start = perfNow();
+            entry.add(record, Config::DEFAULT_PIN[d]);
+            digit.add(perfNow() - start);
+        }
+        uint32_t start = perfNow();
+        entry.matches(record);
+        right.add(perfNow() - start);
+
+        for (uint8_t d = 0; d < Config::PIN_LENGTH; d++) entry.add(record, '0' + (i + 3 * d) % 10);
+        start = perfNow();
+        entry.matches(record);
+        wrong.add(perfNow() - start);
+    }
+    digit.report(Serial, "pin digit", "us");
+    right.report(Serial, "pin verify (right)", "us");
+    wrong.report(Serial, "pin verify (wrong)", "us");
+}
+
+// UART round trip of an empty capture, then a search of the whole library.
+// With no finger on the glass the search walks every page for whatever the
+// char buffer holds, which is its worst case.
+void benchSensor() {
+    if (!warm_boot.fp_ready) {
+        Serial.println("sensor                   not responding, skipped");
+        return;
+    }
+    static SampleSet<BenchConfig::ITERATIONS> capture;
+    static SampleSet<BenchConfig::SEARCH_ITERATIONS> search;
+    for (uint16_t i = 0; i < BenchConfig::ITERATIONS; i++) {
+        uint32_t start = perfNow();
+        finger.getImage();
+        capture.add(perfNow() - start);
+    }
+    for (uint8_t i = 0; i < BenchConfig::SEARCH_ITERATIONS; i++) {
+        uint32_t start = perfNow();
+        finger.fingerFastSearch();
+        search.add(perfNow() - start);
+    }
+    capture.report(Serial, "sensor capture (empty)", "us");
+    search.report(Serial, "sensor full search", "us");
+}
+
+// The report boot, ahead of startTasks(): nothing else draws on the LCD or
+// talks to the sensor yet
+void benchmarkPeripherals() {
+    if (bench_wakes < BenchConfig::WAKE_CYCLES) return;
+    cpu_power.hold(true);  // Fixed clock for the whole run
+    Serial.println("=== Benchmark ===");
+    Serial.printf("chip rev %u, cpu %u MHz, sensor %" PRIu32 " baud, library %u\n", ESP.getChipRevision(),
+                  getCpuFrequencyMhz(), warm_boot.fp_baud, fp_capacity);
+    benchLcd();
+    benchSettings();
+    benchPin();
+    benchSensor();
+}
+
+void benchmarkAfterBoot() {
+    if (bench_wakes < BenchConfig::WAKE_CYCLES) {
+        if (warm_start) bench_wake_ms[bench_wakes++] = millis();
+        Serial.printf("Benchmark: %u/%u wakes timed\n", bench_wakes, BenchConfig::WAKE_CYCLES);
+        Serial.flush();
+        settings.flush();
+        esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+        esp_sleep_enable_timer_wakeup(BenchConfig::SLEEP_US);
+        esp_deep_sleep_start();
+    }
+    bench_wakes = 0;  // A reset after the report starts a new series
+
+    SampleSet<BenchConfig::WAKE_CYCLES> wake;
+    for (uint8_t i = 0; i < BenchConfig::WAKE_CYCLES; i++) wake.add(bench_wake_ms[i]);
+    wake.report(Serial, "wake to ready", "ms");
+
+    for (uint8_t i = 0; i < 100 && !bench_scan_cycles.full(); i++) delay(10);
+    bench_scan_cycles.report(Serial, "keypad scan tick", "cycles");
+    Serial.println("=== End ===");
 }
+#endif
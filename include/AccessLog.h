@@ -0,0 +1,200 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+// Audit trail of grants, denials and lockouts. record() only appends to a RAM
+// ring. service() writes to a raw data partition a flash page at a time, so
+// logging adds no flash write to the path that produced the event.
+//
+// The partition is a circle of 16-byte slots and record n lives in slot
+// n % slots. A sector is erased when the log first enters it, which drops one
+// sector's worth of the oldest records. Each slot is programmed once per lap,
+// so a page filled by two flushes still gets one write per byte. At boot the
+// newest valid record shows where to carry on.
+template <uint16_t RamRecords>
+class AccessLog {
+public:
+    enum Type : uint8_t {
+        BOOT,             // Cold start; times count from zero again
+        GRANTED,          // user, and the finger when one was used
+        PIN_OK,           // First of two factors
+        FINGER_OK,
+        PIN_DENIED,       // user set when the PIN was right but refused
+        FINGER_DENIED,    // finger 0 when no template matched
+        PIN_LOCKOUT,
+        FINGER_LOCKOUT,
+        ADMIN_MENU,
+        CONSOLE_LOGIN,
+        CONSOLE_DENIED,
+        REMOTE_UNLOCK,    // Signed network command
+        REMOTE_CONFIG,
+        FIRMWARE_STAGED,  // Signed image written; boots at the next sleep
+        TYPE_COUNT
+    };
+
+    struct Record {
+        uint32_t sequence;
+        uint32_t time;          // Seconds on the caller's clock
+        uint16_t user;
+        uint16_t finger;
+        uint16_t confidence;    // Sensor match score
+        uint8_t type;
+        uint8_t check;          // Low byte of a CRC32 over the fields above
+    };
+    static_assert(sizeof(Record) == 16, "records pack 16 to a flash page");
+
+    static constexpr uint16_t PAGE_RECORDS = 256 / sizeof(Record);
+    static constexpr uint16_t SECTOR_RECORDS = SPI_FLASH_SEC_SIZE / sizeof(Record);
+
+    static const char *name(uint8_t type) {
+        static const char *const names[TYPE_COUNT] = {
+            "boot", "granted", "pin-ok", "finger-ok", "pin-denied", "finger-denied",
+            "pin-lockout", "finger-lockout", "admin-menu", "console-login", "console-denied",
+            "remote-unlock", "remote-config", "firmware-staged",
+        };
+        return type < TYPE_COUNT ? names[type] : "?";
+    }
+
+    // Find the partition and the newest record in it. False (and a log that
+    // keeps only its RAM ring) without a usable partition.
+    bool begin(const char *label, uint32_t flushDelayMs) {
+        flushDelay = flushDelayMs;
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        if (!partition || partition->size < 2 * SPI_FLASH_SEC_SIZE) {
+            partition = nullptr;
+            return false;
+        }
+        slots = (partition->size / SPI_FLASH_SEC_SIZE) * SECTOR_RECORDS;
+        recover();
+        return true;
+    }
+
+    // RAM only. A full ring drops its oldest unwritten record.
+    const Record &record(Type type, uint32_t time, uint16_t user, uint16_t finger, uint16_t confidence, uint32_t now) {
+        if (pending == RamRecords) {
+            tail = (tail + 1) % RamRecords;
+            pending--;
+            lost++;
+        }
+        if (pending == 0) oldestAt = now;
+        Record &r = ring[(tail + pending) % RamRecords];
+        r = {next++, time, user, finger, confidence, type, 0};
+        r.check = checksum(r);
+        pending++;
+        return r;
+    }
+
+    // Write once a page is complete, or once the oldest unwritten record has
+    // waited flushDelay
+    void service(uint32_t now) {
+        if (!pending) return;
+        uint16_t toPageEnd = PAGE_RECORDS - ring[tail].sequence % PAGE_RECORDS;
+        if (pending >= toPageEnd || now - oldestAt >= flushDelay) flush();
+    }
+
+    // Write everything pending (before sleep or restart)
+    bool flush() {
+        if (!partition) return pending == 0;
+        while (pending) {
+            const Record &first = ring[tail];
+            uint32_t slot = first.sequence % slots;
+            if (slot % SECTOR_RECORDS == 0 &&
+                esp_partition_erase_range(partition, slot * sizeof(Record), SPI_FLASH_SEC_SIZE) != ESP_OK) {
+                return false;
+            }
+            uint16_t count = PAGE_RECORDS - slot % PAGE_RECORDS;
+            if (count > pending) count = pending;
+            if (slot + count > slots) count = slots - slot;
+            for (uint16_t i = 0; i < count; i++) page[i] = ring[(tail + i) % RamRecords];
+            if (esp_partition_write(partition, slot * sizeof(Record), page, count * sizeof(Record)) != ESP_OK) {
+                return false;
+            }
+            tail = (tail + count) % RamRecords;
+            pending -= count;
+            writes++;
+        }
+        return true;
+    }
+
+    // Record sequence from RAM or flash; false once overwritten, or for a gap
+    bool read(uint32_t sequence, Record &out) const {
+        if (sequence >= next) return false;
+        uint32_t unwritten = next - pending;
+        if (sequence >= unwritten) {
+            out = ring[(tail + (sequence - unwritten)) % RamRecords];
+            return true;
+        }
+        if (!partition || next - sequence > slots) return false;
+        if (esp_partition_read(partition, (sequence % slots) * sizeof(Record), &out, sizeof(out)) != ESP_OK) {
+            return false;
+        }
+        return out.sequence == sequence && out.check == checksum(out);
+    }
+
+    uint32_t newest() const { return next; }                          // One past the last record
+    uint32_t oldest() const { return next > slots ? next - slots : 0; }  // Lowest that may still be there
+    uint16_t unwritten() const { return pending; }
+    uint32_t dropped() const { return lost; }
+    uint32_t pageWrites() const { return writes; }
+
+private:
+    static uint8_t checksum(const Record &r) {
+        return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&r), offsetof(Record, check)) & 0xFF;
+    }
+
+    bool valid(uint32_t slot, Record &r) const {
+        if (esp_partition_read(partition, slot * sizeof(Record), &r, sizeof(r)) != ESP_OK) return false;
+        return r.sequence != 0xFFFFFFFF && r.sequence % slots == slot && r.check == checksum(r);
+    }
+
+    // The newest sector starts with the highest sequence; its last valid
+    // record in order is the newest overall
+    void recover() {
+        Record r;
+        bool any = false;
+        uint32_t start = 0;
+        for (uint32_t slot = 0; slot < slots; slot += SECTOR_RECORDS) {
+            if (valid(slot, r) && (!any || r.sequence > next)) {
+                next = r.sequence;
+                start = slot;
+                any = true;
+            }
+        }
+        if (!any) {
+            next = 0;
+            return;
+        }
+        for (uint32_t slot = start + 1; slot < start + SECTOR_RECORDS; slot++) {
+            if (!valid(slot, r) || r.sequence != next + 1) break;
+            next = r.sequence;
+        }
+        next++;
+
+        // A torn write leaves the next slot neither valid nor blank; it can't
+        // be programmed again before an erase, so start on the next sector
+        uint32_t slot = next % slots;
+        if (slot % SECTOR_RECORDS == 0) return;
+        uint8_t raw[sizeof(Record)];
+        esp_partition_read(partition, slot * sizeof(Record), raw, sizeof(raw));
+        for (uint8_t byte : raw) {
+            if (byte != 0xFF) {
+                next += SECTOR_RECORDS - slot % SECTOR_RECORDS;
+                return;
+            }
+        }
+    }
+
+    const esp_partition_t *partition = nullptr;
+    uint32_t slots = 0;
+    uint32_t flushDelay = 0;
+    uint32_t next = 0;            // Sequence for the next record
+    Record ring[RamRecords];
+    uint16_t tail = 0;            // Ring index of the oldest unwritten record
+    uint16_t pending = 0;
+    uint32_t oldestAt = 0;
+    uint32_t lost = 0;
+    uint32_t writes = 0;
+    Record page[PAGE_RECORDS];    // Staged for the flash driver
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+// One hardware revision as a struct of constants: the keypad matrix, the LCD
+// and the sensor link as wired on that board. BoardTraits derives the rest
+// (key count, wake masks) and checks the wiring against what deep sleep
+// needs, all at compile time, so choosing a variant costs nothing at run time.
+//
+// A profile provides
+//   KEYPAD_ROWS, KEYPAD_COLS, ROW_PINS[], COL_PINS[], KEYS[] (legends, row by row)
+//   LCD_COLS, LCD_ROWS, LCD_I2C_ADDR
+//   FP_RX, FP_TX, FP_BAUD_RATE (factory rate), FP_FAST_BAUD_RATE (as raised at init)
+namespace board {
+
+// Bit n set for each GPIO n in pins
+constexpr uint64_t pinMask(const uint8_t *pins, uint8_t count) {
+    return count == 0 ? 0 : (1ULL << pins[0]) | pinMask(pins + 1, count - 1);
+}
+
+// GPIOs with an RTC IO, which EXT1 and the ULP can reach in deep sleep
+constexpr uint64_t RTC_GPIOS = (1ULL << 0) | (1ULL << 2) | (1ULL << 4) | (1ULL << 12) | (1ULL << 13) |
+                               (1ULL << 14) | (1ULL << 15) | (1ULL << 25) | (1ULL << 26) | (1ULL << 27) |
+                               (1ULL << 32) | (1ULL << 33) | (1ULL << 34) | (1ULL << 35) | (1ULL << 36) |
+                               (1ULL << 37) | (1ULL << 38) | (1ULL << 39);
+
+// GPIO 34 and up are inputs only
+constexpr uint64_t OUTPUT_GPIOS = (1ULL << 34) - 1;
+
+}  // namespace board
+
+template <class Profile>
+struct BoardTraits : Profile {
+    static constexpr uint8_t KEY_COUNT = Profile::KEYPAD_ROWS * Profile::KEYPAD_COLS;
+    static constexpr uint64_t KEYPAD_ROW_MASK = board::pinMask(Profile::ROW_PINS, Profile::KEYPAD_ROWS);
+    static constexpr uint64_t KEYPAD_COL_MASK = board::pinMask(Profile::COL_PINS, Profile::KEYPAD_COLS);
+    static constexpr uint64_t KEYPAD_WAKE_PINS = KEYPAD_ROW_MASK | KEYPAD_COL_MASK;
+
+    static_assert(sizeof(Profile::ROW_PINS) == Profile::KEYPAD_ROWS, "one GPIO per keypad row");
+    static_assert(sizeof(Profile::COL_PINS) == Profile::KEYPAD_COLS, "one GPIO per keypad column");
+    static_assert(sizeof(Profile::KEYS) == KEY_COUNT, "one legend per key");
+    static_assert((KEYPAD_ROW_MASK & KEYPAD_COL_MASK) == 0, "a GPIO is both a row and a column");
+    static_assert((KEYPAD_WAKE_PINS & ~board::RTC_GPIOS) == 0, "keypad lines must be RTC GPIOs to wake from deep sleep");
+    static_assert((KEYPAD_COL_MASK & ~board::OUTPUT_GPIOS) == 0, "keypad columns are driven, GPIO 34-39 can't be");
+    static_assert(Profile::FP_FAST_BAUD_RATE % 9600 == 0, "the sensor takes its rate in steps of 9600");
+};
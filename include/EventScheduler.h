@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+// Handle to a scheduled event. 0 means "nothing scheduled"; the upper byte is a
+// generation counter so a stale handle never cancels a slot that was reused.
+using TimerHandle = uint16_t;
+constexpr TimerHandle NO_TIMER = 0;
+
+// Fixed-capacity timer queue for the cooperative main loop. Callbacks are due
+// at an absolute millis() timestamp; run() fires whatever is due and
+// nextDelay() tells the caller how long it may idle before the next event.
+template <uint8_t Capacity>
+class EventScheduler {
+    static_assert(Capacity > 0 && Capacity < 255, "slot index must fit in the handle's low byte");
+
+public:
+    using Callback = void (*)();
+
+    // Queue cb to run delayMs after now. Returns NO_TIMER if every slot is busy.
+    TimerHandle schedule(uint32_t now, uint32_t delayMs, Callback cb) {
+        for (uint8_t i = 0; i < Capacity; i++) {
+            Slot &slot = slots[i];
+            if (slot.callback) continue;
+            slot.callback = cb;
+            slot.due = now + delayMs;
+            if (++slot.generation == 0) slot.generation = 1;
+            return static_cast<TimerHandle>((slot.generation << 8) | (i + 1));
+        }
+        return NO_TIMER;
+    }
+
+    // Replace whatever the handle currently refers to with a fresh event
+    void arm(TimerHandle &handle, uint32_t now, uint32_t delayMs, Callback cb) {
+        cancel(handle);
+        handle = schedule(now, delayMs, cb);
+    }
+
+    void cancel(TimerHandle &handle) {
+        Slot *slot = lookup(handle);
+        if (slot) slot->callback = nullptr;
+        handle = NO_TIMER;
+    }
+
+    bool pending(TimerHandle handle) const {
+        return lookup(handle) != nullptr;
+    }
+
+    // Fire every due event. A slot is released before its callback runs, so
+    // callbacks are free to schedule follow-up events (tone steps, restores).
+    void run(uint32_t now) {
+        for (uint8_t i = 0; i < Capacity; i++) {
+            Slot &slot = slots[i];
+            if (!slot.callback || static_cast<int32_t>(now - slot.due) < 0) continue;
+            Callback cb = slot.callback;
+            slot.callback = nullptr;
+            cb();
+        }
+    }
+
+    // Milliseconds until the next event is due, capped at maxDelay
+    uint32_t nextDelay(uint32_t now, uint32_t maxDelay) const {
+        uint32_t best = maxDelay;
+        for (uint8_t i = 0; i < Capacity; i++) {
+            const Slot &slot = slots[i];
+            if (!slot.callback) continue;
+            int32_t remaining = static_cast<int32_t>(slot.due - now);
+            if (remaining <= 0) return 0;
+            if (static_cast<uint32_t>(remaining) < best) best = remaining;
+        }
+        return best;
+    }
+
+private:
+    struct Slot {
+        Callback callback = nullptr;
+        uint32_t due = 0;
+        uint8_t generation = 0;
+    };
+
+    const Slot *lookup(TimerHandle handle) const {
+        uint8_t index = handle & 0xFF;
+        if (index == 0 || index > Capacity) return nullptr;
+        const Slot &slot = slots[index - 1];
+        return (slot.callback && slot.generation == (handle >> 8)) ? &slot : nullptr;
+    }
+
+    Slot *lookup(TimerHandle handle) {
+        return const_cast<Slot *>(static_cast<const EventScheduler *>(this)->lookup(handle));
+    }
+
+    Slot slots[Capacity];
+};
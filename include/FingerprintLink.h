@@ -0,0 +1,221 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Non-blocking driver for the match path of ZFM/R30x-family sensors (the same
+// packet protocol Adafruit_Fingerprint speaks). Each stage is one command
+// packet; the reply is parsed incrementally from whatever has arrived, so the
+// owning task can sleep on UART receive events instead of busy-waiting inside
+// the library for every exchange.
+//
+// Only touches the port while a pipeline is in flight, which lets the blocking
+// Adafruit calls (enroll, delete, parameters) share the UART when it is idle.
+class FingerprintLink {
+public:
+    enum Stage : uint8_t {
+        IDLE,
+        CAPTURE,   // GenImg
+        EXTRACT,   // Img2Tz into the char buffer
+        SEARCH     // HighSpeedSearch over [start, start + count)
+    };
+
+    struct Reply {
+        Stage stage;
+        uint8_t status;   // Confirmation code, or TIMEOUT/BAD_PACKET from the link itself
+        uint16_t id;      // SEARCH: matched page
+        uint16_t score;   // SEARCH: match confidence
+    };
+
+    // Called as each stage completes; return true to issue the next stage
+    using StageCallback = bool (*)(const Reply &reply);
+
+    static constexpr uint8_t TIMEOUT = 0xFF;     // Same codes as Adafruit_Fingerprint
+    static constexpr uint8_t BAD_PACKET = 0xFE;
+
+    void begin(Stream &port, StageCallback callback, uint32_t replyTimeoutMs = 1500,
+               uint32_t address = 0xFFFFFFFF) {
+        this->port = &port;
+        this->callback = callback;
+        this->replyTimeout = replyTimeoutMs;
+        this->address = address;
+        stage = IDLE;
+    }
+
+    // Kick off GenImg -> Img2Tz -> Search. Returns false if a pipeline is already running.
+    bool startMatch(uint16_t searchStart, uint16_t searchCount, uint8_t buffer = 1) {
+        if (busy() || !port) return false;
+        this->searchStart = searchStart;
+        this->searchCount = searchCount;
+        this->buffer = buffer;
+        while (port->available()) port->read();  // Drop anything stale from the last exchange
+        issue(CAPTURE);
+        return true;
+    }
+
+    // Search the features from the last extract again over another range, e.g.
+    // from the callback after a narrow first search missed
+    bool search(uint16_t searchStart, uint16_t searchCount) {
+        if (busy() || !port) return false;
+        this->searchStart = searchStart;
+        this->searchCount = searchCount;
+        issue(SEARCH);
+        return true;
+    }
+
+    // Feed received bytes through the parser and enforce the reply deadline.
+    // Call on every UART receive event and whenever the wait for one expires.
+    void service(uint32_t nowMs) {
+        if (!busy()) return;
+        while (busy() && port->available()) {
+            if (consume(static_cast<uint8_t>(port->read()))) complete();
+        }
+        if (busy() && static_cast<int32_t>(nowMs - deadline) >= 0) {
+            rx.status = TIMEOUT;
+            complete();
+        }
+    }
+
+    bool busy() const { return stage != IDLE; }
+
+    uint32_t msUntilDeadline(uint32_t nowMs) const {
+        int32_t remaining = static_cast<int32_t>(deadline - nowMs);
+        return remaining > 0 ? remaining : 0;
+    }
+
+private:
+    static constexpr uint8_t CMD_GEN_IMG = 0x01;
+    static constexpr uint8_t CMD_IMG2TZ = 0x02;
+    static constexpr uint8_t CMD_HISPEED_SEARCH = 0x1B;
+    static constexpr uint8_t PID_COMMAND = 0x01;
+    static constexpr uint8_t PID_ACK = 0x07;
+    static constexpr uint8_t MAX_PAYLOAD = 8;
+
+    void issue(Stage next) {
+        uint8_t payload[6];
+        uint8_t length = 0;
+        switch (next) {
+            case CAPTURE:
+                payload[length++] = CMD_GEN_IMG;
+                break;
+            case EXTRACT:
+                payload[length++] = CMD_IMG2TZ;
+                payload[length++] = buffer;
+                break;
+            case SEARCH:
+                payload[length++] = CMD_HISPEED_SEARCH;
+                payload[length++] = buffer;
+                payload[length++] = searchStart >> 8;
+                payload[length++] = searchStart & 0xFF;
+                payload[length++] = searchCount >> 8;
+                payload[length++] = searchCount & 0xFF;
+                break;
+            default:
+                return;
+        }
+        stage = next;
+        rxIndex = 0;
+        rx = {};
+        deadline = millis() + replyTimeout;
+        sendPacket(payload, length);
+    }
+
+    void sendPacket(const uint8_t *payload, uint8_t length) {
+        uint16_t packetLength = length + 2;  // Payload plus checksum
+        uint8_t header[9] = {
+            0xEF, 0x01,
+            static_cast<uint8_t>(address >> 24), static_cast<uint8_t>(address >> 16),
+            static_cast<uint8_t>(address >> 8), static_cast<uint8_t>(address),
+            PID_COMMAND,
+            static_cast<uint8_t>(packetLength >> 8), static_cast<uint8_t>(packetLength)
+        };
+        uint16_t sum = PID_COMMAND + (packetLength >> 8) + (packetLength & 0xFF);
+        for (uint8_t i = 0; i < length; i++) sum += payload[i];
+        uint8_t checksum[2] = {static_cast<uint8_t>(sum >> 8), static_cast<uint8_t>(sum)};
+
+        port->write(header, sizeof(header));
+        port->write(payload, length);
+        port->write(checksum, sizeof(checksum));
+    }
+
+    // Byte-at-a-time reply parser; returns true once a full, valid ACK is in rx
+    bool consume(uint8_t byte) {
+        switch (rxIndex) {
+            case 0:
+                if (byte != 0xEF) return false;
+                break;
+            case 1:
+                if (byte != 0x01) { rxIndex = 0; return false; }
+                break;
+            case 2: case 3: case 4: case 5:
+                break;  // Address; replies echo ours
+            case 6:
+                rxPid = byte;
+                rxSum = byte;
+                break;
+            case 7:
+                rxLength = byte << 8;
+                rxSum += byte;
+                break;
+            case 8:
+                rxLength |= byte;
+                rxSum += byte;
+                if (rxLength < 3 || rxLength - 2 > MAX_PAYLOAD) { rxIndex = 0; return false; }
+                break;
+            default: {
+                uint16_t offset = rxIndex - 9;
+                uint16_t payloadLength = rxLength - 2;
+                if (offset < payloadLength) {
+                    rxPayload[offset] = byte;
+                    rxSum += byte;
+                } else if (offset == payloadLength) {
+                    rxChecksum = byte << 8;
+                } else {
+                    rxChecksum |= byte;
+                    rxIndex = 0;
+                    if (rxPid != PID_ACK || rxChecksum != rxSum) {
+                        rx.status = BAD_PACKET;
+                        return true;
+                    }
+                    rx.status = rxPayload[0];
+                    if (stage == SEARCH && payloadLength >= 5) {
+                        rx.id = (rxPayload[1] << 8) | rxPayload[2];
+                        rx.score = (rxPayload[3] << 8) | rxPayload[4];
+                    }
+                    return true;
+                }
+                break;
+            }
+        }
+        rxIndex++;
+        return false;
+    }
+
+    void complete() {
+        rx.stage = stage;
+        Stage finished = stage;
+        stage = IDLE;  // The callback may inspect busy() or start over
+        bool next = callback && callback(rx);
+        if (next && rx.status == 0 && finished != SEARCH) {
+            issue(static_cast<Stage>(finished + 1));
+        }
+    }
+
+    Stream *port = nullptr;
+    StageCallback callback = nullptr;
+    uint32_t address = 0xFFFFFFFF;
+    uint32_t replyTimeout = 1500;
+    uint32_t deadline = 0;
+
+    volatile Stage stage = IDLE;
+    uint8_t buffer = 1;
+    uint16_t searchStart = 0;
+    uint16_t searchCount = 0;
+
+    Reply rx = {};
+    uint16_t rxIndex = 0;
+    uint8_t rxPid = 0;
+    uint16_t rxLength = 0;
+    uint16_t rxSum = 0;
+    uint16_t rxChecksum = 0;
+    uint8_t rxPayload[MAX_PAYLOAD] = {};
+};
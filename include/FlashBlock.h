@@ -0,0 +1,140 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+// A struct kept in a raw data partition and read in place through the flash
+// cache, for tables too big to copy into RAM. The partition holds two banks.
+// Each bank is an image of T followed by a trailer with a version, a sequence
+// number and a CRC32. The valid bank with the higher sequence is current.
+//
+// update() writes the other bank: the current image with patches applied,
+// trailer last. A write cut short leaves the old image in charge. Every
+// update erases and rewrites a whole bank, so this suits data that changes
+// on an admin's command, not on every unlock.
+template <class T>
+class FlashBlock {
+public:
+    struct Patch {
+        uint32_t offset;      // Into T
+        const void *bytes;
+        uint32_t length;
+    };
+
+    // Map the partition and pick the current bank. With neither bank valid an
+    // all-zero image is written and fresh() is set. False without the partition.
+    bool begin(const char *label, uint16_t version) {
+        this->version = version;
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        if (!partition || partition->size < 2 * BANK_SIZE) return false;
+        const void *mapped;
+        if (esp_partition_mmap(partition, 0, 2 * BANK_SIZE, SPI_FLASH_MMAP_DATA, &mapped, &mapping) != ESP_OK) {
+            return false;
+        }
+        banks = static_cast<const uint8_t *>(mapped);
+
+        const Trailer *a = validTrailer(0);
+        const Trailer *b = validTrailer(1);
+        if (!a && !b) {
+            blank = true;
+            formatted = update(nullptr, 0);
+            return formatted;
+        }
+        current = !a || (b && int32_t(b->sequence - a->sequence) > 0);
+        sequence = (current ? b : a)->sequence;
+        return true;
+    }
+
+    const T &data() const { return *reinterpret_cast<const T *>(banks + current * BANK_SIZE); }
+    bool ready() const { return banks && !blank; }
+    bool fresh() const { return formatted; }
+    uint32_t commitCount() const { return commits; }
+
+    // Patch for one field of data(): copy value over it
+    template <class F>
+    Patch patch(const F &field, const F &value) const {
+        return {uint32_t(reinterpret_cast<const uint8_t *>(&field) - reinterpret_cast<const uint8_t *>(&data())),
+                &value, sizeof(F)};
+    }
+
+    // New image: the current one with patches applied in order
+    bool update(const Patch *patches, uint8_t count) {
+        if (!banks) return false;
+        uint8_t target = blank ? 0 : current ^ 1;
+        uint32_t base = target * BANK_SIZE;
+        if (esp_partition_erase_range(partition, base, BANK_SIZE) != ESP_OK) return false;
+
+        const uint8_t *source = blank ? nullptr : banks + current * BANK_SIZE;
+        uint32_t crc = 0;
+        for (uint32_t at = 0; at < sizeof(T); at += CHUNK) {
+            uint32_t length = sizeof(T) - at < CHUNK ? sizeof(T) - at : CHUNK;
+            // Staged in RAM: while the driver writes, the cache (and so source) is off
+            if (source) {
+                memcpy(chunk, source + at, length);
+            } else {
+                memset(chunk, 0, length);
+            }
+            for (uint8_t i = 0; i < count; i++) apply(patches[i], at, length);
+            crc = esp_rom_crc32_le(crc, chunk, length);
+            if (esp_partition_write(partition, base + at, chunk, length) != ESP_OK) return false;
+        }
+
+        Trailer trailer = {MAGIC, version, uint16_t(sizeof(T) & 0xFFFF), sequence + 1, 0};
+        trailer.crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(&trailer), offsetof(Trailer, crc));
+        if (esp_partition_write(partition, base + TRAILER_AT, &trailer, sizeof(trailer)) != ESP_OK) return false;
+
+        // The flash driver drops cached lines over what it wrote, so data() sees the new bank
+        current = target;
+        sequence++;
+        blank = false;
+        commits++;
+        return true;
+    }
+
+private:
+    struct Trailer {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;        // Low bits of sizeof(T)
+        uint32_t sequence;
+        uint32_t crc;         // Over the image and everything above
+    };
+
+    static constexpr uint32_t MAGIC = 0x4B4C4246;  // "FBLK"
+    static constexpr uint32_t CHUNK = 256;
+    static constexpr uint32_t TRAILER_AT = (sizeof(T) + 3) & ~3u;
+    static constexpr uint32_t BANK_SIZE =
+        (TRAILER_AT + sizeof(Trailer) + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+
+    const Trailer *validTrailer(uint8_t bank) const {
+        const uint8_t *image = banks + bank * BANK_SIZE;
+        const Trailer *trailer = reinterpret_cast<const Trailer *>(image + TRAILER_AT);
+        if (trailer->magic != MAGIC || trailer->version != version || trailer->size != (sizeof(T) & 0xFFFF)) {
+            return nullptr;
+        }
+        uint32_t crc = esp_rom_crc32_le(0, image, sizeof(T));
+        crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t *>(trailer), offsetof(Trailer, crc));
+        return crc == trailer->crc ? trailer : nullptr;
+    }
+
+    // The part of patch that falls in [at, at + length) of the image
+    void apply(const Patch &patch, uint32_t at, uint32_t length) {
+        uint32_t from = patch.offset > at ? patch.offset : at;
+        uint32_t end = patch.offset + patch.length;
+        if (end > at + length) end = at + length;
+        if (from >= end) return;
+        memcpy(chunk + (from - at), static_cast<const uint8_t *>(patch.bytes) + (from - patch.offset), end - from);
+    }
+
+    const esp_partition_t *partition = nullptr;
+    spi_flash_mmap_handle_t mapping = 0;
+    const uint8_t *banks = nullptr;
+    uint16_t version = 0;
+    uint8_t current = 0;
+    bool blank = false;       // Neither bank valid yet
+    bool formatted = false;
+    uint32_t sequence = 0;
+    uint32_t commits = 0;
+    uint8_t chunk[CHUNK];
+};
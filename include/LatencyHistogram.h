@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+
+// Fixed-bucket latency histogram over microseconds. Bucket n counts samples in
+// [2^n, 2^(n+1)) µs (bucket 0 also takes 0), so 24 buckets reach ~16 s with a
+// constant-time record() and no allocation. Percentiles are reported as the
+// upper edge of the bucket they fall in: within a factor of two, which is
+// enough to tell a healthy sensor from a struggling one.
+//
+// Meant to have a single writer; a reader on another task may see a sample
+// half-recorded, which only matters for a debugging printout.
+class LatencyHistogram {
+public:
+    static constexpr uint8_t BUCKETS = 24;
+
+    void record(uint32_t us) {
+        uint8_t bucket = us ? 31 - __builtin_clz(us) : 0;
+        if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+        counts[bucket]++;
+        if (!samples || us < lowest) lowest = us;
+        if (us > highest) highest = us;
+        sum += us;
+        samples++;
+    }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        samples = 0;
+        sum = 0;
+        lowest = 0;
+        highest = 0;
+    }
+
+    uint32_t count() const { return samples; }
+    uint32_t fastest() const { return lowest; }
+    uint32_t slowest() const { return highest; }
+    uint32_t mean() const { return samples ? sum / samples : 0; }
+    uint32_t bucket(uint8_t n) const { return n < BUCKETS ? counts[n] : 0; }
+
+    // Upper bound of the bucket holding the pct-th percentile sample
+    uint32_t percentile(uint8_t pct) const {
+        if (!samples) return 0;
+        uint32_t rank = (static_cast<uint64_t>(samples) * pct + 99) / 100;
+        uint32_t seen = 0;
+        for (uint8_t n = 0; n < BUCKETS; n++) {
+            seen += counts[n];
+            if (seen >= rank) {
+                uint32_t edge = (2UL << n) - 1;
+                return edge < highest ? edge : highest;
+            }
+        }
+        return highest;
+    }
+
+private:
+    uint32_t counts[BUCKETS] = {};
+    uint32_t samples = 0;
+    uint64_t sum = 0;
+    uint32_t lowest = 0;
+    uint32_t highest = 0;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+
+// Custom-character bitmaps as last uploaded to the controller. Kept by the
+// caller, typically in RTC memory: the LCD keeps CGRAM while the ESP32 deep
+// sleeps, so a wake does not need to send the glyphs again.
+struct LcdGlyphCache {
+    uint8_t valid;         // Bit n set once slot n has been uploaded
+    uint8_t rows[8][8];
+};
+
+// Shadow framebuffer for an HD44780-style character LCD. Drawing goes into
+// the frame; update() compares it with what is known to be on the glass and
+// sends only the changed cells, reusing the controller's auto-incrementing
+// cursor so a run of changed cells costs one cursor move. Nothing is ever
+// cleared on the device itself.
+template <class Lcd, uint8_t Cols, uint8_t Rows>
+class LcdFrameBuffer : public Print {
+public:
+    explicit LcdFrameBuffer(Lcd &lcd) : lcd(lcd) {
+        memset(frame, ' ', sizeof(frame));
+        memset(glass, ' ', sizeof(glass));
+    }
+
+    // Forget what is on the glass (after the controller was re-initialised or
+    // someone else wrote to it); the next update() repaints every cell
+    void invalidate() {
+        glassKnown = false;
+        cursorRow = NO_CURSOR;
+    }
+
+    // The controller was just reset: it shows blanks with the cursor home
+    void assumeCleared() {
+        memset(glass, ' ', sizeof(glass));
+        glassKnown = true;
+        cursorRow = 0;
+        cursorCol = 0;
+    }
+
+    void clear() {
+        memset(frame, ' ', sizeof(frame));
+        col = 0;
+        row = 0;
+    }
+
+    void setCursor(uint8_t c, uint8_t r) {
+        col = c;
+        row = r;
+    }
+
+    // Characters past the end of a line are dropped rather than wrapped
+    size_t write(uint8_t ch) override {
+        if (row >= Rows || col >= Cols) return 0;
+        frame[row][col++] = ch;
+        return 1;
+    }
+    using Print::write;
+
+    // Send the changed cells; returns how many were written
+    uint8_t update() {
+        uint8_t written = 0;
+        for (uint8_t r = 0; r < Rows; r++) {
+            for (uint8_t c = 0; c < Cols; c++) {
+                if (glassKnown && frame[r][c] == glass[r][c]) continue;
+                if (cursorRow != r || cursorCol != c) lcd.setCursor(c, r);
+                lcd.write(frame[r][c]);
+                glass[r][c] = frame[r][c];
+                cursorRow = r;
+                cursorCol = c + 1;  // DDRAM lines aren't contiguous, so this never carries into the next row
+                written++;
+            }
+        }
+        glassKnown = true;
+        return written;
+    }
+
+    // Upload a custom character unless the cache says the controller already has it
+    void defineGlyph(LcdGlyphCache &cache, uint8_t slot, uint8_t bitmap[8]) {
+        slot &= 7;
+        if ((cache.valid & (1 << slot)) && memcmp(cache.rows[slot], bitmap, 8) == 0) return;
+        lcd.createChar(slot, bitmap);
+        memcpy(cache.rows[slot], bitmap, 8);
+        cache.valid |= 1 << slot;
+        cursorRow = NO_CURSOR;  // CGRAM writes move the address counter off the display
+    }
+
+private:
+    static constexpr uint8_t NO_CURSOR = 0xFF;
+
+    Lcd &lcd;
+    uint8_t frame[Rows][Cols];
+    uint8_t glass[Rows][Cols];
+    bool glassKnown = false;
+    uint8_t cursorRow = NO_CURSOR;
+    uint8_t cursorCol = 0;
+    uint8_t col = 0;
+    uint8_t row = 0;
+};
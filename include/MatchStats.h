@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Arduino.h>
+
+// How the sensor is doing at this site, for choosing its security level:
+// where touches are lost (poor images, misses) and how confidently each user
+// matches. A user who often scores near the bottom band would start failing
+// at a stricter level. Plain data, persisted as-is like TemplateIndex.
+template <uint8_t Tracked, uint8_t Bands = 8, uint16_t BandWidth = 50>
+struct MatchStats {
+    struct User {
+        uint16_t id;         // 0 marks a free slot
+        uint16_t matches;
+        uint16_t lowest;
+        uint16_t highest;
+        uint32_t total;      // Sum of confidences, for the mean
+    };
+
+    uint32_t touches;        // Touches that reached a verdict
+    uint32_t retries;        // Silent re-captures after a poor image
+    uint32_t imageErrors;    // Touches that never gave a usable image
+    uint32_t misses;         // Usable image, no template matched
+    uint32_t bands[Bands];   // Match confidences; the last band is open-ended
+    User users[Tracked];
+
+    // One touch's outcome and the re-captures it took
+    void touch(uint8_t retried) {
+        touches++;
+        retries += retried;
+    }
+
+    void imageError() { imageErrors++; }
+    void miss() { misses++; }
+
+    // A template matched; user 0 when nobody owns it. A user not yet tracked
+    // takes a free slot or the one with fewest matches.
+    void match(uint16_t user, uint16_t confidence) {
+        uint16_t band = confidence / BandWidth;
+        bands[band < Bands ? band : Bands - 1]++;
+        if (user == 0) return;
+
+        User *slot = nullptr;
+        for (User &u : users) {
+            if (u.id == user) { slot = &u; break; }
+            if (!slot || u.matches < slot->matches) slot = &u;
+        }
+        if (slot->id != user) *slot = {user, 0, UINT16_MAX, 0, 0};
+        if (slot->matches == UINT16_MAX) {
+            slot->matches /= 2;  // Keep the mean: halve both
+            slot->total /= 2;
+        }
+        slot->matches++;
+        slot->total += confidence;
+        if (confidence < slot->lowest) slot->lowest = confidence;
+        if (confidence > slot->highest) slot->highest = confidence;
+    }
+
+    // A removed user's numbers no longer mean anything
+    void forget(uint16_t user) {
+        for (User &u : users) {
+            if (u.id == user) u = {};
+        }
+    }
+};
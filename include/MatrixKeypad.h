@@ -0,0 +1,242 @@
+#pragma once
+
+#include <Arduino.h>
+#include "soc/gpio_struct.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Timer-driven matrix scanner. Each hardware-timer tick samples the columns for
+// the row driven on the previous tick, then moves on to the next row, so every
+// row gets a full period to settle without busy-waiting. All GPIO traffic goes
+// through the W1TS/W1TC registers: rows idle as pulled-up inputs and are driven
+// low by enabling their output driver, never fighting a neighbouring row when
+// two keys in one column are held.
+//
+// Debounce works on whole-matrix bitmasks: a key reads as down once it has been
+// down for DebounceScans consecutive passes, and up once it has been up for as
+// many. Every key is tracked independently (n-key rollover; ghosting still
+// applies to a diode-less matrix). Edges go into a single-producer ring buffer
+// and the listener task is notified.
+//
+// While nobody is typing the scan can be parked: the timer stops, every row is
+// driven low and a column falling to a keypress raises a GPIO interrupt (and
+// wakes the chip from light sleep) so the listener can resume scanning.
+template <uint8_t Rows, uint8_t Cols, uint8_t DebounceScans = 4>
+class MatrixKeypad {
+    static_assert(Rows * Cols <= 32, "key state is kept in a 32-bit mask");
+    static_assert(DebounceScans > 0 && DebounceScans <= 8, "debounce history is kept per pass");
+
+public:
+    struct Event {
+        uint8_t key;      // Row-major index into the keymap
+        bool pressed;     // false = released
+    };
+
+    // Claim the pins and start scanning on hardware timer timerNum. isr must be
+    // an IRAM function that calls scanISR() on this instance.
+    void begin(const uint8_t *rowPins, const uint8_t *colPins, uint8_t timerNum,
+               uint32_t rowPeriodUs, void (*isr)(), TaskHandle_t listener) {
+        this->listener = listener;
+
+        for (uint8_t c = 0; c < Cols; c++) {
+            pinMode(colPins[c], INPUT_PULLUP);
+            splitMask(colPins[c], colLow[c], colHigh[c]);
+            this->colPins[c] = colPins[c];
+        }
+        for (uint8_t r = 0; r < Rows; r++) {
+            pinMode(rowPins[r], INPUT_PULLUP);
+            splitMask(rowPins[r], rowLow[r], rowHigh[r]);
+            // Output level is latched low; enabling the driver is what selects the row
+            GPIO.out_w1tc = rowLow[r];
+            GPIO.out1_w1tc.val = rowHigh[r];
+        }
+
+        row = 0;
+        raw = 0;
+        driveRow(row);
+
+        timer = timerBegin(timerNum, 80, true);  // 1 µs ticks from the 80 MHz APB clock
+        timerAttachInterrupt(timer, isr, true);
+        timerAlarmWrite(timer, rowPeriodUs, true);
+        timerAlarmEnable(timer);
+    }
+
+    // Treat the keys in mask as already down (call before begin). A key still
+    // held from before the scan started then reports only its release.
+    void seed(uint32_t mask) {
+        stable = mask;
+        for (uint8_t i = 0; i < DebounceScans; i++) history[i] = mask;
+    }
+
+    // Attach wakeIsr (an IRAM function calling wakeISR()) to every column as a
+    // low-level interrupt and light-sleep wake source. Disarmed until park().
+    void enableWake(void (*wakeIsr)()) {
+        for (uint8_t c = 0; c < Cols; c++) {
+            attachInterrupt(colPins[c], wakeIsr, ONLOW);
+            gpio_wakeup_enable(static_cast<gpio_num_t>(colPins[c]), GPIO_INTR_LOW_LEVEL);
+        }
+        setColumnInterrupts(GPIO_INTR_DISABLE);
+    }
+
+    // Stop scanning with all rows driven, so any key pulls its column low.
+    // Only call with nothing held.
+    void park() {
+        if (isParked || !timer) return;
+        timerAlarmDisable(timer);
+        for (uint8_t r = 0; r < Rows; r++) driveRow(r);
+        isParked = true;
+        setColumnInterrupts(GPIO_INTR_LOW_LEVEL);
+    }
+
+    // Back to one row at a time from a clean debounce state
+    void resume() {
+        if (!isParked) return;
+        setColumnInterrupts(GPIO_INTR_DISABLE);
+        for (uint8_t r = 0; r < Rows; r++) releaseRow(r);
+        row = 0;
+        raw = 0;
+        memset(history, 0, sizeof(history));
+        stable = 0;
+        driveRow(row);
+        isParked = false;
+        timerWrite(timer, 0);
+        timerAlarmEnable(timer);
+    }
+
+    bool parked() const { return isParked; }
+
+    // Column interrupt while parked: disarm (the level would keep firing) and
+    // hand over to the listener, which calls resume()
+    void IRAM_ATTR wakeISR() {
+        for (uint8_t c = 0; c < Cols; c++) GPIO.pin[colPins[c]].int_type = GPIO_INTR_DISABLE;
+        BaseType_t woken = pdFALSE;
+        if (listener) vTaskNotifyGiveFromISR(listener, &woken);
+        if (woken) portYIELD_FROM_ISR();
+    }
+
+    // Stop the timer and float every row, e.g. before the pins go to the RTC domain
+    void stop() {
+        if (timer) {
+            timerAlarmDisable(timer);
+            timerDetachInterrupt(timer);
+            timerEnd(timer);
+            timer = nullptr;
+            setColumnInterrupts(GPIO_INTR_DISABLE);
+        }
+        isParked = false;
+        for (uint8_t r = 0; r < Rows; r++) releaseRow(r);
+    }
+
+    void IRAM_ATTR scanISR() {
+        // Columns read low where a key joins them to the row driven last tick
+        uint32_t in = GPIO.in;
+        uint32_t in1 = GPIO.in1.val;
+        for (uint8_t c = 0; c < Cols; c++) {
+            if (!(in & colLow[c]) && !(in1 & colHigh[c])) raw |= 1UL << (row * Cols + c);
+        }
+
+        releaseRow(row);
+        row = (row + 1 == Rows) ? 0 : row + 1;
+        driveRow(row);
+        if (row != 0) return;
+
+        // Full pass complete: integrate it into the debounced state
+        history[historyIndex] = raw;
+        historyIndex = (historyIndex + 1 == DebounceScans) ? 0 : historyIndex + 1;
+        raw = 0;
+
+        uint32_t allDown = UINT32_MAX;
+        uint32_t anyDown = 0;
+        for (uint8_t i = 0; i < DebounceScans; i++) {
+            allDown &= history[i];
+            anyDown |= history[i];
+        }
+        uint32_t next = (stable | allDown) & anyDown;
+        uint32_t changed = next ^ stable;
+        stable = next;
+        if (!changed) return;
+
+        while (changed) {
+            uint8_t key = __builtin_ctz(changed);
+            changed &= changed - 1;
+            push(key, next & (1UL << key));
+        }
+
+        BaseType_t woken = pdFALSE;
+        if (listener) vTaskNotifyGiveFromISR(listener, &woken);
+        if (woken) portYIELD_FROM_ISR();
+    }
+
+    // Pop the oldest edge; consumer side of the ring buffer
+    bool read(Event &event) {
+        uint8_t t = tail;
+        if (t == head) return false;
+        event = events[t];
+        tail = (t + 1) & (QUEUE_SIZE - 1);
+        return true;
+    }
+
+    // Debounced bitmask of the keys currently held
+    uint32_t held() const { return stable; }
+
+    // Edges lost because the consumer fell behind
+    uint16_t overruns() const { return dropped; }
+
+private:
+    static constexpr uint8_t QUEUE_SIZE = 16;  // Power of two
+    static_assert((QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0, "ring index wraps with a mask");
+
+    static void splitMask(uint8_t pin, uint32_t &low, uint32_t &high) {
+        low = pin < 32 ? 1UL << pin : 0;
+        high = pin < 32 ? 0 : 1UL << (pin - 32);
+    }
+
+    void setColumnInterrupts(gpio_int_type_t type) {
+        for (uint8_t c = 0; c < Cols; c++) GPIO.pin[colPins[c]].int_type = type;
+    }
+
+    void IRAM_ATTR driveRow(uint8_t r) {
+        GPIO.enable_w1ts = rowLow[r];
+        GPIO.enable1_w1ts.val = rowHigh[r];
+    }
+
+    void IRAM_ATTR releaseRow(uint8_t r) {
+        GPIO.enable_w1tc = rowLow[r];
+        GPIO.enable1_w1tc.val = rowHigh[r];
+    }
+
+    void IRAM_ATTR push(uint8_t key, bool pressed) {
+        uint8_t h = head;
+        uint8_t next = (h + 1) & (QUEUE_SIZE - 1);
+        if (next == tail) {
+            dropped++;
+            return;
+        }
+        events[h].key = key;
+        events[h].pressed = pressed;
+        head = next;
+    }
+
+    hw_timer_t *timer = nullptr;
+    TaskHandle_t listener = nullptr;
+
+    uint32_t rowLow[Rows] = {};
+    uint32_t rowHigh[Rows] = {};
+    uint32_t colLow[Cols] = {};
+    uint32_t colHigh[Cols] = {};
+    uint8_t colPins[Cols] = {};
+    bool isParked = false;
+
+    // Scan state, touched only from the timer ISR
+    uint8_t row = 0;
+    uint32_t raw = 0;
+    uint32_t history[DebounceScans] = {};
+    uint8_t historyIndex = 0;
+    volatile uint32_t stable = 0;
+
+    Event events[QUEUE_SIZE] = {};
+    volatile uint8_t head = 0;   // Written by the ISR
+    volatile uint8_t tail = 0;   // Written by the consumer
+    volatile uint16_t dropped = 0;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/ecdsa.h>
+
+// A firmware image written into the idle app partition as it arrives. Each
+// chunk goes to flash as soon as it is hashed, so the image is never held in
+// RAM, and the flash is erased a sector at a time just ahead of the writes.
+// The image is only made bootable once its SHA-256 checks out against an
+// ECDSA P-256 signature from the release key, e.g.
+//   openssl dgst -sha256 -sign release.pem -out firmware.bin.sig firmware.bin
+// Until then the running image stays in charge, whatever the transport did.
+class OtaUpdate {
+public:
+    enum Result : uint8_t {
+        OK,
+        NO_PARTITION,     // No idle app partition, or an update already open
+        FLASH_ERROR,
+        TOO_LARGE,
+        SHORT_IMAGE,      // Fewer bytes than begin() was promised
+        BAD_SIGNATURE,
+        BAD_IMAGE         // Signed, but not an app image for this chip
+    };
+
+    static constexpr uint8_t PUBLIC_KEY_BYTES = 65;   // Uncompressed point: 04 || X || Y
+    static constexpr uint8_t MAX_SIGNATURE_BYTES = 72; // DER
+
+    static const char *name(Result result) {
+        static const char *const names[] = {"ok", "no-partition", "flash-error", "too-large",
+                                            "short-image", "bad-signature", "bad-image"};
+        return result <= BAD_IMAGE ? names[result] : "?";
+    }
+
+    // key: PUBLIC_KEY_BYTES bytes, kept by reference
+    void configure(const uint8_t *publicKey) { key = publicKey; }
+
+    Result begin(uint32_t size, const uint8_t *signature, uint8_t signatureLength) {
+        if (open || signatureLength > MAX_SIGNATURE_BYTES) return NO_PARTITION;
+        target = esp_ota_get_next_update_partition(nullptr);
+        if (!target) return NO_PARTITION;
+        if (size > target->size) return TOO_LARGE;
+        if (esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) return FLASH_ERROR;
+        memcpy(this->signature, signature, signatureLength);
+        this->signatureLength = signatureLength;
+        expected = size;
+        received = 0;
+        mbedtls_sha256_init(&hash);
+        mbedtls_sha256_starts_ret(&hash, 0);
+        open = true;
+        return OK;
+    }
+
+    Result write(const uint8_t *data, uint32_t length) {
+        if (!open) return NO_PARTITION;
+        if (length > expected - received) {
+            abort();
+            return TOO_LARGE;
+        }
+        mbedtls_sha256_update_ret(&hash, data, length);
+        if (esp_ota_write(handle, data, length) != ESP_OK) {
+            abort();
+            return FLASH_ERROR;
+        }
+        received += length;
+        return OK;
+    }
+
+    // Check the signature and make the image the one to boot next
+    Result finish() {
+        if (!open) return NO_PARTITION;
+        if (received != expected) {
+            abort();
+            return SHORT_IMAGE;
+        }
+        uint8_t digest[32];
+        mbedtls_sha256_finish_ret(&hash, digest);
+        mbedtls_sha256_free(&hash);
+        open = false;
+        if (!signedByKey(digest)) {
+            esp_ota_abort(handle);
+            return BAD_SIGNATURE;
+        }
+        if (esp_ota_end(handle) != ESP_OK) return BAD_IMAGE;
+        return esp_ota_set_boot_partition(target) == ESP_OK ? OK : FLASH_ERROR;
+    }
+
+    void abort() {
+        if (!open) return;
+        mbedtls_sha256_free(&hash);
+        esp_ota_abort(handle);
+        open = false;
+    }
+
+    uint32_t progress() const { return received; }
+
+private:
+    bool signedByKey(const uint8_t *digest) const {
+        if (!key) return false;
+        mbedtls_ecdsa_context ecdsa;
+        mbedtls_ecdsa_init(&ecdsa);
+        bool good = mbedtls_ecp_group_load(&ecdsa.grp, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+                    mbedtls_ecp_point_read_binary(&ecdsa.grp, &ecdsa.Q, key, PUBLIC_KEY_BYTES) == 0 &&
+                    mbedtls_ecdsa_read_signature(&ecdsa, digest, 32, signature, signatureLength) == 0;
+        mbedtls_ecdsa_free(&ecdsa);
+        return good;
+    }
+
+    const uint8_t *key = nullptr;
+    const esp_partition_t *target = nullptr;
+    esp_ota_handle_t handle = 0;
+    mbedtls_sha256_context hash;
+    uint8_t signature[MAX_SIGNATURE_BYTES];
+    uint8_t signatureLength = 0;
+    uint32_t expected = 0;
+    uint32_t received = 0;
+    bool open = false;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+
+// Typed settings block cached in RAM and persisted as a single NVS blob.
+// Reads are plain loads from data. The stored image carries a layout version
+// and a CRC32; one that fails either check is ignored and the caller's
+// defaults stay in place.
+//
+// Writes are deferred: changed() only marks the block dirty, and service()
+// commits once no further change has come in for commitDelayMs, so a burst of
+// edits costs one flash write. NVS itself spreads those writes over its pages.
+template <class T>
+class PersistentBlock {
+public:
+    T data = {};
+
+    // Open the namespace and load the stored image. Returns false when there
+    // is none (or it is stale/corrupt), leaving data as the caller set it.
+    bool begin(const char *ns, const char *key, uint16_t version, uint32_t commitDelayMs) {
+        this->key = key;
+        this->version = version;
+        this->commitDelay = commitDelayMs;
+        if (!prefs.begin(ns, false)) return false;
+
+        Image image;
+        if (prefs.getBytesLength(key) != sizeof(image)) return false;
+        if (prefs.getBytes(key, &image, sizeof(image)) != sizeof(image)) return false;
+        if (image.version != version || image.size != sizeof(T)) return false;
+        if (image.crc != checksum(image)) return false;
+
+        data = image.data;
+        return true;
+    }
+
+    // Call after modifying data; restarts the quiet period
+    void changed(uint32_t now) {
+        dirty = true;
+        lastChange = now;
+    }
+
+    // Commit once changes have settled
+    void service(uint32_t now) {
+        if (dirty && now - lastChange >= commitDelay) commit();
+    }
+
+    // Write now if anything is pending (before sleep or restart)
+    bool flush() {
+        return !dirty || commit();
+    }
+
+    bool commit() {
+        Image image = {};
+        image.version = version;
+        image.size = sizeof(T);
+        image.data = data;
+        image.crc = checksum(image);
+        bool ok = prefs.putBytes(key, &image, sizeof(image)) == sizeof(image);
+        if (ok) {
+            dirty = false;
+            commits++;
+        }
+        return ok;
+    }
+
+    bool pending() const { return dirty; }
+    uint32_t commitCount() const { return commits; }
+
+private:
+    struct Image {
+        uint16_t version;
+        uint16_t size;
+        T data;
+        uint32_t crc;   // Over everything above
+    };
+
+    static uint32_t checksum(const Image &image) {
+        return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&image), offsetof(Image, crc));
+    }
+
+    Preferences prefs;
+    const char *key = nullptr;
+    uint16_t version = 0;
+    uint32_t commitDelay = 0;
+    uint32_t lastChange = 0;
+    uint32_t commits = 0;
+    bool dirty = false;
+};
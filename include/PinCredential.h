@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+#include <esp_system.h>
+#include <mbedtls/sha256.h>
+
+// Compile-time shape of a PIN credential. The stored hash is
+// SHA-256(salt || PIN), re-hashed Rounds more times. A few thousand rounds
+// cost tens of milliseconds on the SHA peripheral. That is nothing at the
+// keypad, but it is paid for every one of the 10^Digits guesses against a
+// dumped flash image.
+template <uint8_t Digits, uint16_t Rounds, uint8_t SaltBytes = 16>
+struct PinPolicy {
+    static constexpr uint8_t DIGITS = Digits;
+    static constexpr uint16_t ROUNDS = Rounds;
+    static constexpr uint8_t SALT_BYTES = SaltBytes;
+
+    static_assert(Digits >= 4 && Digits <= 16, "PIN length out of range");
+    static_assert(SaltBytes + Digits <= 55, "salt and PIN must fit one SHA-256 block");
+};
+
+// Salted, stretched PIN hash with constant-time verification. Only the Record
+// is stored; the PIN itself never reaches flash.
+template <class Policy>
+class PinCredential {
+public:
+    static constexpr uint8_t DIGITS = Policy::DIGITS;
+    static constexpr uint8_t SALT_BYTES = Policy::SALT_BYTES;
+    static constexpr uint8_t HASH_BYTES = 32;
+
+    using Salt = uint8_t[SALT_BYTES];
+    using Digest = uint8_t[HASH_BYTES];
+
+    struct Record {
+        Salt salt;
+        Digest hash;
+    };
+
+    // A PIN as it is typed. Each digit goes straight into the hash, so no
+    // plaintext copy is kept. matches() then costs the same whatever was
+    // entered. Salt and digits fit in one block, so the SHA engine is only
+    // claimed inside matches().
+    class Entry {
+    public:
+        ~Entry() { clear(); }
+
+        // Returns true once the PIN is complete; later digits are ignored
+        bool add(const Record &record, char digit) { return add(record.salt, digit); }
+
+        bool add(const Salt &salt, char digit) {
+            if (count >= Policy::DIGITS) return true;
+            if (count == 0) {
+                mbedtls_sha256_init(&context);
+                mbedtls_sha256_starts_ret(&context, 0);
+                mbedtls_sha256_update_ret(&context, salt, sizeof(Salt));
+            }
+            uint8_t byte = static_cast<uint8_t>(digit);
+            mbedtls_sha256_update_ret(&context, &byte, 1);
+            return ++count >= Policy::DIGITS;
+        }
+
+        uint8_t length() const { return count; }
+
+        // Finish the hash and compare. A short entry still runs the full
+        // stretch so it fails in the same time. The entry restarts empty.
+        bool matches(const Record &record) {
+            bool complete = count == Policy::DIGITS;
+            if (count == 0) add(record, '\0');
+            Digest digest;
+            finish(digest);
+            bool same = equal(digest, record.hash);
+            memset(digest, 0, sizeof(digest));
+            return same & complete;
+        }
+
+        // The stretched hash of what was typed; the entry restarts empty
+        void finish(Digest &digest) {
+            mbedtls_sha256_finish_ret(&context, digest);
+            clear();
+            for (uint16_t i = 0; i < Policy::ROUNDS; i++) mbedtls_sha256_ret(digest, sizeof(digest), digest, 0);
+        }
+
+        void clear() {
+            if (count) mbedtls_sha256_free(&context);  // Also wipes the buffered digits
+            count = 0;
+        }
+
+    private:
+        mbedtls_sha256_context context;
+        uint8_t count = 0;
+    };
+
+    // Exactly DIGITS decimal digits
+    static bool wellFormed(const char *pin) {
+        for (uint8_t i = 0; i < Policy::DIGITS; i++) {
+            if (pin[i] < '0' || pin[i] > '9') return false;
+        }
+        return pin[Policy::DIGITS] == '\0';
+    }
+
+    // New record with a fresh salt; pin must be wellFormed()
+    static void create(Record &record, const char *pin) {
+        esp_fill_random(record.salt, sizeof(record.salt));
+        digest(record.salt, pin, record.hash);
+    }
+
+    // The stretched hash of pin under salt; pin must be wellFormed()
+    static void digest(const Salt &salt, const char *pin, Digest &out) {
+        Entry entry;
+        for (uint8_t i = 0; i < Policy::DIGITS; i++) entry.add(salt, pin[i]);
+        entry.finish(out);
+    }
+
+    static bool verify(const Record &record, const char *pin) {
+        Entry entry;
+        for (uint8_t i = 0; i < Policy::DIGITS && pin[i]; i++) entry.add(record, pin[i]);
+        return entry.matches(record) & (strlen(pin) == Policy::DIGITS);
+    }
+
+    // No early exit: the time taken says nothing about where the hashes differ
+    static bool equal(const uint8_t *a, const uint8_t *b) {
+        uint8_t diff = 0;
+        for (uint8_t i = 0; i < HASH_BYTES; i++) diff |= a[i] ^ b[i];
+        return diff == 0;
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Lock relay with a timed release, and optionally a door sensor. grant()
+// energises the relay on the caller's task and returns; a one-shot esp_timer
+// relocks when the window runs out. With a door sensor the relay also relocks
+// as soon as the door has been opened and shut again, and the door's movements
+// are reported.
+//
+// Events come from the esp_timer task. The listener must not block: posting
+// to a queue with no wait is about right.
+class RelayController {
+public:
+    enum Event : uint8_t {
+        RELOCKED,
+        DOOR_OPENED,
+        DOOR_CLOSED
+    };
+    using Listener = void (*)(Event event);
+
+    struct Options {
+        uint8_t relayPin;
+        uint8_t energisedLevel;   // Level that releases the lock
+        int8_t doorPin;           // -1 without a door sensor
+        uint8_t doorOpenLevel;    // Level the sensor shows with the door open
+        uint16_t doorPollMs;      // Sample period while the door is watched
+        bool extendOnRegrant;     // A grant while open restarts the window
+        bool relockOnClose;       // Door opened and shut: relock without waiting
+    };
+
+    bool begin(const Options &options, Listener listener) {
+        this->options = options;
+        this->listener = listener;
+        digitalWrite(options.relayPin, !options.energisedLevel);
+        pinMode(options.relayPin, OUTPUT);
+
+        esp_timer_create_args_t args = {};
+        args.arg = this;
+        args.callback = [](void *self) { static_cast<RelayController *>(self)->expire(); };
+        args.name = "relock";
+        if (esp_timer_create(&args, &relockTimer) != ESP_OK) return false;
+        if (options.doorPin < 0) return true;
+
+        pinMode(options.doorPin, options.doorOpenLevel ? INPUT_PULLDOWN : INPUT_PULLUP);
+        doorOpen = sampled = digitalRead(options.doorPin) == options.doorOpenLevel;
+        args.callback = [](void *self) { static_cast<RelayController *>(self)->sampleDoor(); };
+        args.name = "door";
+        if (esp_timer_create(&args, &doorTimer) != ESP_OK) return false;
+        if (doorOpen) watchDoor();
+        return true;
+    }
+
+    // Release the lock for windowMs. While already open the window restarts
+    // if extendOnRegrant is set and is left alone otherwise. Returns whether
+    // the window changed.
+    bool grant(uint32_t windowMs) {
+        if (!relockTimer) return false;
+        int64_t deadline = esp_timer_get_time() + windowMs * 1000LL;
+        portENTER_CRITICAL(&lock);
+        requests++;
+        bool applied = !energised || options.extendOnRegrant;
+        if (applied) {
+            if (!energised) openedSinceGrant = false;
+            energised = true;
+            relockAt = deadline;
+        }
+        portEXIT_CRITICAL(&lock);
+        if (!applied) return false;
+
+        digitalWrite(options.relayPin, options.energisedLevel);
+        // The old window may expire in between; expire() checks relockAt, restart the timer
+        esp_timer_stop(relockTimer);
+        while (esp_timer_start_once(relockTimer, windowMs * 1000ULL) == ESP_ERR_INVALID_STATE) {
+            esp_timer_stop(relockTimer);
+        }
+        watchDoor();
+        return true;
+    }
+
+    // Lock now, ending the window early
+    void relock() {
+        if (!relockTimer) return;
+        portENTER_CRITICAL(&lock);
+        relockAt = esp_timer_get_time();
+        portEXIT_CRITICAL(&lock);
+        esp_timer_stop(relockTimer);
+        while (esp_timer_start_once(relockTimer, 0) == ESP_ERR_INVALID_STATE) esp_timer_stop(relockTimer);
+    }
+
+    bool unlocked() const { return energised; }
+    bool doorIsOpen() const { return doorOpen; }
+    uint32_t grants() const { return requests; }  // Every grant() call, applied or not
+
+private:
+    void watchDoor() {
+        if (doorTimer && !esp_timer_is_active(doorTimer)) {
+            esp_timer_start_periodic(doorTimer, options.doorPollMs * 1000ULL);
+        }
+    }
+
+    // esp_timer task from here on
+    void expire() {
+        portENTER_CRITICAL(&lock);
+        bool due = energised && esp_timer_get_time() >= relockAt;
+        if (due) energised = false;
+        portEXIT_CRITICAL(&lock);
+        if (!due) return;  // Extended meanwhile
+        digitalWrite(options.relayPin, !options.energisedLevel);
+        if (listener) listener(RELOCKED);
+    }
+
+    // Two equal samples in a row count, which rides out reed-switch bounce
+    void sampleDoor() {
+        bool open = digitalRead(options.doorPin) == options.doorOpenLevel;
+        bool steady = open == sampled;
+        sampled = open;
+        if (steady && open != doorOpen) {
+            doorOpen = open;
+            if (listener) listener(open ? DOOR_OPENED : DOOR_CLOSED);
+            if (open) {
+                openedSinceGrant = true;
+            } else if (openedSinceGrant && options.relockOnClose && energised) {
+                relock();
+            }
+        }
+        // Locked with the door shut: nothing left to watch until the next grant
+        if (!energised && !doorOpen) esp_timer_stop(doorTimer);
+    }
+
+    Options options = {};
+    Listener listener = nullptr;
+    esp_timer_handle_t relockTimer = nullptr;
+    esp_timer_handle_t doorTimer = nullptr;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    volatile bool energised = false;
+    int64_t relockAt = 0;
+    volatile uint32_t requests = 0;
+
+    volatile bool doorOpen = false;
+    bool sampled = false;
+    bool openedSinceGrant = false;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+#include <mbedtls/md.h>
+
+// Signed commands from the network. A command reads
+//   <counter> <verb> [arg] <signature>
+// where signature is the hex HMAC-SHA256 of everything before it, under a key
+// shared with the operator's backend. Each counter must be higher than the
+// last one accepted, so a captured command can't be replayed; the caller
+// persists counter() after every accepted command.
+class RemoteCommand {
+public:
+    enum Action : uint8_t {
+        UNLOCK,
+        SET_MODE,    // arg: 0 single factor, 1 two-factor
+        REPORT,      // Publish health now
+        UPDATE       // Fetch, check and stage new firmware
+    };
+
+    enum Verdict : uint8_t {
+        OK,
+        MALFORMED,
+        BAD_SIGNATURE,
+        REPLAYED
+    };
+
+    struct Parsed {
+        Action action;
+        uint16_t arg;
+        uint32_t counter;
+    };
+
+    static constexpr uint8_t KEY_BYTES = 32;
+    static constexpr uint8_t MAX_LENGTH = 128;
+
+    // key: KEY_BYTES bytes, kept by reference
+    void begin(const uint8_t *key, uint32_t lastCounter) {
+        this->key = key;
+        last = lastCounter;
+    }
+
+    static const char *name(Verdict verdict) {
+        static const char *const names[] = {"ok", "malformed", "bad-signature", "replayed"};
+        return verdict <= REPLAYED ? names[verdict] : "?";
+    }
+
+    Verdict parse(const uint8_t *payload, size_t length, Parsed &out) {
+        char text[MAX_LENGTH + 1];
+        if (!key || length > MAX_LENGTH) return MALFORMED;
+        memcpy(text, payload, length);
+        text[length] = '\0';
+
+        // The signature is the last word, and covers the text up to the space before it
+        char *space = strrchr(text, ' ');
+        if (!space || strlen(space + 1) != 2 * SIGNATURE_BYTES) return MALFORMED;
+        uint8_t claimed[SIGNATURE_BYTES];
+        if (!fromHex(space + 1, claimed, SIGNATURE_BYTES)) return MALFORMED;
+        uint8_t expected[SIGNATURE_BYTES];
+        if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, KEY_BYTES,
+                            reinterpret_cast<const uint8_t *>(text), space - text, expected) != 0) {
+            return MALFORMED;
+        }
+        uint8_t diff = 0;
+        for (uint8_t i = 0; i < SIGNATURE_BYTES; i++) diff |= claimed[i] ^ expected[i];
+        if (diff) return BAD_SIGNATURE;
+        *space = '\0';
+
+        char *verb = nullptr;
+        unsigned long counter = strtoul(text, &verb, 10);
+        if (verb == text || *verb != ' ') return MALFORMED;
+        verb++;
+        char *arg = strchr(verb, ' ');
+        if (arg) *arg++ = '\0';
+
+        if (strcmp(verb, "unlock") == 0 && !arg) {
+            out = {UNLOCK, 0, uint32_t(counter)};
+        } else if (strcmp(verb, "mode") == 0 && arg && (strcmp(arg, "single") == 0 || strcmp(arg, "2fa") == 0)) {
+            out = {SET_MODE, uint16_t(strcmp(arg, "2fa") == 0), uint32_t(counter)};
+        } else if (strcmp(verb, "report") == 0 && !arg) {
+            out = {REPORT, 0, uint32_t(counter)};
+        } else if (strcmp(verb, "update") == 0 && !arg) {
+            out = {UPDATE, 0, uint32_t(counter)};
+        } else {
+            return MALFORMED;
+        }
+        if (out.counter <= last) return REPLAYED;
+        last = out.counter;
+        return OK;
+    }
+
+    uint32_t counter() const { return last; }
+
+    // Exactly bytes' worth of hex digits
+    static bool fromHex(const char *hex, uint8_t *out, uint8_t bytes = KEY_BYTES) {
+        for (uint8_t i = 0; i < bytes; i++) {
+            int hi = nibble(hex[2 * i]);
+            int lo = nibble(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0) return false;
+            out[i] = hi << 4 | lo;
+        }
+        return true;
+    }
+
+private:
+    static constexpr uint8_t SIGNATURE_BYTES = 32;
+
+    static int nibble(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    const uint8_t *key = nullptr;
+    uint32_t last = 0;
+};
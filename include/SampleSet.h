@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include <algorithm>
+
+// Fixed-capacity sample buffer for benchmarks: exact order statistics, at
+// the cost of keeping every sample. add() is ISR-safe; summarize once the
+// producer has stopped. Samples past the capacity are dropped.
+template <uint16_t Capacity>
+class SampleSet {
+public:
+    void IRAM_ATTR add(uint32_t value) {
+        if (used < Capacity) samples[used++] = value;
+    }
+
+    void clear() { used = 0; }
+    uint16_t count() const { return used; }
+    bool full() const { return used == Capacity; }
+
+    // Sorts in place; "name: n=…, min …, median …, p99 …, max … unit"
+    void report(Print &out, const char *name, const char *unit) {
+        if (!used) {
+            out.printf("%-24s no samples\n", name);
+            return;
+        }
+        std::sort(samples, samples + used);
+        out.printf("%-24s n=%-4u min %7" PRIu32 "  median %7" PRIu32 "  p99 %7" PRIu32 "  max %7" PRIu32 " %s\n", name, used,
+                   samples[0], samples[used / 2], samples[(used * 99) / 100], samples[used - 1], unit);
+    }
+
+private:
+    uint32_t samples[Capacity];
+    volatile uint16_t used = 0;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <string.h>
+
+// Line-oriented command console. poll() drains whatever the port has buffered
+// and never waits for the rest of a line, so it can run on every loop pass.
+// Commands come from a caller-supplied table; privileged ones need a login
+// first, which the caller verifies (e.g. against the PIN). A session expires
+// after a period without commands, and repeated bad logins lock the console
+// out for a while.
+class SerialConsole {
+public:
+    static constexpr uint8_t MAX_ARGS = 4;
+
+    // argv[0] is the command name
+    using Handler = void (*)(Print &out, uint8_t argc, char **argv);
+    using Authenticator = bool (*)(const char *secret);
+
+    struct Command {
+        const char *name;
+        const char *usage;
+        bool privileged;
+        Handler run;
+    };
+
+    void begin(Stream &port, const Command *table, uint8_t count, Authenticator authenticate,
+               uint32_t sessionMs, uint8_t maxFailures, uint32_t lockoutMs) {
+        this->port = &port;
+        this->table = table;
+        this->count = count;
+        this->authenticate = authenticate;
+        this->sessionTime = sessionMs;
+        this->maxFailures = maxFailures;
+        this->lockoutTime = lockoutMs;
+    }
+
+    void poll(uint32_t now) {
+        if (!port) return;
+        while (port->available()) {
+            char c = port->read();
+            if (c == '\r') continue;
+            if (c != '\n') {
+                if (length < sizeof(line) - 1) line[length++] = c;
+                else overflow = true;
+                continue;
+            }
+            line[length] = '\0';
+            if (overflow) port->println("ERR line too long");
+            else execute(now);
+            length = 0;
+            overflow = false;
+        }
+    }
+
+    bool loggedIn(uint32_t now) const {
+        return session && now - lastCommand < sessionTime;
+    }
+
+private:
+    void execute(uint32_t now) {
+        char *argv[MAX_ARGS + 1];
+        uint8_t argc = 0;
+        for (char *p = line; *p && argc <= MAX_ARGS;) {
+            while (isspace(static_cast<unsigned char>(*p))) *p++ = '\0';
+            if (!*p) break;
+            argv[argc++] = p;
+            while (*p && !isspace(static_cast<unsigned char>(*p))) p++;
+        }
+        if (argc == 0) return;
+
+        if (strcmp(argv[0], "help") == 0) return help();
+        if (strcmp(argv[0], "login") == 0) return login(now, argc > 1 ? argv[1] : "");
+        if (strcmp(argv[0], "logout") == 0) {
+            session = false;
+            port->println("OK");
+            return;
+        }
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (strcmp(argv[0], table[i].name) != 0) continue;
+            // Only a live session is kept alive; an open command must not revive an expired one
+            if (!loggedIn(now)) {
+                session = false;
+                if (table[i].privileged) {
+                    port->println("ERR login required");
+                    return;
+                }
+            } else {
+                lastCommand = now;
+            }
+            table[i].run(*port, argc, argv);
+            return;
+        }
+        port->printf("ERR unknown command '%s' (try help)\n", argv[0]);
+    }
+
+    void login(uint32_t now, const char *secret) {
+        if (failures >= maxFailures) {
+            if (now - lockedAt < lockoutTime) {
+                port->printf("ERR locked out for %" PRIu32 "s\n", (lockoutTime - (now - lockedAt)) / 1000);
+                return;
+            }
+            failures = 0;
+        }
+        if (authenticate && authenticate(secret)) {
+            failures = 0;
+            session = true;
+            lastCommand = now;
+            port->println("OK");
+            return;
+        }
+        session = false;
+        if (++failures >= maxFailures) lockedAt = now;
+        port->println("ERR denied");
+    }
+
+    void help() {
+        port->println("help | login <pin> | logout");
+        for (uint8_t i = 0; i < count; i++) {
+            port->printf("%s%s\n", table[i].usage, table[i].privileged ? "  (login)" : "");
+        }
+    }
+
+    Stream *port = nullptr;
+    const Command *table = nullptr;
+    uint8_t count = 0;
+    Authenticator authenticate = nullptr;
+    uint32_t sessionTime = 0;
+    uint8_t maxFailures = 3;
+    uint32_t lockoutTime = 0;
+
+    char line[64];
+    uint8_t length = 0;
+    bool overflow = false;
+
+    bool session = false;
+    uint32_t lastCommand = 0;
+    uint8_t failures = 0;
+    uint32_t lockedAt = 0;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+// Backing memory for a FreeRTOS queue or task, sized at compile time. Declared
+// as globals they land in .bss, so the memory they take is known from the
+// link map rather than found out from the heap at run time.
+template <class T, UBaseType_t Length>
+class QueueStorage {
+public:
+    static constexpr size_t BYTES = Length * sizeof(T) + sizeof(StaticQueue_t);
+
+    QueueHandle_t create() { return xQueueCreateStatic(Length, sizeof(T), items, &control); }
+
+private:
+    uint8_t items[Length * sizeof(T)];
+    StaticQueue_t control;
+};
+
+// StackBytes as FreeRTOS on ESP-IDF counts stack depth: in bytes
+template <uint32_t StackBytes>
+class TaskStorage {
+public:
+    static constexpr size_t BYTES = StackBytes + sizeof(StaticTask_t);
+
+    TaskHandle_t create(TaskFunction_t code, const char *name, UBaseType_t priority, BaseType_t core) {
+        return xTaskCreateStaticPinnedToCore(code, name, StackBytes, nullptr, priority, stack, &control, core);
+    }
+
+private:
+    StackType_t stack[StackBytes / sizeof(StackType_t)];
+    StaticTask_t control;
+};
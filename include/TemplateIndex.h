@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+
+// Host-side picture of the sensor's template library: which pages hold a
+// template, and match statistics for the IDs seen most. Plain data, so it can
+// be persisted as-is (PersistentBlock<TemplateIndex<...>>).
+//
+// plan() turns it into at most two searches: first a page range covering the
+// hottest IDs, then the rest of the library up to the highest enrolled page.
+// The sensor's search time grows with the range it walks, so matching a
+// regular user costs a short search, and nobody ever pays for empty pages
+// past the last enrollment.
+template <uint16_t MaxIds, uint8_t Tracked, uint8_t HotIds = 4>
+struct TemplateIndex {
+    static_assert(HotIds <= Tracked, "hot IDs come from the tracked set");
+
+    struct Entry {
+        uint16_t id;
+        uint16_t hits;
+        uint32_t lastUsed;   // Value of clock at the last match
+    };
+
+    struct Plan {
+        uint16_t firstStart, firstCount;
+        uint16_t secondStart, secondCount;  // 0 = no second pass
+    };
+
+    bool known;                          // enrolled[] reflects the sensor
+    uint32_t clock;                      // Matches recorded so far; the recency base
+    uint8_t enrolled[(MaxIds + 7) / 8];
+    Entry tracked[Tracked];              // hits == 0 marks a free slot
+
+    // Forget the library layout (keeps the statistics)
+    void resetLayout() {
+        memset(enrolled, 0, sizeof(enrolled));
+        known = false;
+    }
+
+    void setEnrolled(uint16_t id, bool present) {
+        if (id >= MaxIds) return;
+        if (present) {
+            enrolled[id / 8] |= 1 << (id % 8);
+        } else {
+            enrolled[id / 8] &= ~(1 << (id % 8));
+            forget(id);
+        }
+    }
+
+    bool isEnrolled(uint16_t id) const {
+        return id < MaxIds && (enrolled[id / 8] & (1 << (id % 8)));
+    }
+
+    // One past the highest enrolled page, 0 if the library is empty
+    uint16_t span() const {
+        for (int i = sizeof(enrolled) - 1; i >= 0; i--) {
+            if (enrolled[i]) return i * 8 + (31 - __builtin_clz(enrolled[i])) + 1;
+        }
+        return 0;
+    }
+
+    // Count a successful match. A new ID takes a free slot or evicts the
+    // least-hit one (oldest on a tie).
+    void hit(uint16_t id) {
+        clock++;
+        setEnrolled(id, true);
+        Entry *slot = nullptr;
+        for (Entry &e : tracked) {
+            if (e.hits && e.id == id) { slot = &e; break; }
+            if (!slot || e.hits < slot->hits || (e.hits == slot->hits && e.lastUsed < slot->lastUsed)) slot = &e;
+        }
+        if (!slot->hits || slot->id != id) *slot = {id, 0, 0};
+        if (slot->hits == UINT16_MAX) {
+            for (Entry &e : tracked) e.hits = (e.hits + 1) / 2;  // Age everyone, keep free slots free
+        }
+        slot->hits++;
+        slot->lastUsed = clock;
+    }
+
+    // Searches for one identification against a library of capacity pages
+    Plan plan(uint16_t capacity) const {
+        uint16_t end = known ? span() : capacity;
+        if (end > capacity) end = capacity;
+        Plan p = {0, end, 0, 0};
+
+        // The HotIds most-hit entries, still enrolled
+        uint16_t lo = UINT16_MAX, hi = 0;
+        uint8_t taken = 0;
+        bool used[Tracked] = {};
+        for (uint8_t n = 0; n < HotIds; n++) {
+            int best = -1;
+            for (uint8_t i = 0; i < Tracked; i++) {
+                if (used[i] || !tracked[i].hits || tracked[i].id >= end) continue;
+                if (best < 0 || tracked[i].hits > tracked[best].hits) best = i;
+            }
+            if (best < 0) break;
+            used[best] = true;
+            taken++;
+            if (tracked[best].id < lo) lo = tracked[best].id;
+            if (tracked[best].id > hi) hi = tracked[best].id;
+        }
+
+        // A miss searches only what the first pass left out, and one search
+        // takes one range: so the hot range reaches out to page 0 or to end,
+        // whichever is nearer. Only worth a separate round trip when it still
+        // skips most of the library.
+        if (!taken) return p;
+        if (lo <= end - 1 - hi) lo = 0; else hi = end - 1;
+        uint16_t width = hi - lo + 1;
+        if (width * 2 > end) return p;
+        if (lo == 0) return {0, width, width, static_cast<uint16_t>(end - width)};
+        return {lo, width, 0, lo};
+    }
+
+private:
+    void forget(uint16_t id) {
+        for (Entry &e : tracked) {
+            if (e.hits && e.id == id) e = {};
+        }
+    }
+};
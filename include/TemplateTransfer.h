@@ -0,0 +1,315 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Adafruit_Fingerprint.h>
+#include <esp_rom_crc.h>
+
+// Bulk template backup/restore between a host and a ZFM-family sensor.
+//
+// Host link framing (little endian):
+//   0xA5 0x5A | type:u8 | length:u16 | payload | crc32 over type..payload
+//
+// Backup:  host BACKUP{first:u16, count:u16}; for every enrolled page the
+//          device answers BEGIN{id}, DATA{bytes}..., END{id}, then DONE{count}.
+// Restore: host BEGIN{id}, DATA{bytes}..., END{id}; the device stores the
+//          template and answers STATUS{code, id}. DATA frames may be any size
+//          up to MAX_DATA.
+// A session ends on FINISH or after a quiet period; the device then sends DONE.
+//
+// Templates are streamed packet by packet in both directions (UpChar/DownChar),
+// so at most one sensor data packet is held in RAM.
+class TemplateTransfer {
+public:
+    enum FrameType : uint8_t {
+        BACKUP = 0x01,
+        FINISH = 0x02,
+        BEGIN = 0x10,
+        DATA = 0x11,
+        END = 0x12,
+        STATUS = 0x20,
+        DONE = 0x21
+    };
+
+    enum Status : uint8_t {
+        OK = 0,
+        BAD_FRAME = 0x80,      // CRC or length error; the template in progress is dropped
+        OUT_OF_ORDER = 0x81,   // DATA/END without BEGIN, or END for another id
+        // Anything below 0x80 is the sensor's own confirmation code
+    };
+
+    static constexpr uint16_t MAX_DATA = 256;  // Largest sensor packet (and host DATA frame)
+
+    using PresentFn = bool (*)(uint16_t id);   // Backup: may this page hold a template?
+    using StoredFn = void (*)(uint16_t id);    // Restore: template written to the library
+
+    TemplateTransfer(Stream &host, Adafruit_Fingerprint &sensor, Stream &sensorPort)
+        : host(host), sensor(sensor), sensorPort(sensorPort) {}
+
+    // Serve host frames until FINISH or idleTimeoutMs without one. packetLength
+    // is the sensor's data packet size. Returns templates moved in either direction.
+    uint16_t run(uint16_t packetLength, uint32_t idleTimeoutMs, PresentFn present, StoredFn stored) {
+        this->packetLength = packetLength <= MAX_DATA ? packetLength : MAX_DATA;
+        moved = 0;
+        restoring = false;
+
+        for (;;) {
+            uint8_t type;
+            uint16_t length;
+            if (!readFrame(type, length, idleTimeoutMs)) {
+                if (length == NO_FRAME) break;
+                restoring = false;
+                sendStatus(BAD_FRAME, restoreId);
+                continue;
+            }
+            if (type == FINISH) break;
+            switch (type) {
+                case BACKUP:
+                    if (length >= 4) backup(get16(frame), get16(frame + 2), present);
+                    break;
+                case BEGIN:
+                    if (length >= 2) beginRestore(get16(frame));
+                    break;
+                case DATA:
+                    restoreData(frame, length);
+                    break;
+                case END:
+                    if (length >= 2) endRestore(get16(frame), stored);
+                    break;
+                default:
+                    sendStatus(BAD_FRAME, 0);
+                    break;
+            }
+        }
+
+        uint8_t done[2];
+        put16(done, moved);
+        writeFrame(DONE, done, sizeof(done));
+        return moved;
+    }
+
+private:
+    static constexpr uint8_t SYNC0 = 0xA5, SYNC1 = 0x5A;
+    static constexpr uint16_t NO_FRAME = 0xFFFF;
+    static constexpr uint8_t CMD_DOWNLOAD = 0x09;    // DownChar (UpChar is Adafruit's getModel)
+    static constexpr uint8_t PID_DATA = 0x02;
+    static constexpr uint8_t PID_END_DATA = 0x08;
+    static constexpr uint32_t SENSOR_TIMEOUT = 1000;
+
+    static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+    static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+
+    // --- Backup ----------------------------------------------------------
+
+    void backup(uint16_t first, uint16_t count, PresentFn present) {
+        uint8_t idBytes[2];
+        uint16_t sent = 0;
+        for (uint32_t id = first; id < static_cast<uint32_t>(first) + count; id++) {
+            if (present && !present(id)) continue;
+            if (sensor.loadModel(id) != FINGERPRINT_OK) continue;  // Empty page
+            uint8_t code = sensor.getModel();
+            if (code != FINGERPRINT_OK) {
+                sendStatus(code, id);
+                continue;
+            }
+
+            put16(idBytes, id);
+            writeFrame(BEGIN, idBytes, sizeof(idBytes));
+            uint8_t pid;
+            uint16_t length;
+            do {
+                if (!readSensorPacket(pid, length)) {
+                    sendStatus(FINGERPRINT_PACKETRECIEVEERR, id);
+                    break;
+                }
+                writeFrame(DATA, packet, length);
+            } while (pid != PID_END_DATA);
+            if (pid == PID_END_DATA) {
+                writeFrame(END, idBytes, sizeof(idBytes));
+                sent++;
+            }
+        }
+        moved += sent;
+        put16(idBytes, sent);
+        writeFrame(DONE, idBytes, sizeof(idBytes));
+    }
+
+    // --- Restore ---------------------------------------------------------
+    // The template is regrouped into sensor packets. A full packet is held
+    // back until more data arrives, so the last one can go out as END_DATA.
+
+    void beginRestore(uint16_t id) {
+        uint8_t request[2] = {CMD_DOWNLOAD, 1};
+        Adafruit_Fingerprint_Packet command(FINGERPRINT_COMMANDPACKET, sizeof(request), request);
+        sensor.writeStructuredPacket(command);
+        uint8_t code = sensor.getStructuredPacket(&command);  // The reply overwrites the request
+        if (code == FINGERPRINT_OK) code = command.type == FINGERPRINT_ACKPACKET ? command.data[0] : FINGERPRINT_BADPACKET;
+        restoring = code == FINGERPRINT_OK;
+        restoreId = id;
+        fill = 0;
+        if (!restoring) sendStatus(code, id);
+    }
+
+    void restoreData(const uint8_t *data, uint16_t length) {
+        if (!restoring) {
+            sendStatus(OUT_OF_ORDER, restoreId);
+            return;
+        }
+        while (length > 0) {
+            if (fill == packetLength) {
+                writeSensorPacket(PID_DATA, packet, fill);
+                fill = 0;
+            }
+            uint16_t n = packetLength - fill;
+            if (n > length) n = length;
+            memcpy(packet + fill, data, n);
+            fill += n;
+            data += n;
+            length -= n;
+        }
+    }
+
+    void endRestore(uint16_t id, StoredFn stored) {
+        if (!restoring || id != restoreId || fill == 0) {
+            restoring = false;
+            sendStatus(OUT_OF_ORDER, id);
+            return;
+        }
+        restoring = false;
+        writeSensorPacket(PID_END_DATA, packet, fill);
+        uint8_t code = sensor.storeModel(id);
+        if (code == FINGERPRINT_OK) {
+            moved++;
+            if (stored) stored(id);
+        }
+        sendStatus(code, id);
+    }
+
+    // --- Host framing ----------------------------------------------------
+
+    void writeFrame(uint8_t type, const uint8_t *payload, uint16_t length) {
+        uint8_t header[5] = {SYNC0, SYNC1, type, static_cast<uint8_t>(length), static_cast<uint8_t>(length >> 8)};
+        uint32_t crc = esp_rom_crc32_le(0, header + 2, 3);
+        crc = esp_rom_crc32_le(crc, payload, length);
+        uint8_t trailer[4] = {static_cast<uint8_t>(crc), static_cast<uint8_t>(crc >> 8),
+                              static_cast<uint8_t>(crc >> 16), static_cast<uint8_t>(crc >> 24)};
+        host.write(header, sizeof(header));
+        host.write(payload, length);
+        host.write(trailer, sizeof(trailer));
+    }
+
+    void sendStatus(uint8_t code, uint16_t id) {
+        uint8_t payload[3] = {code};
+        put16(payload + 1, id);
+        writeFrame(STATUS, payload, sizeof(payload));
+    }
+
+    // Next frame into frame[]. False with length == NO_FRAME on timeout,
+    // otherwise a malformed or corrupt frame.
+    bool readFrame(uint8_t &type, uint16_t &length, uint32_t timeoutMs) {
+        length = NO_FRAME;
+        uint8_t header[5];
+        uint32_t start = millis();
+        uint8_t matched = 0;
+        while (matched < 2) {
+            int c = readByte(host, start, timeoutMs);
+            if (c < 0) return false;
+            matched = (c == SYNC1 && matched == 1) ? 2 : (c == SYNC0 ? 1 : 0);
+        }
+        header[0] = SYNC0;
+        header[1] = SYNC1;
+
+        // A frame in progress gets its own timeout from the sync on
+        start = millis();
+        if (!readBytes(host, header + 2, 3, start, FRAME_TIMEOUT)) return badFrame(length);
+        type = header[2];
+        uint16_t size = get16(header + 3);
+        if (size > MAX_DATA) return badFrame(length);
+        uint8_t trailer[4];
+        if (!readBytes(host, frame, size, start, FRAME_TIMEOUT) ||
+            !readBytes(host, trailer, 4, start, FRAME_TIMEOUT)) {
+            return badFrame(length);
+        }
+        uint32_t crc = esp_rom_crc32_le(0, header + 2, 3);
+        crc = esp_rom_crc32_le(crc, frame, size);
+        uint32_t sent = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint32_t>(trailer[3]) << 24);
+        if (crc != sent) return badFrame(length);
+        length = size;
+        return true;
+    }
+
+    static bool badFrame(uint16_t &length) {
+        length = 0;
+        return false;
+    }
+
+    static int readByte(Stream &port, uint32_t start, uint32_t timeoutMs) {
+        while (!port.available()) {
+            if (millis() - start >= timeoutMs) return -1;
+            delay(1);
+        }
+        return port.read();
+    }
+
+    static bool readBytes(Stream &port, uint8_t *out, uint16_t count, uint32_t start, uint32_t timeoutMs) {
+        for (uint16_t i = 0; i < count; i++) {
+            int c = readByte(port, start, timeoutMs);
+            if (c < 0) return false;
+            out[i] = c;
+        }
+        return true;
+    }
+
+    // --- Sensor data packets ---------------------------------------------
+
+    void writeSensorPacket(uint8_t pid, const uint8_t *data, uint16_t length) {
+        uint16_t packetSize = length + 2;
+        uint8_t header[9] = {0xEF, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, pid,
+                             static_cast<uint8_t>(packetSize >> 8), static_cast<uint8_t>(packetSize)};
+        uint16_t sum = pid + (packetSize >> 8) + (packetSize & 0xFF);
+        for (uint16_t i = 0; i < length; i++) sum += data[i];
+        uint8_t checksum[2] = {static_cast<uint8_t>(sum >> 8), static_cast<uint8_t>(sum)};
+        sensorPort.write(header, sizeof(header));
+        sensorPort.write(data, length);
+        sensorPort.write(checksum, sizeof(checksum));
+    }
+
+    // One UpChar data packet into packet[]
+    bool readSensorPacket(uint8_t &pid, uint16_t &length) {
+        uint32_t start = millis();
+        uint8_t header[9];
+        int c;
+        do {
+            c = readByte(sensorPort, start, SENSOR_TIMEOUT);
+            if (c < 0) return false;
+        } while (c != 0xEF);
+        header[0] = c;
+        if (!readBytes(sensorPort, header + 1, 8, start, SENSOR_TIMEOUT) || header[1] != 0x01) return false;
+        pid = header[6];
+        uint16_t packetSize = (header[7] << 8) | header[8];
+        if (packetSize < 2 || packetSize - 2 > MAX_DATA) return false;
+        length = packetSize - 2;
+        uint8_t checksum[2];
+        if (!readBytes(sensorPort, packet, length, start, SENSOR_TIMEOUT) ||
+            !readBytes(sensorPort, checksum, 2, start, SENSOR_TIMEOUT)) {
+            return false;
+        }
+        uint16_t sum = pid + header[7] + header[8];
+        for (uint16_t i = 0; i < length; i++) sum += packet[i];
+        return (pid == PID_DATA || pid == PID_END_DATA) && sum == ((checksum[0] << 8) | checksum[1]);
+    }
+
+    static constexpr uint32_t FRAME_TIMEOUT = 500;  // Sync to CRC
+
+    Stream &host;
+    Adafruit_Fingerprint &sensor;
+    Stream &sensorPort;
+
+    uint16_t packetLength = 128;
+    uint16_t moved = 0;
+    bool restoring = false;
+    uint16_t restoreId = 0;
+    uint16_t fill = 0;
+
+    uint8_t frame[MAX_DATA];     // Last host frame payload
+    uint8_t packet[MAX_DATA];    // One sensor data packet
+};
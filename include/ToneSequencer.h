@@ -0,0 +1,115 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+
+// Plays beep patterns on a LEDC channel without blocking anyone. A pattern is
+// a table of (frequency, duration, pause) steps, normally constexpr in flash.
+// A one-shot esp_timer walks the table, so each step costs one callback on
+// the esp_timer task and play() only restarts the timer. The LEDC timer is set
+// up once by the caller; steps just retune it and switch the duty.
+class ToneSequencer {
+public:
+    struct Step {
+        uint16_t frequency;  // Hz
+        uint16_t duration;   // Beep length in ms
+        uint16_t pause;      // Silence after it in ms; none after the last step
+    };
+
+    struct Pattern {
+        const Step *steps;
+        uint8_t count;
+    };
+
+    template <uint8_t N>
+    static constexpr Pattern pattern(const Step (&steps)[N]) {
+        return {steps, N};
+    }
+
+    // awake, if given, is held while a pattern plays: LEDC stops in light sleep
+    bool begin(uint8_t channel, uint8_t resolution, esp_pm_lock_handle_t awake = nullptr) {
+        this->channel = channel;
+        this->resolution = resolution;
+        this->awake = awake;
+        esp_timer_create_args_t args = {};
+        args.callback = onTimer;
+        args.arg = this;
+        args.name = "tone";
+        return esp_timer_create(&args, &timer) == ESP_OK;
+    }
+
+    // Callable from any task; a new pattern pre-empts whatever is playing
+    void play(const Pattern &pattern) {
+        if (!timer) return;
+        portENTER_CRITICAL(&lock);
+        requested = pattern;
+        restart = true;
+        portEXIT_CRITICAL(&lock);
+        // The callback may re-arm the timer between the two calls; stop that and retry
+        esp_timer_stop(timer);
+        while (esp_timer_start_once(timer, 0) == ESP_ERR_INVALID_STATE) esp_timer_stop(timer);
+    }
+
+    void stop() { play({nullptr, 0}); }
+
+    bool playing() const { return restart || active; }
+
+private:
+    static void onTimer(void *arg) { static_cast<ToneSequencer *>(arg)->advance(); }
+
+    // Everything below runs on the esp_timer task only
+    void advance() {
+        portENTER_CRITICAL(&lock);
+        bool fresh = restart;
+        if (fresh) {
+            current = requested;
+            restart = false;
+            active = current.count > 0;
+        }
+        portEXIT_CRITICAL(&lock);
+
+        if (fresh) {
+            index = 0;
+        } else if (beeping) {
+            ledcWrite(channel, 0);
+            beeping = false;
+            uint16_t pause = current.steps[index++].pause;
+            if (pause && index < current.count) {
+                esp_timer_start_once(timer, pause * 1000ULL);
+                return;
+            }
+        }
+
+        if (index >= current.count) {
+            ledcWrite(channel, 0);
+            beeping = false;
+            active = false;
+            if (awake && awakeHeld) esp_pm_lock_release(awake);
+            awakeHeld = false;
+            return;
+        }
+        if (awake && !awakeHeld) esp_pm_lock_acquire(awake);
+        awakeHeld = true;
+        const Step &step = current.steps[index];
+        ledcChangeFrequency(channel, step.frequency, resolution);
+        ledcWrite(channel, 1UL << (resolution - 1));  // 50% duty
+        beeping = true;
+        esp_timer_start_once(timer, step.duration * 1000ULL);
+    }
+
+    esp_timer_handle_t timer = nullptr;
+    esp_pm_lock_handle_t awake = nullptr;
+    uint8_t channel = 0;
+    uint8_t resolution = 8;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    Pattern requested = {nullptr, 0};
+    volatile bool restart = false;
+    volatile bool active = false;
+
+    Pattern current = {nullptr, 0};
+    uint8_t index = 0;
+    bool beeping = false;
+    bool awakeHeld = false;
+};
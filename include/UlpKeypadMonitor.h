@@ -0,0 +1,148 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+#include "esp32/ulp.h"
+#include "driver/rtc_io.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+
+// Deep-sleep keypad watcher running on the ULP coprocessor. Every period the
+// ULP raises one column at a time and reads the rows (pulled down), so a held
+// key reads high on its row. A reading must repeat for a number of samples
+// before it counts; each newly accepted key goes into a small buffer in RTC
+// slow memory, and the first one wakes the main CPU. The ULP keeps sampling
+// while the chip boots, so digits typed during the boot land in the buffer too.
+//
+// Optionally watches a touch line (active high) the same way; a debounced
+// touch is buffered as TOUCH and wakes the CPU like a key.
+//
+// Every pin must be an RTC GPIO. The caller hands them to the RTC domain
+// before sleep: columns as outputs driven low, rows and touch as inputs with
+// pull-downs, no holds.
+template <uint8_t Rows, uint8_t Cols>
+class UlpKeypadMonitor {
+public:
+    static constexpr uint8_t BUFFER_LEN = 8;
+    static constexpr uint8_t TOUCH = Rows * Cols;  // Buffered in place of a key index
+    static constexpr int8_t NONE = -1;
+
+    // Load and start the program. touchPin < 0 (or not an RTC GPIO) leaves
+    // the touch line to the caller. Fails if a pin has no RTC IO or the
+    // program doesn't fit the reserved ULP memory.
+    esp_err_t start(const uint8_t *rowPins, const uint8_t *colPins, int8_t touchPin,
+                    uint8_t debounceSamples, uint32_t periodUs) {
+        ulp_insn_t program[PROGRAM_MAX];
+        size_t n = 0;
+
+        program[n++] = I_MOVI(R2, 0);  // R2: key index + 1 seen this sample, 0 = none
+        int touchIo = touchPin >= 0 ? rtc_io_number_get(static_cast<gpio_num_t>(touchPin)) : -1;
+        watchingTouch = touchIo >= 0;
+        if (watchingTouch) {
+            program[n++] = I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + touchIo, RTC_GPIO_IN_NEXT_S + touchIo);
+            program[n++] = I_JUMPR(2, 1, JUMPR_LT);
+            program[n++] = I_MOVI(R2, TOUCH + 1);
+        }
+        for (uint8_t c = 0; c < Cols; c++) {
+            int col = rtc_io_number_get(static_cast<gpio_num_t>(colPins[c]));
+            if (col < 0) return ESP_ERR_INVALID_ARG;
+            program[n++] = I_WR_REG(RTC_GPIO_OUT_W1TS_REG, RTC_GPIO_OUT_DATA_W1TS_S + col,
+                                    RTC_GPIO_OUT_DATA_W1TS_S + col, 1);
+            program[n++] = I_DELAY(SETTLE_CYCLES);
+            for (uint8_t r = 0; r < Rows; r++) {
+                int row = rtc_io_number_get(static_cast<gpio_num_t>(rowPins[r]));
+                if (row < 0) return ESP_ERR_INVALID_ARG;
+                program[n++] = I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + row, RTC_GPIO_IN_NEXT_S + row);
+                program[n++] = I_JUMPR(2, 1, JUMPR_LT);  // Row low: skip the next instruction
+                program[n++] = I_MOVI(R2, r * Cols + c + 1);
+            }
+            program[n++] = I_WR_REG(RTC_GPIO_OUT_W1TC_REG, RTC_GPIO_OUT_DATA_W1TC_S + col,
+                                    RTC_GPIO_OUT_DATA_W1TC_S + col, 1);
+        }
+
+        enum { L_SAME, L_STABLE, L_WAIT, L_DONE };
+        const ulp_insn_t filter[] = {
+            I_MOVI(R3, 0),                       // Data words sit at the start of RTC slow memory
+            I_LD(R1, R3, LAST),
+            I_ST(R2, R3, LAST),
+            I_SUBR(R0, R2, R1),
+            M_BXZ(L_SAME),
+            I_MOVI(R0, 0),                       // Reading changed: start counting again
+            I_ST(R0, R3, COUNT),
+            I_HALT(),
+        M_LABEL(L_SAME),
+            I_LD(R0, R3, COUNT),
+            M_BGE(L_STABLE, debounceSamples),
+            I_ADDI(R0, R0, 1),
+            I_ST(R0, R3, COUNT),
+            M_BL(L_DONE, debounceSamples),
+        M_LABEL(L_STABLE),
+            I_LD(R1, R3, HELD),
+            I_SUBR(R0, R2, R1),
+            M_BXZ(L_DONE),                       // Still the key already accepted
+            I_ST(R2, R3, HELD),
+            I_MOVR(R0, R2),
+            M_BL(L_DONE, 1),                     // A release; nothing to buffer
+            I_LD(R1, R3, HEAD),
+            I_MOVR(R0, R1),
+            M_BGE(L_DONE, BUFFER_LEN),
+            I_ST(R2, R1, BUFFER),                // R3 is 0, so head addresses the slot directly
+            I_ADDI(R0, R1, 1),
+            I_ST(R0, R3, HEAD),
+            M_BGE(L_DONE, 2),                    // Only the first event needs to wake the CPU
+        M_LABEL(L_WAIT),
+            I_RD_REG(RTC_CNTL_LOW_POWER_ST_REG, RTC_CNTL_RDY_FOR_WAKEUP_S, RTC_CNTL_RDY_FOR_WAKEUP_S),
+            M_BL(L_WAIT, 1),
+            I_WAKE(),
+        M_LABEL(L_DONE),
+            I_HALT(),
+        };
+        if (n + sizeof(filter) / sizeof(filter[0]) > PROGRAM_MAX) return ESP_ERR_NO_MEM;
+        memcpy(&program[n], filter, sizeof(filter));
+        n += sizeof(filter) / sizeof(filter[0]);
+
+        memset(RTC_SLOW_MEM, 0, DATA_WORDS * sizeof(uint32_t));
+        size_t size = n;
+        esp_err_t err = ulp_process_macros_and_load(DATA_WORDS, program, &size);
+        if (err != ESP_OK) return err;
+        err = ulp_set_wakeup_period(0, periodUs);
+        if (err != ESP_OK) return err;
+        return ulp_run(DATA_WORDS);
+    }
+
+    // After a ULP wake: stop the program and copy out what it buffered.
+    // Returns the number of events; held gets the key (or TOUCH) still down
+    // when the ULP stopped, or NONE.
+    uint8_t collect(uint8_t *events, uint8_t maxEvents, int8_t &held) {
+        CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+        delayMicroseconds(200);  // Let a sample in progress run to its halt
+
+        // The ULP stores its program counter in the upper half of each word
+        uint8_t count = word(HEAD);
+        if (count > BUFFER_LEN) count = BUFFER_LEN;
+        if (count > maxEvents) count = maxEvents;
+        for (uint8_t i = 0; i < count; i++) events[i] = word(BUFFER + i) - 1;
+        uint16_t last = word(HELD);
+        held = last ? static_cast<int8_t>(last - 1) : NONE;
+        return count;
+    }
+
+    bool touchWatched() const { return watchingTouch; }
+
+private:
+    // RTC slow memory word offsets shared with the program
+    static constexpr uint8_t LAST = 0;     // Previous sample
+    static constexpr uint8_t COUNT = 1;    // Samples it has repeated
+    static constexpr uint8_t HELD = 2;     // Last accepted reading
+    static constexpr uint8_t HEAD = 3;     // Events buffered
+    static constexpr uint8_t BUFFER = 4;
+    static constexpr uint8_t DATA_WORDS = BUFFER + BUFFER_LEN;
+
+    static constexpr size_t FILTER_MAX = 40;  // The debounce and buffering tail, labels included
+    static constexpr size_t PROGRAM_MAX = 4 + Cols * (3 + 3 * Rows) + FILTER_MAX;
+    static constexpr uint16_t SETTLE_CYCLES = 80;  // ~10 µs at the 8 MHz ULP clock
+
+    static uint16_t word(uint8_t offset) { return RTC_SLOW_MEM[offset] & 0xFFFF; }
+
+    bool watchingTouch = false;
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+#include "FlashBlock.h"
+#include "PinCredential.h"
+
+// The people who may open the lock. Each user has a PIN hash, a role and an
+// enabled flag, and the table also records which user owns each fingerprint
+// template page. It lives in a FlashBlock and is read in place, so hundreds
+// of users cost no RAM.
+//
+// A PIN is found by its hash, not by comparing it against every user. All
+// users share one salt, so the typed PIN is hashed and stretched once, and
+// its digest picks a home slot in an open-addressed table. The lookup always
+// examines the same Probes slots and never exits early, so it takes the same
+// time for any PIN however full the table is. To keep that true, inserts
+// place every PIN within Probes slots of its home and keep the table at most
+// half full, and no two users may share a PIN.
+template <class Credential, uint16_t Slots, uint16_t Pages, uint8_t Probes = 16>
+class UserTable {
+public:
+    static_assert((Slots & (Slots - 1)) == 0, "Slots must be a power of two");
+    static_assert(Probes <= Slots, "more probes than slots");
+
+    enum Role : uint8_t {
+        USER,
+        ADMIN       // May open the admin menu and log in on the console
+    };
+
+    enum Result : uint8_t {
+        OK,
+        BAD_PIN,      // Not Credential::DIGITS digits
+        PIN_IN_USE,   // Another user has it
+        FULL,
+        NO_USER,
+        LAST_ADMIN,   // Would leave nobody able to administer the lock
+        FLASH_ERROR
+    };
+
+    static constexpr uint16_t NONE = 0;  // No user: an empty slot or an unowned page
+
+    struct User {
+        typename Credential::Digest hash;
+        uint16_t id;        // NONE for an empty slot; never reused
+        uint8_t role;
+        uint8_t enabled;
+    };
+
+    struct Layout {
+        typename Credential::Salt salt;
+        uint16_t lastId;                // Highest id handed out
+        uint16_t count;
+        uint16_t legacyOwner;           // Owns pages enrolled before the table existed
+        User users[Slots];
+        uint16_t owners[Pages];         // 0: legacyOwner, RELEASED: nobody
+    };
+
+    bool begin(const char *label, uint16_t version) { return store.begin(label, version); }
+    bool ready() const { return store.ready(); }
+    bool fresh() const { return store.fresh(); }
+    uint32_t commitCount() const { return store.commitCount(); }
+
+    // Only while ready(); the checks below stand in for a table when the partition is missing
+    const Layout &data() const { return store.data(); }
+    uint16_t size() const { return ready() ? data().count : 0; }
+
+    const typename Credential::Salt &salt() const {
+        static const typename Credential::Salt none = {};
+        return ready() ? data().salt : none;
+    }
+
+    // Slot holding the PIN with this stretched hash, or -1. Same work for any digest.
+    int16_t find(const typename Credential::Digest &digest) const {
+        if (!ready()) return -1;
+        const Layout &table = data();
+        uint16_t home = homeSlot(digest);
+        int16_t found = -1;
+        for (uint8_t i = 0; i < Probes; i++) {
+            uint16_t slot = (home + i) & (Slots - 1);
+            const User &user = table.users[slot];
+            bool hit = Credential::equal(user.hash, digest) & (user.id != NONE);
+            found = hit ? slot : found;
+        }
+        return found;
+    }
+
+    // Finish a PIN typed against salt() and look it up; a short entry runs
+    // the full stretch and never matches
+    const User *match(typename Credential::Entry &entry) const {
+        bool complete = entry.length() == Credential::DIGITS;
+        if (entry.length() == 0) entry.add(salt(), '\0');
+        typename Credential::Digest digest;
+        entry.finish(digest);
+        int16_t slot = find(digest);
+        memset(digest, 0, sizeof(digest));
+        return complete && slot >= 0 ? &data().users[slot] : nullptr;
+    }
+
+    const User *match(const char *pin) const {
+        typename Credential::Entry entry;
+        for (uint8_t i = 0; i < Credential::DIGITS && pin[i]; i++) entry.add(salt(), pin[i]);
+        const User *user = match(entry);
+        return strlen(pin) == Credential::DIGITS ? user : nullptr;
+    }
+
+    const User *user(uint16_t id) const {
+        if (id == NONE || !ready()) return nullptr;
+        for (const User &user : data().users) {
+            if (user.id == id) return &user;
+        }
+        return nullptr;
+    }
+
+    // Who the template on page belongs to; NONE when nobody or a removed user
+    uint16_t owner(uint16_t page) const {
+        if (page >= Pages || !ready()) return NONE;
+        uint16_t id = data().owners[page];
+        if (id == RELEASED) return NONE;
+        return id == NONE ? data().legacyOwner : id;
+    }
+
+    Result add(const char *pin, Role role, uint16_t &id) {
+        if (!ready()) return FLASH_ERROR;
+        const Layout &table = data();
+        if (!Credential::wellFormed(pin)) return BAD_PIN;
+        if (table.count >= Slots / 2 || table.lastId == RELEASED - 1) return FULL;
+        User user = {};
+        Credential::digest(table.salt, pin, user.hash);
+        int16_t slot = place(user.hash, -1);
+        if (slot < 0) return slot == -2 ? PIN_IN_USE : FULL;
+
+        user.id = table.lastId + 1;
+        user.role = role;
+        user.enabled = 1;
+        uint16_t count = table.count + 1;
+        typename Store::Patch patches[] = {
+            store.patch(table.users[slot], user),
+            store.patch(table.lastId, user.id),
+            store.patch(table.count, count),
+        };
+        if (!store.update(patches, 3)) return FLASH_ERROR;
+        id = user.id;
+        return OK;
+    }
+
+    // The user's pages stay recorded under a dead id and so belong to nobody
+    Result remove(uint16_t id) {
+        const Layout &table = data();
+        const User *user = this->user(id);
+        if (!user) return NO_USER;
+        if (leavesNoAdmin(*user)) return LAST_ADMIN;
+        User empty = {};
+        uint16_t count = table.count - 1;
+        uint16_t legacy = table.legacyOwner == id ? NONE : table.legacyOwner;
+        typename Store::Patch patches[] = {
+            store.patch(*user, empty),
+            store.patch(table.count, count),
+            store.patch(table.legacyOwner, legacy),
+        };
+        return store.update(patches, 3) ? OK : FLASH_ERROR;
+    }
+
+    Result setPin(uint16_t id, const char *pin) {
+        const Layout &table = data();
+        const User *user = this->user(id);
+        if (!user) return NO_USER;
+        if (!Credential::wellFormed(pin)) return BAD_PIN;
+        User moved = *user;
+        Credential::digest(table.salt, pin, moved.hash);
+        int16_t from = user - table.users;
+        int16_t slot = place(moved.hash, from);
+        if (slot < 0) return slot == -2 ? PIN_IN_USE : FULL;
+
+        User empty = {};
+        typename Store::Patch patches[] = {
+            store.patch(*user, empty),
+            store.patch(table.users[slot], moved),
+        };
+        return store.update(patches, 2) ? OK : FLASH_ERROR;
+    }
+
+    Result setEnabled(uint16_t id, bool enabled) {
+        const User *user = this->user(id);
+        if (!user) return NO_USER;
+        if (!enabled && leavesNoAdmin(*user)) return LAST_ADMIN;
+        uint8_t flag = enabled;
+        typename Store::Patch patch = store.patch(user->enabled, flag);
+        return store.update(&patch, 1) ? OK : FLASH_ERROR;
+    }
+
+    // Record who a template page belongs to; NONE leaves it to nobody
+    Result bind(uint16_t page, uint16_t id) {
+        if (!ready()) return FLASH_ERROR;
+        if (page >= Pages) return NO_USER;
+        if (id != NONE && !user(id)) return NO_USER;
+        uint16_t owner = id == NONE ? RELEASED : id;
+        typename Store::Patch patch = store.patch(data().owners[page], owner);
+        return store.update(&patch, 1) ? OK : FLASH_ERROR;
+    }
+
+    // First start: one earlier credential becomes admin 1, keeping both its
+    // salt and hash so the PIN carries over without being known. Pages
+    // enrolled before now are left to that admin.
+    Result seed(const typename Credential::Record &legacy) {
+        if (!ready()) return FLASH_ERROR;
+        const Layout &table = data();
+        User admin = {};
+        memcpy(admin.hash, legacy.hash, sizeof(admin.hash));
+        admin.id = 1;
+        admin.role = ADMIN;
+        admin.enabled = 1;
+        uint16_t one = 1;
+        typename Store::Patch patches[] = {
+            store.patch(table.salt, legacy.salt),
+            store.patch(table.users[homeSlot(admin.hash)], admin),
+            store.patch(table.lastId, one),
+            store.patch(table.count, one),
+            store.patch(table.legacyOwner, one),
+        };
+        return store.update(patches, 5) ? OK : FLASH_ERROR;
+    }
+
+private:
+    using Store = FlashBlock<Layout>;
+    static constexpr uint16_t RELEASED = 0xFFFF;
+
+    static uint16_t homeSlot(const typename Credential::Digest &digest) {
+        return (digest[0] | digest[1] << 8) & (Slots - 1);
+    }
+
+    // Free slot for hash within reach of its home. vacating is a slot that
+    // is about to be emptied. -1 when none is free, -2 when the PIN is taken.
+    int16_t place(const typename Credential::Digest &hash, int16_t vacating) const {
+        int16_t taken = find(hash);
+        if (taken >= 0 && taken != vacating) return -2;
+        uint16_t home = homeSlot(hash);
+        for (uint8_t i = 0; i < Probes; i++) {
+            uint16_t slot = (home + i) & (Slots - 1);
+            if (data().users[slot].id == NONE || slot == vacating) return slot;
+        }
+        return -1;
+    }
+
+    bool leavesNoAdmin(const User &leaving) const {
+        if (leaving.role != ADMIN || !leaving.enabled) return false;
+        for (const User &user : data().users) {
+            if (&user != &leaving && user.id != NONE && user.role == ADMIN && user.enabled) return false;
+        }
+        return true;
+    }
+
+    Store store;
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+// Host build of the parts of the ESP32 Arduino core the locker uses. Print and
+// the serial port work for real; time is the simulated clock in sim_hal.h.
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <string>
+
+#include "sim_hal.h"
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define ONLOW 0x04
+#define ONHIGH 0x05
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define SERIAL_8N1 0x800001c
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class Print {
+public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t write(const char *s) { return s ? write(reinterpret_cast<const uint8_t *>(s), strlen(s)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write(reinterpret_cast<const uint8_t *>(buffer), size); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(int n, int base = DEC) { return print(static_cast<long>(n), base); }
+    size_t print(unsigned n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+    size_t print(long n, int base = DEC) {
+        if (base == DEC) return formatted("%ld", n);
+        return print(static_cast<unsigned long>(n), base);
+    }
+    size_t print(unsigned long n, int base = DEC) {
+        if (base == HEX) return formatted("%lX", n);
+        if (base == OCT) return formatted("%lo", n);
+        return formatted("%lu", n);
+    }
+    size_t print(double n, int digits = 2) { return formatted("%.*f", digits, n); }
+
+    size_t println() { return write("\r\n"); }
+    template <class T> size_t println(T value) { return print(value) + println(); }
+    template <class T> size_t println(T value, int format) { return print(value, format) + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        if (muted()) return 0;
+        va_list args;
+        va_start(args, format);
+        size_t n = vformatted(format, args);
+        va_end(args);
+        return n;
+    }
+
+    virtual void flush() {}
+
+protected:
+    // A sink that throws output away can skip the formatting
+    virtual bool muted() const { return false; }
+
+private:
+    size_t formatted(const char *format, ...) {
+        if (muted()) return 0;
+        va_list args;
+        va_start(args, format);
+        size_t n = vformatted(format, args);
+        va_end(args);
+        return n;
+    }
+
+    size_t vformatted(const char *format, va_list args) {
+        char buffer[256];
+        int n = vsnprintf(buffer, sizeof(buffer), format, args);
+        if (n <= 0) return 0;
+        return write(reinterpret_cast<const uint8_t *>(buffer),
+                     static_cast<size_t>(n) < sizeof(buffer) ? n : sizeof(buffer) - 1);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long ms) { timeout = ms; }
+
+    size_t readBytes(uint8_t *buffer, size_t length) {
+        size_t n = 0;
+        while (n < length) {
+            int c = read();
+            if (c < 0) break;
+            buffer[n++] = c;
+        }
+        return n;
+    }
+    size_t readBytes(char *buffer, size_t length) { return readBytes(reinterpret_cast<uint8_t *>(buffer), length); }
+
+protected:
+    unsigned long timeout = 1000;
+};
+
+typedef std::function<void(void)> OnReceiveCb;
+
+// Input is whatever the harness queued with feed(); output is kept for the
+// harness to inspect, and echoed to stdout when asked to
+class HardwareSerial : public Stream {
+public:
+    explicit HardwareSerial(int uart) : uart(uart) {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1,
+               bool invert = false, unsigned long timeoutMs = 20000UL, uint8_t rxfifoFull = 112) {
+        this->baud = baud;
+    }
+    void end(bool = true) {}
+    void updateBaudRate(unsigned long baud) { this->baud = baud; }
+    unsigned long baudRate() { return baud; }
+    void onReceive(OnReceiveCb cb, bool = false) { receive = cb; }
+    size_t setRxBufferSize(size_t n) { return n; }
+    size_t setTxBufferSize(size_t n) { return n; }
+    int availableForWrite() { return 128; }
+    operator bool() const { return true; }
+
+    int available() override { return input.size(); }
+    int read() override {
+        if (input.empty()) return -1;
+        uint8_t c = input.front();
+        input.pop_front();
+        return c;
+    }
+    int peek() override { return input.empty() ? -1 : input.front(); }
+
+    size_t write(uint8_t c) override {
+        if (echo) fputc(c, stdout);
+        if (capture) output += static_cast<char>(c);
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size) override {
+        if (echo) fwrite(buffer, 1, size, stdout);
+        if (capture) output.append(reinterpret_cast<const char *>(buffer), size);
+        return size;
+    }
+    using Print::write;
+
+    // Harness side
+    void feed(const char *text) {
+        while (*text) input.push_back(static_cast<uint8_t>(*text++));
+        if (receive) receive();
+    }
+    void clearInput() { input.clear(); }
+    bool echo = false;
+    bool capture = false;
+    std::string output;
+
+protected:
+    bool muted() const override { return !echo && !capture; }
+
+private:
+    int uart;
+    unsigned long baud = 0;
+    std::deque<uint8_t> input;
+    OnReceiveCb receive;
+};
+
+extern HardwareSerial Serial;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+
+double ledcSetup(uint8_t channel, double freq, uint8_t resolution);
+double ledcChangeFrequency(uint8_t channel, double freq, uint8_t resolution);
+void ledcWrite(uint8_t channel, uint32_t duty);
+double ledcWriteTone(uint8_t channel, double freq);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcDetachPin(uint8_t pin);
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+size_t getArduinoLoopTaskStackSize();
+
+// Hardware timers never fire on the host: the keypad scan ISR is not simulated
+struct hw_timer_t;
+hw_timer_t *timerBegin(uint8_t num, uint16_t divider, bool countUp);
+void timerEnd(hw_timer_t *timer);
+void timerAttachInterrupt(hw_timer_t *timer, void (*isr)(void), bool edge);
+void timerDetachInterrupt(hw_timer_t *timer);
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarm, bool autoreload);
+void timerAlarmEnable(hw_timer_t *timer);
+void timerAlarmDisable(hw_timer_t *timer);
+void timerStart(hw_timer_t *timer);
+void timerStop(hw_timer_t *timer);
+void timerWrite(hw_timer_t *timer, uint64_t value);
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getMinFreeHeap() { return 180000; }
+    uint32_t getMaxAllocHeap() { return 110000; }
+    uint32_t getHeapSize() { return 300000; }
+    uint8_t getChipRevision() { return 3; }
+    uint32_t getSketchSize() { return 0; }
+    const char *getSdkVersion() { return "host"; }
+    static uint32_t getCycleCount() { return static_cast<uint32_t>(sim::now() * 240); }
+    void restart();
+};
+extern EspClass ESP;
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
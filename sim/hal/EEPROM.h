@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Legacy settings area, erased (all 0xFF) unless the harness writes to it
+class EEPROMClass {
+public:
+    EEPROMClass() { erase(); }
+    bool begin(size_t size) { return size <= sizeof(bytes); }
+    uint8_t read(int address) { return address >= 0 && address < static_cast<int>(sizeof(bytes)) ? bytes[address] : 0xFF; }
+    void write(int address, uint8_t value) {
+        if (address >= 0 && address < static_cast<int>(sizeof(bytes))) bytes[address] = value;
+    }
+    bool commit() { return true; }
+    void end() {}
+    void erase() { memset(bytes, 0xFF, sizeof(bytes)); }
+
+private:
+    uint8_t bytes[512];
+};
+
+extern EEPROMClass EEPROM;
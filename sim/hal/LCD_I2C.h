@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string>
+
+// HD44780 behind a PCF8574, up to 20x4, modelled at the level of what it shows:
+// DDRAM for the visible cells, CGRAM, the cursor and the backlight. Counts
+// the data writes, which is what the I2C bus pays for.
+class LCD_I2C : public Print {
+public:
+    static constexpr uint8_t MAX_COLS = 20;
+    static constexpr uint8_t MAX_ROWS = 4;
+
+    LCD_I2C(uint8_t address, uint8_t cols = 16, uint8_t rows = 2) : cols(cols), rows(rows) {
+        memset(cells, ' ', sizeof(cells));
+    }
+
+    void begin(bool beginWire = true) {
+        clear();
+        on = true;
+    }
+    void backlight() { lit = true; }
+    void noBacklight() { lit = false; }
+    void display() { on = true; }
+    void noDisplay() { on = false; }
+    void clear() {
+        memset(cells, ' ', sizeof(cells));
+        home();
+    }
+    void home() { setCursor(0, 0); }
+    void setCursor(uint8_t c, uint8_t r) {
+        col = c;
+        row = r;
+    }
+    void createChar(uint8_t slot, uint8_t bitmap[8]) {
+        memcpy(cgram[slot & 7], bitmap, 8);
+        glyphUploads++;
+    }
+
+    size_t write(uint8_t ch) override {
+        writes++;
+        if (row < rows && col < cols) cells[row][col] = ch;
+        col++;
+        return 1;
+    }
+    using Print::write;
+
+    // Harness side: one row as text, custom glyphs shown as their slot digit
+    std::string text(uint8_t r) const {
+        std::string line;
+        for (uint8_t c = 0; c < cols; c++) {
+            uint8_t ch = cells[r][c];
+            line += ch < 8 ? static_cast<char>('0' + ch) : static_cast<char>(ch);
+        }
+        return line;
+    }
+    bool lit = false;
+    bool on = false;
+    uint32_t writes = 0;
+    uint32_t glyphUploads = 0;
+
+private:
+    uint8_t cols, rows;
+    uint8_t cells[MAX_ROWS][MAX_COLS];
+    uint8_t cgram[8][8] = {};
+    uint8_t col = 0, row = 0;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// NVS as a map shared by every Preferences instance. It survives
+// sim::reboot() like flash does; sim::powerOn() wipes it.
+class Preferences {
+public:
+    using Namespace = std::map<std::string, std::vector<uint8_t>>;
+    static std::map<std::string, Namespace> &flash();
+
+    bool begin(const char *name, bool readOnly = false, const char *partition = nullptr) {
+        ns = &flash()[name];
+        this->readOnly = readOnly;
+        return true;
+    }
+    void end() { ns = nullptr; }
+
+    bool clear() {
+        if (!ns || readOnly) return false;
+        ns->clear();
+        return true;
+    }
+    bool remove(const char *key) { return ns && !readOnly && ns->erase(key) > 0; }
+    bool isKey(const char *key) { return ns && ns->count(key) > 0; }
+    size_t freeEntries() { return 500; }
+
+    size_t putBytes(const char *key, const void *value, size_t length) {
+        if (!ns || readOnly) return 0;
+        const uint8_t *bytes = static_cast<const uint8_t *>(value);
+        (*ns)[key].assign(bytes, bytes + length);
+        writes++;
+        return length;
+    }
+    size_t getBytesLength(const char *key) {
+        if (!ns) return 0;
+        auto it = ns->find(key);
+        return it == ns->end() ? 0 : it->second.size();
+    }
+    size_t getBytes(const char *key, void *buffer, size_t length) {
+        size_t stored = getBytesLength(key);
+        if (stored == 0 || stored > length) return 0;
+        memcpy(buffer, ns->find(key)->second.data(), stored);
+        return stored;
+    }
+
+    static uint32_t writes;  // Blob writes so far, across instances
+
+private:
+    Namespace *ns = nullptr;
+    bool readOnly = false;
+};
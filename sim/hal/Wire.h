@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Arduino.h>
+
+// The I2C bus itself is not simulated; the LCD mock sits above it
+class TwoWire {
+public:
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+    bool setClock(uint32_t frequency) { return true; }
+    void beginTransmission(uint8_t address) {}
+    uint8_t endTransmission(bool stop = true) { return 0; }
+    size_t write(uint8_t data) { return 1; }
+};
+
+extern TwoWire Wire;
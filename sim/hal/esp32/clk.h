@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_clk_slowclk_cal_get(void);  // Q13.19 µs per slow clock tick
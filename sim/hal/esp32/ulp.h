@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_system.h"
+
+// The ULP is not emulated. Programs assemble into placeholder words so the
+// builder code runs, loading always succeeds, and the coprocessor never
+// writes anything: a ULP wake reports an empty key buffer.
+typedef struct { uint32_t instr; } ulp_insn_t;
+
+enum { R0, R1, R2, R3 };
+
+#define JUMPR_LT 0
+#define JUMPR_GE 1
+
+extern uint32_t sim_rtc_slow_mem[2048];
+#define RTC_SLOW_MEM sim_rtc_slow_mem
+
+#define SIM_ULP_INSN(...) ulp_insn_t{ 0 }
+#define I_MOVI(reg, imm) SIM_ULP_INSN(reg, imm)
+#define I_MOVR(dst, src) SIM_ULP_INSN(dst, src)
+#define I_ADDI(dst, src, imm) SIM_ULP_INSN(dst, src, imm)
+#define I_ADDR(dst, a, b) SIM_ULP_INSN(dst, a, b)
+#define I_SUBR(dst, a, b) SIM_ULP_INSN(dst, a, b)
+#define I_LD(dst, base, offset) SIM_ULP_INSN(dst, base, offset)
+#define I_ST(src, base, offset) SIM_ULP_INSN(src, base, offset)
+#define I_RD_REG(reg, lo, hi) SIM_ULP_INSN(reg, lo, hi)
+#define I_WR_REG(reg, lo, hi, val) SIM_ULP_INSN(reg, lo, hi, val)
+#define I_DELAY(cycles) SIM_ULP_INSN(cycles)
+#define I_JUMPR(offset, imm, cond) SIM_ULP_INSN(offset, imm, cond)
+#define I_HALT() SIM_ULP_INSN()
+#define I_WAKE() SIM_ULP_INSN()
+#define M_LABEL(label) SIM_ULP_INSN(label)
+#define M_BRANCH(label) SIM_ULP_INSN(label)
+#define M_BL(label, imm) M_BRANCH(label), I_JUMPR(0, imm, JUMPR_LT)
+#define M_BGE(label, imm) M_BRANCH(label), I_JUMPR(0, imm, JUMPR_GE)
+#define M_BXZ(label) M_BRANCH(label), SIM_ULP_INSN()
+
+esp_err_t ulp_process_macros_and_load(uint32_t loadAddr, const ulp_insn_t *program, size_t *size);
+esp_err_t ulp_run(uint32_t entryPoint);
+esp_err_t ulp_set_wakeup_period(size_t index, uint32_t periodUs);
@@ -0,0 +1,695 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <Preferences.h>
+#include <Wire.h>
+#include <algorithm>
+#include <vector>
+#include "driver/rtc_io.h"
+#include "esp32/clk.h"
+#include "esp32/ulp.h"
+#include "esp_partition.h"
+#include "esp_pm.h"
+#include "esp_rom_crc.h"
+#include "esp_sleep.h"
+#include "mbedtls/sha256.h"
+#include "soc/gpio_struct.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+
+// ---------------------------------------------------------------------------
+// Clock, boots and tasks
+// ---------------------------------------------------------------------------
+
+struct SimQueue {
+    size_t itemSize;
+    size_t length;
+    size_t head = 0;
+    size_t count = 0;
+    std::vector<uint8_t> storage;
+};
+
+struct SimTask {
+    const char *name;
+};
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    uint64_t due = 0;     // On the sim::now() base
+    uint64_t period = 0;  // 0 = one-shot
+    bool active = false;
+};
+
+void erasePartitions();
+
+namespace {
+uint64_t clock_us = 0;
+uint64_t boot_us = 0;
+int wake_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+std::vector<SimQueue *> queues;
+std::vector<SimTask *> tasks;
+std::vector<esp_timer *> timers;
+SimTask loop_task = {"loopTask"};
+SimTask timer_task = {"esp_timer"};
+void *current_task = &loop_task;
+uint8_t pin_levels[40];
+bool pin_driven[40];  // Set from outside; pull-ups and pull-downs no longer apply
+struct LedcChannel {
+    double frequency;
+    uint32_t duty;
+} ledc[16];
+
+void service() {
+    if (sim::hooks.service) sim::hooks.service();
+}
+
+// Let time pass on the loop task; the other tasks get a turn every tick
+void sleepFor(uint64_t us) {
+    service();
+    while (us) {
+        uint64_t step = us < 1000 ? us : 1000;
+        sim::advance(step);
+        service();
+        us -= step;
+    }
+}
+
+bool pop(SimQueue *q, void *item) {
+    if (q->count == 0) return false;
+    memcpy(item, &q->storage[q->head * q->itemSize], q->itemSize);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    return true;
+}
+
+bool push(SimQueue *q, const void *item, bool front) {
+    if (q->count == q->length) return false;
+    size_t slot;
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+        slot = q->head;
+    } else {
+        slot = (q->head + q->count) % q->length;
+    }
+    memcpy(&q->storage[slot * q->itemSize], item, q->itemSize);
+    q->count++;
+    return true;
+}
+
+BaseType_t send(QueueHandle_t q, const void *item, TickType_t ticks, bool front) {
+    if (push(q, item, front)) return pdTRUE;
+    if (ticks == 0) return pdFALSE;
+    service();  // Give the consumer a chance to make room
+    return push(q, item, front) ? pdTRUE : pdFALSE;
+}
+}  // namespace
+
+namespace sim {
+
+Hooks hooks;
+
+uint64_t now() { return clock_us; }
+
+void advance(uint64_t us) { advanceTo(clock_us + us); }
+
+// Fires esp_timer callbacks that fall due on the way, in order
+void advanceTo(uint64_t us) {
+    for (;;) {
+        esp_timer *next = nullptr;
+        for (esp_timer *t : timers) {
+            if (t->active && t->due <= us && (!next || t->due < next->due)) next = t;
+        }
+        if (!next) break;
+        if (next->due > clock_us) clock_us = next->due;
+        if (next->period) {
+            next->due += next->period;
+        } else {
+            next->active = false;
+        }
+        void *caller = current_task;
+        current_task = &timer_task;
+        next->callback(next->arg);
+        current_task = caller;
+    }
+    if (us > clock_us) clock_us = us;
+}
+
+uint64_t nextTimerDue() {
+    uint64_t due = UINT64_MAX;
+    for (esp_timer *t : timers) {
+        if (t->active && t->due < due) due = t->due;
+    }
+    return due;
+}
+
+void reboot(int cause, uint64_t at) {
+    for (SimQueue *q : queues) delete q;
+    queues.clear();
+    for (SimTask *t : tasks) delete t;
+    tasks.clear();
+    for (esp_timer *t : timers) delete t;
+    timers.clear();
+    current_task = &loop_task;
+    memset(pin_levels, 0, sizeof(pin_levels));
+    memset(pin_driven, 0, sizeof(pin_driven));
+    memset(ledc, 0, sizeof(ledc));
+    if (at > clock_us) clock_us = at;
+    boot_us = clock_us;
+    wake_cause = cause;
+}
+
+void powerOn() {
+    clock_us = 0;
+    reboot(ESP_SLEEP_WAKEUP_UNDEFINED, 0);
+    Preferences::flash().clear();
+    EEPROM.erase();
+    erasePartitions();
+    memset(sim_rtc_slow_mem, 0, sizeof(sim_rtc_slow_mem));
+}
+
+void *currentTask() { return current_task; }
+void setCurrentTask(void *task) { current_task = task ? task : &loop_task; }
+
+uint8_t pinLevel(uint8_t pin) { return pin < 40 ? pin_levels[pin] : 0; }
+uint32_t ledcDuty(uint8_t channel) { return ledc[channel & 15].duty; }
+double ledcFrequency(uint8_t channel) { return ledc[channel & 15].frequency; }
+
+void setPinLevel(uint8_t pin, uint8_t level) {
+    if (pin >= 40) return;
+    pin_levels[pin] = level;
+    pin_driven[pin] = true;
+}
+
+}  // namespace sim
+
+// ---------------------------------------------------------------------------
+// Arduino core
+// ---------------------------------------------------------------------------
+
+HardwareSerial Serial(0);
+TwoWire Wire;
+EEPROMClass EEPROM;
+EspClass ESP;
+volatile gpio_dev_t GPIO;
+volatile uint32_t sim_rtc_cntl[64];
+uint32_t sim_rtc_slow_mem[2048];
+
+uint32_t Preferences::writes = 0;
+
+std::map<std::string, Preferences::Namespace> &Preferences::flash() {
+    static std::map<std::string, Namespace> store;
+    return store;
+}
+
+void EspClass::restart() {
+    fprintf(stderr, "sim: ESP.restart() called\n");
+    abort();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= 40 || pin_driven[pin]) return;
+    if (mode & PULLUP) pin_levels[pin] = HIGH;
+    else if (mode & PULLDOWN) pin_levels[pin] = LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    if (pin < 40) pin_levels[pin] = level ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) { return sim::pinLevel(pin); }
+
+unsigned long millis() { return (clock_us - boot_us) / 1000; }
+unsigned long micros() { return clock_us - boot_us; }
+void delay(uint32_t ms) { sleepFor(static_cast<uint64_t>(ms) * 1000); }
+void delayMicroseconds(uint32_t us) { sim::advance(us); }
+void yield() { service(); }
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+void detachInterrupt(uint8_t) {}
+
+double ledcSetup(uint8_t channel, double freq, uint8_t) {
+    ledc[channel & 15].frequency = freq;
+    return freq;
+}
+double ledcChangeFrequency(uint8_t channel, double freq, uint8_t) { return ledcSetup(channel, freq, 0); }
+void ledcWrite(uint8_t channel, uint32_t duty) { ledc[channel & 15].duty = duty; }
+double ledcWriteTone(uint8_t channel, double freq) {
+    ledcWrite(channel, freq ? 127 : 0);
+    return ledcSetup(channel, freq, 8);
+}
+void ledcAttachPin(uint8_t, uint8_t) {}
+void ledcDetachPin(uint8_t) {}
+
+bool setCpuFrequencyMhz(uint32_t) { return true; }
+uint32_t getCpuFrequencyMhz() { return 240; }
+size_t getArduinoLoopTaskStackSize() { return 8192; }
+
+// Section bounds the linker script provides on the chip; on the host they only
+// need to exist, and the sizes derived from them mean nothing
+extern "C" {
+char _iram_start[1], _iram_end[1], _data_start[1], _heap_start[1];
+}
+
+struct hw_timer_t {
+    uint8_t num;
+};
+hw_timer_t *timerBegin(uint8_t num, uint16_t, bool) {
+    static hw_timer_t hw_timers[4] = {{0}, {1}, {2}, {3}};
+    return &hw_timers[num & 3];
+}
+void timerEnd(hw_timer_t *) {}
+void timerAttachInterrupt(hw_timer_t *, void (*)(void), bool) {}
+void timerDetachInterrupt(hw_timer_t *) {}
+void timerAlarmWrite(hw_timer_t *, uint64_t, bool) {}
+void timerAlarmEnable(hw_timer_t *) {}
+void timerAlarmDisable(hw_timer_t *) {}
+void timerStart(hw_timer_t *) {}
+void timerStop(hw_timer_t *) {}
+void timerWrite(hw_timer_t *, uint64_t) {}
+
+// ---------------------------------------------------------------------------
+// FreeRTOS
+// ---------------------------------------------------------------------------
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *name, uint32_t, void *, UBaseType_t,
+                                   TaskHandle_t *handle, BaseType_t) {
+    tasks.push_back(new SimTask{name});
+    if (handle) *handle = tasks.back();
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t code, const char *name, uint32_t stack, void *arg,
+                                           UBaseType_t priority, StackType_t *, StaticTask_t *, BaseType_t core) {
+    TaskHandle_t handle = nullptr;
+    xTaskCreatePinnedToCore(code, name, stack, arg, priority, &handle, core);
+    return handle;
+}
+
+void vTaskDelete(TaskHandle_t) {}
+void vTaskDelay(TickType_t ticks) { sleepFor(static_cast<uint64_t>(ticks) * 1000); }
+
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment) {
+    *previous += increment;
+    int32_t ahead = static_cast<int32_t>(*previous - xTaskGetTickCount());
+    if (ahead > 0) vTaskDelay(ahead);
+}
+
+void vTaskSuspend(TaskHandle_t) {}
+void vTaskResume(TaskHandle_t) {}
+TickType_t xTaskGetTickCount() { return millis(); }
+TaskHandle_t xTaskGetCurrentTaskHandle() { return current_task; }
+const char *pcTaskGetName(TaskHandle_t task) { return static_cast<SimTask *>(task ? task : current_task)->name; }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 0; }
+BaseType_t xTaskNotifyGive(TaskHandle_t) { return pdPASS; }
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t *woken) {
+    if (woken) *woken = pdFALSE;
+}
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    SimQueue *q = new SimQueue{itemSize, length};
+    q->storage.resize(static_cast<size_t>(length) * itemSize);
+    queues.push_back(q);
+    return q;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *, StaticQueue_t *) {
+    return xQueueCreate(length, itemSize);
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    queues.erase(std::remove(queues.begin(), queues.end(), q), queues.end());
+    delete q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) { return send(q, item, ticks, false); }
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t ticks) { return send(q, item, ticks, false); }
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks) { return send(q, item, ticks, true); }
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void *item, BaseType_t *woken) {
+    if (woken) *woken = pdFALSE;
+    return push(q, item, false) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void *item) {
+    q->count = 0;
+    return push(q, item, false) ? pdTRUE : pdFALSE;
+}
+
+// An empty queue hands control to the harness: it runs the other tasks and
+// either posts input or lets the timeout pass
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    if (pop(q, item)) return pdTRUE;
+    if (ticks == 0) return pdFALSE;
+    service();
+    if (pop(q, item)) return pdTRUE;
+    if (!sim::hooks.wait) {
+        if (ticks == portMAX_DELAY) throw sim::Stalled{};
+        sim::advance(static_cast<uint64_t>(ticks) * 1000);
+        return pop(q, item) ? pdTRUE : pdFALSE;
+    }
+    sim::hooks.wait(ticks);
+    return pop(q, item) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t) {
+    if (q->count == 0) return pdFALSE;
+    memcpy(item, &q->storage[q->head * q->itemSize], q->itemSize);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) { return q->count; }
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) { return q->length - q->count; }
+
+BaseType_t xQueueReset(QueueHandle_t q) {
+    q->head = 0;
+    q->count = 0;
+    return pdPASS;
+}
+
+// ---------------------------------------------------------------------------
+// ESP-IDF
+// ---------------------------------------------------------------------------
+
+const char *esp_err_to_name(esp_err_t err) {
+    switch (err) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+uint32_t esp_get_free_heap_size() { return ESP.getFreeHeap(); }
+uint32_t esp_get_minimum_free_heap_size() { return ESP.getMinFreeHeap(); }
+esp_reset_reason_t esp_reset_reason() {
+    return wake_cause == ESP_SLEEP_WAKEUP_UNDEFINED ? ESP_RST_POWERON : ESP_RST_DEEPSLEEP;
+}
+void esp_restart() { ESP.restart(); }
+
+uint32_t esp_random() {
+    static uint32_t state = 0x2545F491;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void esp_fill_random(void *buf, size_t len) {
+    uint8_t *out = static_cast<uint8_t *>(buf);
+    while (len--) *out++ = esp_random();
+}
+
+int64_t esp_timer_get_time() { return clock_us - boot_us; }
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+    if (!args || !args->callback || !handle) return ESP_ERR_INVALID_ARG;
+    esp_timer *t = new esp_timer{args->callback, args->arg, args->name};
+    timers.push_back(t);
+    *handle = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t timeoutUs) {
+    if (t->active) return ESP_ERR_INVALID_STATE;
+    t->due = clock_us + timeoutUs;
+    t->period = 0;
+    t->active = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t periodUs) {
+    if (t->active) return ESP_ERR_INVALID_STATE;
+    t->due = clock_us + periodUs;
+    t->period = periodUs;
+    t->active = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t) {
+    if (!t->active) return ESP_ERR_INVALID_STATE;
+    t->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t) {
+    if (t->active) return ESP_ERR_INVALID_STATE;
+    timers.erase(std::remove(timers.begin(), timers.end(), t), timers.end());
+    delete t;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t t) { return t->active; }
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// The data partitions of partitions.csv
+struct SimPartition {
+    esp_partition_t info;
+    std::vector<uint8_t> bytes;
+};
+
+std::vector<SimPartition> &partitions() {
+    static std::vector<SimPartition> table = [] {
+        std::vector<SimPartition> t;
+        t.push_back({{ESP_PARTITION_TYPE_DATA, esp_partition_subtype_t(0x40), 0x290000, 0x10000, "users", false}, {}});
+        t.push_back({{ESP_PARTITION_TYPE_DATA, esp_partition_subtype_t(0x41), 0x2A0000, 0x10000, "events", false}, {}});
+        for (SimPartition &p : t) p.bytes.assign(p.info.size, 0xFF);
+        return t;
+    }();
+    return table;
+}
+
+void erasePartitions() {
+    for (SimPartition &p : partitions()) std::fill(p.bytes.begin(), p.bytes.end(), 0xFF);
+}
+
+SimPartition *partitionOf(const esp_partition_t *info) {
+    for (SimPartition &p : partitions()) {
+        if (&p.info == info) return &p;
+    }
+    return nullptr;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (SimPartition &p : partitions()) {
+        if (p.info.type != type) continue;
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && p.info.subtype != subtype) continue;
+        if (label && strcmp(label, p.info.label) != 0) continue;
+        return &p.info;
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    SimPartition *p = partitionOf(partition);
+    if (!p || !dst) return ESP_ERR_INVALID_ARG;
+    if (src_offset + size > p->bytes.size()) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, &p->bytes[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    SimPartition *p = partitionOf(partition);
+    if (!p || !src) return ESP_ERR_INVALID_ARG;
+    if (dst_offset + size > p->bytes.size()) return ESP_ERR_INVALID_SIZE;
+    const uint8_t *in = static_cast<const uint8_t *>(src);
+    for (size_t i = 0; i < size; i++) p->bytes[dst_offset + i] &= in[i];
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    SimPartition *p = partitionOf(partition);
+    if (!p) return ESP_ERR_INVALID_ARG;
+    if (offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) return ESP_ERR_INVALID_ARG;
+    if (offset + size > p->bytes.size()) return ESP_ERR_INVALID_SIZE;
+    std::fill(p->bytes.begin() + offset, p->bytes.begin() + offset + size, 0xFF);
+    return ESP_OK;
+}
+
+// The mapping is the backing store itself, so it sees every write at once
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t, const void **out_ptr, spi_flash_mmap_handle_t *out_handle) {
+    SimPartition *p = partitionOf(partition);
+    if (!p || !out_ptr || !out_handle) return ESP_ERR_INVALID_ARG;
+    if (offset + size > p->bytes.size()) return ESP_ERR_INVALID_SIZE;
+    *out_ptr = &p->bytes[offset];
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t) {}
+
+// ---------------------------------------------------------------------------
+// mbedTLS SHA-256 (FIPS 180-4)
+// ---------------------------------------------------------------------------
+
+namespace {
+
+constexpr uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+void sha256Block(uint32_t state[8], const unsigned char *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 | uint32_t(block[4 * i + 2]) << 8 |
+               block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+        uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+}  // namespace
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) { memset(ctx, 0, sizeof(*ctx)); }
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) { memset(ctx, 0, sizeof(*ctx)); }
+
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224) {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    if (is224) return -1;  // Not needed here
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->total = 0;
+    ctx->is224 = 0;
+    return 0;
+}
+
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen) {
+    while (ilen--) {
+        ctx->buffer[ctx->total++ % 64] = *input++;
+        if (ctx->total % 64 == 0) sha256Block(ctx->state, ctx->buffer);
+    }
+    return 0;
+}
+
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char output[32]) {
+    uint64_t bits = ctx->total * 8;
+    unsigned char pad = 0x80;
+    mbedtls_sha256_update_ret(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->total % 64 != 56) mbedtls_sha256_update_ret(ctx, &pad, 1);
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++) length[i] = bits >> (56 - 8 * i);
+    mbedtls_sha256_update_ret(ctx, length, 8);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) output[4 * i + j] = ctx->state[i] >> (24 - 8 * j);
+    }
+    return 0;
+}
+
+int mbedtls_sha256_ret(const unsigned char *input, size_t ilen, unsigned char output[32], int is224) {
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    int err = mbedtls_sha256_starts_ret(&ctx, is224);
+    if (!err) err = mbedtls_sha256_update_ret(&ctx, input, ilen);
+    if (!err) err = mbedtls_sha256_finish_ret(&ctx, output);
+    mbedtls_sha256_free(&ctx);
+    return err;
+}
+
+esp_err_t esp_pm_configure(const void *) { return ESP_ERR_NOT_SUPPORTED; }
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t, int, const char *, esp_pm_lock_handle_t *) { return ESP_ERR_NOT_SUPPORTED; }
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t) { return ESP_ERR_INVALID_ARG; }
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t) { return ESP_ERR_INVALID_ARG; }
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return static_cast<esp_sleep_wakeup_cause_t>(wake_cause); }
+uint64_t esp_sleep_get_ext1_wakeup_status() { return 0; }
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t, int) { return ESP_OK; }
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t, esp_sleep_ext1_wakeup_mode_t) { return ESP_OK; }
+esp_err_t esp_sleep_enable_ulp_wakeup() { return ESP_OK; }
+esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t) { return ESP_OK; }
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t) { return ESP_OK; }
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t, esp_sleep_pd_option_t) { return ESP_OK; }
+esp_err_t esp_light_sleep_start() { return ESP_OK; }
+void esp_deep_sleep_start() { throw sim::DeepSleep{}; }
+
+esp_err_t gpio_set_pull_mode(gpio_num_t pin, gpio_pull_mode_t mode) {
+    pinMode(pin, mode == GPIO_PULLUP_ONLY ? INPUT_PULLUP : mode == GPIO_PULLDOWN_ONLY ? INPUT_PULLDOWN : INPUT);
+    return ESP_OK;
+}
+esp_err_t gpio_wakeup_enable(gpio_num_t, gpio_int_type_t) { return ESP_OK; }
+esp_err_t gpio_wakeup_disable(gpio_num_t) { return ESP_OK; }
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level) {
+    digitalWrite(pin, level);
+    return ESP_OK;
+}
+int gpio_get_level(gpio_num_t pin) { return digitalRead(pin); }
+esp_err_t gpio_hold_dis(gpio_num_t) { return ESP_OK; }
+
+int rtc_io_number_get(gpio_num_t pin) {
+    static const int8_t rtc_io[40] = {
+        11, -1, 12, -1, 10, -1, -1, -1, -1, -1, -1, -1, 15, 14, 16, 13, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, 6, 7, 17, -1, -1, -1, -1, 9, 8, 4, 5, 0, 1, 2, 3,
+    };
+    return pin >= 0 && pin < 40 ? rtc_io[pin] : -1;
+}
+bool rtc_gpio_is_valid_gpio(gpio_num_t pin) { return rtc_io_number_get(pin) >= 0; }
+esp_err_t rtc_gpio_init(gpio_num_t pin) { return rtc_gpio_is_valid_gpio(pin) ? ESP_OK : ESP_ERR_INVALID_ARG; }
+esp_err_t rtc_gpio_deinit(gpio_num_t pin) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_set_direction(gpio_num_t pin, rtc_gpio_mode_t) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_set_level(gpio_num_t pin, uint32_t level) { return gpio_set_level(pin, level); }
+uint32_t rtc_gpio_get_level(gpio_num_t pin) { return digitalRead(pin); }
+esp_err_t rtc_gpio_pullup_en(gpio_num_t pin) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_pullup_dis(gpio_num_t pin) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_pulldown_en(gpio_num_t pin) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_pulldown_dis(gpio_num_t pin) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_hold_en(gpio_num_t pin) { return rtc_gpio_init(pin); }
+esp_err_t rtc_gpio_hold_dis(gpio_num_t pin) { return rtc_gpio_init(pin); }
+
+// One slow clock tick per microsecond: a calibration of 1.0 in Q13.19
+uint64_t rtc_time_get() { return clock_us; }
+uint32_t esp_clk_slowclk_cal_get() { return 1UL << 19; }
+uint64_t rtc_time_slowclk_to_us(uint64_t ticks, uint32_t period) { return (ticks * period) >> 19; }
+
+esp_err_t ulp_process_macros_and_load(uint32_t, const ulp_insn_t *, size_t *) { return ESP_OK; }
+esp_err_t ulp_run(uint32_t) { return ESP_OK; }
+esp_err_t ulp_set_wakeup_period(size_t, uint32_t) { return ESP_OK; }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Controls for the host build. There is one thread and one clock; nothing
+// runs unless the sketch or the harness calls it. The loop task is the only
+// task that executes sketch code: whenever it would block (an empty queue
+// wait, a full queue, vTaskDelay(), delay()), the HAL calls back into the
+// harness, which plays the fingerprint, keypad and display tasks
+// and the person at the door.
+namespace sim {
+
+struct DeepSleep {};  // Thrown by esp_deep_sleep_start(); the harness reboots
+struct Stalled {};    // A wait with no timeout and no hook to end it
+
+struct Hooks {
+    void (*service)() = nullptr;          // Drain the other tasks' queues; must not let time pass
+    void (*wait)(uint32_t ms) = nullptr;  // Let up to ms pass (portMAX_DELAY: no limit), or post input sooner
+};
+extern Hooks hooks;
+
+// Microseconds since power-up. This is the RTC clock; esp_timer and millis()
+// count from the last boot.
+uint64_t now();
+void advance(uint64_t us);
+void advanceTo(uint64_t us);
+uint64_t nextTimerDue();  // Earliest armed esp_timer; UINT64_MAX when none
+
+// Boot again at time at (no earlier than now) as after a deep-sleep wake;
+// cause is an esp_sleep_wakeup_cause_t. Queues, tasks and esp_timers are
+// freed, and nothing fires in between. RTC memory is the caller's business.
+void reboot(int cause, uint64_t at);
+// Back to time zero with flash and the legacy EEPROM erased
+void powerOn();
+
+void *currentTask();
+void setCurrentTask(void *task);
+
+uint8_t pinLevel(uint8_t pin);
+void setPinLevel(uint8_t pin, uint8_t level);  // Drive an input from outside
+uint32_t ledcDuty(uint8_t channel);            // 0 = silent
+double ledcFrequency(uint8_t channel);
+
+}  // namespace sim
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+// Register layout of the GPIO block, so code poking it directly compiles
+// and runs against plain memory
+typedef union {
+    struct { uint32_t data : 8; uint32_t reserved8 : 24; };
+    uint32_t val;
+} gpio_hi_reg_t;
+
+typedef struct {
+    uint32_t bt_select;
+    uint32_t out;
+    uint32_t out_w1ts;
+    uint32_t out_w1tc;
+    gpio_hi_reg_t out1;
+    gpio_hi_reg_t out1_w1ts;
+    gpio_hi_reg_t out1_w1tc;
+    uint32_t sdio_select;
+    uint32_t enable;
+    uint32_t enable_w1ts;
+    uint32_t enable_w1tc;
+    gpio_hi_reg_t enable1;
+    gpio_hi_reg_t enable1_w1ts;
+    gpio_hi_reg_t enable1_w1tc;
+    uint32_t strap;
+    uint32_t in;
+    gpio_hi_reg_t in1;
+    uint32_t status;
+    uint32_t status_w1ts;
+    uint32_t status_w1tc;
+    union {
+        struct {
+            uint32_t reserved0 : 2;
+            uint32_t pad_driver : 1;
+            uint32_t reserved3 : 4;
+            uint32_t int_type : 3;
+            uint32_t wakeup_enable : 1;
+            uint32_t config : 2;
+            uint32_t int_ena : 5;
+            uint32_t reserved18 : 14;
+        };
+        uint32_t val;
+    } pin[40];
+} gpio_dev_t;
+
+extern volatile gpio_dev_t GPIO;
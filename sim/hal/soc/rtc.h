@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// The simulated slow clock ticks once per microsecond of sim::now()
+uint64_t rtc_time_get(void);
+uint64_t rtc_time_slowclk_to_us(uint64_t rtc_time, uint32_t period);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// Registers are words in a host array (see hal.cpp) instead of peripheral addresses
+extern volatile uint32_t sim_rtc_cntl[64];
+
+#define RTC_CNTL_STATE0_REG (&sim_rtc_cntl[6])
+#define RTC_CNTL_LOW_POWER_ST_REG (&sim_rtc_cntl[48])
+#define RTC_CNTL_RDY_FOR_WAKEUP_S 19
+#define RTC_CNTL_ULP_CP_SLP_TIMER_EN (1u << 24)
+
+#define REG_READ(reg) (*(volatile uint32_t *)(reg))
+#define REG_WRITE(reg, val) (*(volatile uint32_t *)(reg) = (val))
+#define SET_PERI_REG_MASK(reg, mask) (*(volatile uint32_t *)(reg) |= (mask))
+#define CLEAR_PERI_REG_MASK(reg, mask) (*(volatile uint32_t *)(reg) &= ~(mask))
@@ -0,0 +1,9 @@
+#pragma once
+
+// Only used as operands of ULP instructions, which the host never executes
+#define RTC_GPIO_OUT_W1TS_REG 0x3ff48404
+#define RTC_GPIO_OUT_W1TC_REG 0x3ff48408
+#define RTC_GPIO_OUT_DATA_W1TS_S 14
+#define RTC_GPIO_OUT_DATA_W1TC_S 14
+#define RTC_GPIO_IN_REG 0x3ff48424
+#define RTC_GPIO_IN_NEXT_S 14
@@ -0,0 +1,950 @@
+// Host simulation of the locker. The sketch is compiled unchanged against the
+// stand-in core in sim/hal and driven from a timeline of keypresses, finger
+// touches and console lines on a simulated clock, so the auth state machine
+// runs at host speed with no board attached.
+//
+// Only the loop task executes as written, along with the esp_timer callbacks
+// behind the relay and the buzzer. The other tasks are stood in for at their
+// queue interfaces: display commands are rendered into the LCD model,
+// fingerprint commands go to the sketch's own handler, and finger touches feed
+// the match pipeline callback the way the UART replies would.
+//
+//   pio run -e native-sim
+//   .pio/build/native-sim/program                         scenarios, then a short fuzz
+//   .pio/build/native-sim/program scenarios [-v]
+//   .pio/build/native-sim/program fuzz [events] [seed] [2fa] [-v]
+//
+// -v echoes the sketch's serial output. The exit status is non-zero when a
+// scenario fails or the fuzzer breaks an invariant.
+
+#include "../ESP32-Fingerprint-Keypad-Locker.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace {
+
+using HostClock = std::chrono::steady_clock;
+
+uint64_t hostNs(HostClock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(HostClock::now() - since).count();
+}
+
+constexpr uint64_t MS = 1000;                       // sim::now() runs in µs
+constexpr uint64_t SENSOR_MATCH_US = 250 * MS;      // Touch to search reply, roughly what the sensor takes
+constexpr uint64_t RELAY_SLACK_US = 5 * MS;
+constexpr uint16_t STRANGER = 150;                  // A page nobody is enrolled on
+
+// ---------------------------------------------------------------------------
+// Timeline
+// ---------------------------------------------------------------------------
+
+struct Stimulus {
+    enum Type : uint8_t {
+        KEY,
+        TOUCH,         // A finger lands on the sensor
+        SEARCH_DONE,   // The sensor answers the extract and search for that touch
+        CONSOLE,       // A line typed on the serial console
+        END            // Stop driving once the loop is idle here
+    };
+    Type type;
+    uint64_t at;       // sim::now()
+    char key;
+    uint16_t page;     // TOUCH, SEARCH_DONE: whose finger
+    std::string line;
+};
+
+std::deque<Stimulus> timeline;   // Ordered by time
+bool (*refill)() = nullptr;      // Called when the timeline runs dry; false = no more
+
+void schedule(const Stimulus &s) {
+    auto it = timeline.end();
+    while (it != timeline.begin() && (it - 1)->at > s.at) --it;
+    timeline.insert(it, s);
+}
+
+bool nextStimulus(Stimulus *&next) {
+    if (timeline.empty() && !(refill && refill())) return false;
+    next = &timeline.front();
+    return true;
+}
+
+// Builds a script from the current time on
+struct Script {
+    uint64_t t = sim::now();
+
+    Script &after(uint32_t ms) {
+        t += ms * MS;
+        return *this;
+    }
+    Script &keys(const char *text, uint32_t gapMs = 150) {
+        for (; *text; text++) {
+            schedule({Stimulus::KEY, t, *text, 0, ""});
+            t += gapMs * MS;
+        }
+        return *this;
+    }
+    Script &touch(uint16_t page) {
+        schedule({Stimulus::TOUCH, t, 0, page, ""});
+        t += 1000 * MS;
+        return *this;
+    }
+    Script &console(const char *line) {
+        schedule({Stimulus::CONSOLE, t, 0, 0, std::string(line) + "\n"});
+        t += 100 * MS;
+        return *this;
+    }
+    void end(uint32_t settleMs = 5000) { schedule({Stimulus::END, t + settleMs * MS, 0, 0, ""}); }
+};
+
+struct Finished {};
+
+// ---------------------------------------------------------------------------
+// Invariants
+// ---------------------------------------------------------------------------
+
+// The credentials delivered since the last unlock. A model of the rules, not of
+// the code: PIN digits count in groups of PIN_LENGTH, '*' and '#' start over,
+// keys typed during a PIN lockout or into a menu are ignored. Only the
+// harness knows the PIN in the clear; scenarios that change it update pin,
+// and those that add users list their PINs in others.
+struct Oracle {
+    std::string pin = Config::DEFAULT_PIN;
+    std::vector<std::string> others;
+    std::string digits;
+    bool pinSeen = false;
+    bool fpSeen = false;
+
+    void key(char k) {
+        if (auth.is_pin_locked_out && lockoutRemaining(auth.pin_lockout_start) > 0) return;
+        if (menu_active) {
+            digits.clear();
+            return;
+        }
+        if (k < '0' || k > '9') {
+            digits.clear();
+            return;
+        }
+        digits += k;
+        if (digits.size() < Config::PIN_LENGTH) return;
+        if (digits == pin || std::find(others.begin(), others.end(), digits) != others.end()) pinSeen = true;
+        digits.clear();
+    }
+
+    bool unlockAllowed() const {
+        return getAuthMode() == Config::TWO_FACTOR ? pinSeen && fpSeen : pinSeen || fpSeen;
+    }
+
+    // No factor carries over a deep sleep, and nothing half-typed does either
+    void slept() {
+        digits.clear();
+        pinSeen = fpSeen = false;
+    }
+};
+
+struct Stats {
+    uint64_t stimuli = 0;
+    uint32_t unlocks = 0;
+    uint32_t sleeps = 0;
+    uint32_t renders = 0;
+    uint64_t lcdWritesAtStart = 0;
+    LatencyHistogram handle;   // ns from posting an input to the loop task idling again
+    LatencyHistogram render;   // ns per display command
+};
+
+Oracle oracle;
+Stats stats;
+bool verbose = false;
+bool failed = false;
+std::deque<std::string> history;  // Recent stimuli, for a failure report
+
+void fail(const char *what) {
+    failed = true;
+    printf("\nINVARIANT BROKEN at %.3f s: %s\n", sim::now() / 1e6, what);
+    printf("  mode %s, pin strikes %d%s, fp strikes %d%s, fp mode %s\n",
+           getAuthMode() == Config::TWO_FACTOR ? "2fa" : "single", auth.wrong_pin_attempts,
+           auth.is_pin_locked_out ? " (locked)" : "", auth.wrong_fp_attempts,
+           auth.is_fp_locked_out ? " (locked)" : "", fp_mode == FingerprintCommand::MATCH ? "match" : "detect");
+    printf("  last stimuli:\n");
+    for (const std::string &h : history) printf("    %s\n", h.c_str());
+    throw Finished{};
+}
+
+void note(const Stimulus &s) {
+    char line[64];
+    switch (s.type) {
+        case Stimulus::KEY: snprintf(line, sizeof(line), "%10.3f key %c", s.at / 1e6, s.key); break;
+        case Stimulus::TOUCH: snprintf(line, sizeof(line), "%10.3f touch #%u", s.at / 1e6, s.page); break;
+        case Stimulus::SEARCH_DONE: snprintf(line, sizeof(line), "%10.3f search #%u", s.at / 1e6, s.page); break;
+        case Stimulus::CONSOLE: snprintf(line, sizeof(line), "%10.3f console %.40s", s.at / 1e6, s.line.c_str()); break;
+        case Stimulus::END: return;
+    }
+    history.push_back(line);
+    if (history.size() > 24) history.pop_front();
+}
+
+// ---------------------------------------------------------------------------
+// Stand-ins for the other tasks
+// ---------------------------------------------------------------------------
+
+bool relay_open = false;
+uint64_t relay_since = 0;      // Latest grant; each one restarts the window
+uint32_t relay_grants = 0;     // Grants already checked against the oracle
+bool sensor_busy = false;      // A touch is waiting for its search reply
+bool in_fp_command = false;    // The fingerprint handler is running (and lets time pass)
+uint64_t service_ns = 0;       // Host time spent in stand-ins, kept out of the handler figures
+
+struct TaskScope {
+    void *caller;
+    explicit TaskScope(void *task) : caller(sim::currentTask()) { sim::setCurrentTask(task); }
+    ~TaskScope() { sim::setCurrentTask(caller); }
+};
+
+void serviceTasks() {
+    if (!display_queue) return;  // Between a reboot and setup()
+    HostClock::time_point start = HostClock::now();
+
+    DisplayCommand display;
+    while (xQueueReceive(display_queue, &display, 0) == pdTRUE) {
+        HostClock::time_point begin = HostClock::now();
+        renderDisplayCommand(display);
+        stats.render.record(hostNs(begin));
+        stats.renders++;
+    }
+
+    // The loop task grants the relay itself; check each grant since the last pass
+    for (; relay_grants < relay.grants(); relay_grants++) {
+        if (!oracle.unlockAllowed()) fail("unlocked without the credentials the auth mode asks for");
+        oracle.pinSeen = oracle.fpSeen = false;
+        stats.unlocks++;
+        relay_open = true;
+        relay_since = sim::now();
+    }
+    if (relay_open) {
+        if (sim::pinLevel(PinConfig::RELAY) == HIGH) {
+            relay_open = false;
+        } else if (sim::now() - relay_since > Config::UNLOCK_TIME * MS + RELAY_SLACK_US) {
+            fail("relay still energised after the unlock time");
+        }
+    }
+
+    // Enroll and delete wait on the sensor, which calls back in here through delay()
+    if (!in_fp_command) {
+        in_fp_command = true;
+        TaskScope scope(fingerprint_task);
+        FingerprintCommand command;
+        while (xQueueReceive(fp_command_queue, &command, 0) == pdTRUE) runFingerprintCommand(command);
+        in_fp_command = false;
+        if (auth.is_fp_locked_out && fp_mode != FingerprintCommand::DETECT_ONLY) {
+            fail("sensor still matching during a fingerprint lockout");
+        }
+    }
+    service_ns += hostNs(start);
+}
+
+bool inRange(uint16_t page, uint16_t start, uint16_t count) {
+    return page >= start && page - start < count;
+}
+
+// What the fingerprint task does on a touch edge: the capture reply goes to the
+// pipeline callback, which says whether to go on and extract
+void fingerTouched(uint16_t page) {
+    if (sensor_busy) return;
+    TaskScope scope(fingerprint_task);
+    fp_await_lift = false;  // The touch line dropped since the last finger
+    xQueuePeek(fp_plan_queue, &fp_plan, 0);
+    finger.presented = page;
+    if (onFingerprintStage({FingerprintLink::CAPTURE, FINGERPRINT_OK, 0, 0})) {
+        sensor_busy = true;
+        schedule({Stimulus::SEARCH_DONE, sim::now() + SENSOR_MATCH_US, 0, page, ""});
+    }
+}
+
+// Extract and search replies. A miss in the first range makes the callback ask
+// the link for the second, and a smeared image for another capture; the sim
+// answers both itself instead of the UART.
+void searchDone(uint16_t page) {
+    TaskScope scope(fingerprint_task);
+    sensor_busy = false;
+    uint8_t image = finger.smudged ? FINGERPRINT_IMAGEMESS : FINGERPRINT_OK;
+    if (finger.smudged) finger.smudged--;
+    if (!onFingerprintStage({FingerprintLink::EXTRACT, image, 0, 0})) {
+        if (!fp_link.busy()) return;
+        fp_link.begin(fingerprintSerial, onFingerprintStage, Config::FP_REPLY_TIMEOUT);
+        if (onFingerprintStage({FingerprintLink::CAPTURE, FINGERPRINT_OK, 0, 0})) {
+            sensor_busy = true;
+            schedule({Stimulus::SEARCH_DONE, sim::now() + SENSOR_MATCH_US, 0, page, ""});
+        }
+        return;
+    }
+
+    FingerprintIndex::Plan plan = fp_plan;
+    bool enrolled = finger.library.count(page) > 0;
+    bool found = enrolled && inRange(page, plan.firstStart, plan.firstCount);
+    onFingerprintStage({FingerprintLink::SEARCH, found ? (uint8_t)FINGERPRINT_OK : (uint8_t)FINGERPRINT_NOTFOUND,
+                        page, 200});
+    if (fp_link.busy()) {
+        fp_link.begin(fingerprintSerial, onFingerprintStage, Config::FP_REPLY_TIMEOUT);
+        found = enrolled && inRange(page, plan.secondStart, plan.secondCount);
+        onFingerprintStage({FingerprintLink::SEARCH, found ? (uint8_t)FINGERPRINT_OK : (uint8_t)FINGERPRINT_NOTFOUND,
+                            page, 200});
+    }
+    if (found) oracle.fpSeen = true;
+}
+
+// ---------------------------------------------------------------------------
+// Driving the loop task
+// ---------------------------------------------------------------------------
+
+bool handling = false;
+HostClock::time_point handle_start;
+uint64_t handle_service_ns = 0;
+
+void deliver(const Stimulus &s) {
+    note(s);
+    stats.stimuli++;
+    switch (s.type) {
+        case Stimulus::KEY: {
+            oracle.key(s.key);
+            InputEvent event = {};
+            event.type = InputEvent::KEY;
+            event.key = s.key;
+            postInput(event);
+            break;
+        }
+        case Stimulus::TOUCH:
+            fingerTouched(s.page);
+            break;
+        case Stimulus::SEARCH_DONE:
+            searchDone(s.page);
+            break;
+        case Stimulus::CONSOLE:
+            Serial.feed(s.line.c_str());
+            break;
+        case Stimulus::END:
+            throw Finished{};
+    }
+}
+
+// The loop task would block for up to ms: let the other tasks run and time
+// pass until the next stimulus, the next esp_timer callback or the timeout
+void waitForStimulus(uint32_t ms) {
+    if (handling) {
+        stats.handle.record(hostNs(handle_start) - (service_ns - handle_service_ns));
+        handling = false;
+    }
+    uint64_t deadline = ms == portMAX_DELAY ? UINT64_MAX : sim::now() + ms * MS;
+    for (;;) {
+        serviceTasks();
+        if (uxQueueMessagesWaiting(input_queue)) break;  // A stand-in reported something
+
+        Stimulus *next = nullptr;
+        uint64_t due = nextStimulus(next) ? next->at : UINT64_MAX;
+        uint64_t step = std::min({due, deadline, sim::nextTimerDue()});
+        if (step == UINT64_MAX) throw Finished{};
+
+        sim::advanceTo(step);
+        if (step == due) {
+            Stimulus s = *next;
+            timeline.pop_front();
+            deliver(s);
+            if (uxQueueMessagesWaiting(input_queue) || s.type == Stimulus::CONSOLE) break;
+        } else if (step == deadline) {
+            serviceTasks();
+            return;
+        }
+    }
+    handling = true;
+    handle_start = HostClock::now();
+    handle_service_ns = service_ns;
+}
+
+// Globals a reset clears that the loop task's behaviour depends on. RTC
+// memory (auth, warm_boot, lcd_glyphs) is left alone. setFingerprintMode()
+// keeps its function-local copy of the last mode sent, so fp_mode is kept too
+// to stay consistent with it.
+void resetVolatileState() {
+    input_queue = display_queue = fp_command_queue = fp_plan_queue = nullptr;
+    scheduler = EventScheduler<12>();
+    ready_screen_timer = pin_lockout_timer = fp_lockout_timer = sleep_timer = NO_TIMER;
+    relay = RelayController();
+    tones = ToneSequencer();
+    settings = PersistentBlock<Settings>();
+    users = Users();
+    access_log = EventLog();
+    log_export_next = log_export_end = 0;
+    fp_index = PersistentBlock<FingerprintIndex>();
+    fp_stats = PersistentBlock<FingerprintStats>();
+    fp_retries = 0;
+    console = SerialConsole();
+    for (LatencyHistogram &h : perf) h.reset();
+    pin_entry.clear();
+    star_count = hash_count = 0;
+    last_activity = 0;
+    ready_screen_active = false;
+    backlight_on = true;
+    menu_active = false;
+    menu_state = MENU_CLOSED;
+    menu_timer = NO_TIMER;
+    menu_input_length = 0;
+    serial_transfer = false;
+    wake_key_count = 0;
+    wake_key_held = 0;
+    fp_await_lift = false;
+    fp_next_capture = 0;
+    fp_touch_us = 0;
+    fp_capacity = 0xA3;
+    fp_packet_len = 128;
+    relay_open = false;
+    relay_grants = 0;
+    sensor_busy = false;
+    for (auto it = timeline.begin(); it != timeline.end();) {
+        it = it->type == Stimulus::SEARCH_DONE ? timeline.erase(it) : it + 1;
+    }
+}
+
+// Sleep until whatever comes next on the timeline wakes the chip. A console
+// line can't (the UART is off), so it is lost.
+bool wakeFromDeepSleep() {
+    stats.sleeps++;
+    oracle.slept();
+    resetVolatileState();
+    Stimulus *next = nullptr;
+    while (nextStimulus(next) && next->type == Stimulus::CONSOLE) timeline.pop_front();
+    if (!next || next->type == Stimulus::END) return false;
+    int cause = next->type == Stimulus::KEY ? ESP_SLEEP_WAKEUP_ULP : ESP_SLEEP_WAKEUP_EXT0;
+    sim::reboot(cause, next->at);
+    setup();
+    return true;
+}
+
+void drive() {
+    for (;;) {
+        try {
+            loop();
+        } catch (const Finished &) {
+            handling = false;
+            return;
+        } catch (const sim::DeepSleep &) {
+            if (!wakeFromDeepSleep()) return;
+        }
+    }
+}
+
+// Power-up with a library of enrolled pages and optionally 2FA already stored.
+// flashed, if given, writes whatever an older firmware left in flash.
+void boot(std::initializer_list<uint16_t> enrolled, bool twoFactor = false, void (*flashed)() = nullptr) {
+    sim::powerOn();
+    resetVolatileState();
+    timeline.clear();
+    history.clear();
+    refill = nullptr;
+    auth = AuthState();
+    warm_boot = {};
+    lcd_glyphs = {};
+    fp_mode = FingerprintCommand::MATCH;
+    lcd = LCD_I2C(PinConfig::I2C_ADDR, Board::LCD_COLS, Board::LCD_ROWS);
+    finger = Adafruit_Fingerprint(&fingerprintSerial);
+    for (uint16_t page : enrolled) finger.library.insert(page);
+    oracle = Oracle();
+    stats = Stats();
+    Serial.clearInput();
+    Serial.output.clear();
+    Serial.echo = verbose;
+    Serial.capture = false;
+    sim::hooks.service = serviceTasks;
+    sim::hooks.wait = waitForStimulus;
+
+    if (flashed) flashed();
+    if (twoFactor) {
+        // As if set from the console on an earlier run
+        loadSettings();
+        setAuthMode(Config::TWO_FACTOR);
+        settings.flush();
+        settings = PersistentBlock<Settings>();
+        users = Users();
+    }
+    setup();
+    stats.lcdWritesAtStart = lcd.writes;
+}
+
+// ---------------------------------------------------------------------------
+// Scenarios
+// ---------------------------------------------------------------------------
+
+int checks_failed = 0;
+
+void expect(bool ok, const char *what) {
+    if (ok) return;
+    checks_failed++;
+    printf("    FAILED: %s\n", what);
+}
+
+bool lcdShows(uint8_t row, const char *text) {
+    return lcd.text(row).find(text) != std::string::npos;
+}
+
+void scenarioPinUnlocks() {
+    boot({1});
+    Script().after(500).keys("123456").end(100);
+    drive();
+    expect(stats.unlocks == 1, "correct PIN unlocks");
+    expect(sim::pinLevel(PinConfig::RELAY) == LOW, "relay energised straight away");
+    expect(lcdShows(1, "Granted"), "LCD says access granted");
+
+    Script().end(Config::UNLOCK_TIME + 100);
+    drive();
+    expect(sim::pinLevel(PinConfig::RELAY) == HIGH, "relay released after the unlock time");
+}
+
+// A second grant while open restarts the window instead of being dropped
+void scenarioRelayExtends() {
+    boot({1});
+    Script().after(500).keys("123456").after(2000).keys("123456").end(100);
+    drive();
+    expect(stats.unlocks == 2, "both PINs granted");
+    uint64_t second = relay_since;
+
+    Script().end(Config::UNLOCK_TIME - 500);
+    drive();
+    expect(sim::pinLevel(PinConfig::RELAY) == LOW, "still open past the first window");
+
+    Script().end(300);
+    drive();
+    expect(sim::pinLevel(PinConfig::RELAY) == HIGH, "relocked one window after the second grant");
+    expect(sim::now() - second >= Config::UNLOCK_TIME * MS, "window measured from the second grant");
+    expect(ready_screen_active, "back on the ready screen");
+}
+
+// The error tone plays on its own timer while the keypad keeps working
+void scenarioBuzzer() {
+    boot({1});
+    Script().after(500).keys("00000").keys("0", 0).end(50);
+    drive();
+    expect(sim::ledcDuty(PinConfig::BUZZER_CHANNEL) > 0, "error tone sounding");
+    expect(sim::ledcFrequency(PinConfig::BUZZER_CHANNEL) == 400, "first step of the error tone");
+
+    Script().after(100).keys("12345").keys("6", 0).end(50);
+    drive();
+    expect(stats.unlocks == 1, "PIN typed over the tone unlocks");
+
+    Script().end(1000);
+    drive();
+    expect(!tones.playing() && sim::ledcDuty(PinConfig::BUZZER_CHANNEL) == 0, "buzzer silent afterwards");
+}
+
+void scenarioPinLockout() {
+    boot({1});
+    Script().after(500).keys("000000000000000000000000000000").after(500).keys("123456").end(100);
+    drive();
+    expect(auth.is_pin_locked_out, "five wrong PINs lock the keypad");
+    expect(stats.unlocks == 0, "correct PIN ignored during the lockout");
+
+    // Long enough to sleep; the lockout runs on the RTC clock through it
+    Script().after(20000).keys("123456").end(100);
+    drive();
+    expect(stats.sleeps == 1, "deep sleep while locked out");
+    expect(stats.unlocks == 0, "lockout survives deep sleep");
+
+    Script().after(15000).keys("123456").end(100);
+    drive();
+    expect(!auth.is_pin_locked_out, "lockout over after 30 s");
+    expect(stats.unlocks == 1, "correct PIN unlocks after the lockout");
+}
+
+// Wrong PINs at the menu prompts are strikes like any other
+void scenarioMenuPinLockout() {
+    boot({1});
+    Script script;
+    script.after(500);
+    for (int i = 0; i < 3; i++) script.keys("############").keys("000000#").after(500);
+    for (int i = 0; i < 2; i++) script.keys("************").keys("000000#").after(500);
+    script.end(100);
+    drive();
+    expect(auth.is_pin_locked_out, "five wrong menu PINs lock the keypad");
+    expect(!menu_active, "menu closed after the last wrong PIN");
+
+    Script().keys("############").after(500).keys("123456").end(100);
+    drive();
+    expect(!menu_active, "admin prompt refused during the lockout");
+    expect(stats.unlocks == 0, "correct PIN ignored during the lockout");
+}
+
+void scenarioTwoFactor() {
+    boot({1, 2}, true);
+    Script().after(500).touch(1).end(100);
+    drive();
+    expect(stats.unlocks == 0, "finger alone does not unlock");
+    expect(auth.fingerprint_verified, "finger recorded as the first factor");
+
+    Script().keys("123456").end(100);
+    drive();
+    expect(stats.unlocks == 1, "finger then PIN unlocks");
+
+    Script().after(4000).keys("123456").touch(2).end(100);
+    drive();
+    expect(stats.unlocks == 2, "PIN then finger unlocks");
+}
+
+void scenarioFingerprintLockout() {
+    boot({1});
+    Script s;
+    s.after(500);
+    for (int i = 0; i < Config::MAX_WRONG_ATTEMPTS; i++) s.touch(STRANGER).after(1000);
+    s.touch(1).end(100);
+    drive();
+    expect(auth.is_fp_locked_out, "five unknown fingers lock the sensor");
+    expect(fp_mode == FingerprintCommand::DETECT_ONLY, "sensor stops matching while locked out");
+    expect(stats.unlocks == 0, "enrolled finger ignored during the lockout");
+
+    Script().after(Config::LOCKOUT_TIME).touch(1).end(100);
+    drive();
+    expect(fp_mode == FingerprintCommand::MATCH, "matching resumes after the lockout");
+    expect(stats.unlocks == 1, "enrolled finger unlocks after the lockout");
+}
+
+void scenarioFactorDroppedOnSleep() {
+    boot({1}, true);
+    Script().after(500).touch(1).after(20000).keys("123456").end(100);
+    drive();
+    expect(stats.sleeps == 1, "slept between the factors");
+    expect(stats.unlocks == 0, "a finger from before the sleep does not count");
+
+    Script().touch(1).end(100);
+    drive();
+    expect(stats.unlocks == 1, "PIN then a fresh finger unlocks");
+}
+
+void scenarioConsole() {
+    boot({1});
+    Serial.capture = true;
+    Script().after(500).console("set-mode 2fa").end(100);
+    drive();
+    expect(Serial.output.find("ERR login required") != std::string::npos, "privileged command refused");
+    expect(getAuthMode() == Config::SINGLE_FACTOR, "mode unchanged");
+
+    Serial.output.clear();
+    Script().console("perf reset").end(100);
+    drive();
+    expect(Serial.output.find("ERR login required") != std::string::npos, "perf reset refused without a login");
+
+    Script().console("login 000000").console("login 111111").console("login 222222").console("login 123456").end(100);
+    drive();
+    expect(Serial.output.find("ERR locked out") != std::string::npos, "bad logins lock the console");
+
+    // The UART sleeps with the chip, so wake it from the keypad first
+    Script().after(Config::LOCKOUT_TIME).keys("*").after(500).console("login 123456").console("set-mode 2fa").end(100);
+    drive();
+    expect(getAuthMode() == Config::TWO_FACTOR, "mode set after logging in");
+}
+
+void scenarioEnrollFromMenu() {
+    boot({1});
+    finger.fingerOn = true;   // Left on the glass through both captures
+    Script().after(500).keys("############").keys("123456#").keys("11").keys("7#").keys("#").end(10000);
+    drive();
+    finger.fingerOn = false;
+    expect(finger.library.count(7) == 1, "template stored on page 7");
+    expect(users.owner(7) == 1, "template given to the admin at the keypad");
+    expect(fp_index.data.isEnrolled(7), "template index knows page 7");
+    expect(!menu_active, "menu closed after enrolling");
+
+    Script().after(3000).touch(7).end(100);
+    drive();
+    expect(stats.unlocks == 1, "new finger unlocks");
+
+    Script().after(3000).keys("############").keys("123456#").keys("12").keys("65543#").end(100);
+    drive();
+    expect(finger.library.count(7) == 1, "a delete ID past the library does not wrap round to page 7");
+    expect(lcdShows(0, "Invalid ID!"), "LCD says the ID is invalid");
+}
+
+// A menu left open gives up on its own, and the lock then sleeps as usual
+void scenarioMenuTimesOut() {
+    boot({1});
+    Script().after(500).keys("############").keys("123456#").end(100);
+    drive();
+    expect(menu_active && lcdShows(0, "Menu:"), "admin menu open");
+
+    Script().end(Config::MENU_IDLE_TIMEOUT - 1000);
+    drive();
+    expect(menu_active && stats.sleeps == 0, "still open and awake before the timeout");
+
+    Script().end(1100);
+    drive();
+    expect(!menu_active && lcdShows(0, "Menu Closed"), "menu closed by the idle timeout");
+
+    Script().after(Config::INACTIVITY_TIME + 7000).keys("*").end(100);
+    drive();
+    expect(stats.sleeps == 1, "sleeps once the menu is gone");
+}
+
+void scenarioPinChange() {
+    boot({1});
+    Script().after(500).keys("************").keys("123456#").keys("246810#").keys("246810#").end(100);
+    drive();
+    expect(lcdShows(0, "PIN Updated"), "menu reports the new PIN");
+
+    oracle.pin = "246810";
+    Script().after(3000).keys("123456").after(2500).keys("246810").end(100);
+    drive();
+    expect(auth.wrong_pin_attempts == 0, "new PIN clears the strike from the old one");
+    expect(stats.unlocks == 1, "only the new PIN unlocks");
+}
+
+// In 2FA each user's PIN pairs only with their own fingers, and a disabled
+// user gets nowhere with either
+void scenarioUsers() {
+    boot({1, 2, 3}, true);
+    Serial.capture = true;
+    Script().after(500).console("login 123456").console("user-add 424242").console("bind 2 2")
+        .console("user-add 515151").console("bind 3 3").console("user-enable 3 off").end(100);
+    drive();
+    expect(Serial.output.find("OK id 2") != std::string::npos, "second user added");
+    expect(users.owner(1) == 1 && users.owner(2) == 2 && users.owner(3) == 3, "templates bound");
+    expect(users.user(3) && !users.user(3)->enabled, "third user disabled");
+    oracle.others = {"424242", "515151"};
+
+    Script().keys("424242").touch(1).end(100);
+    drive();
+    expect(stats.unlocks == 0 && auth.wrong_fp_attempts == 1, "another user's finger refused after a PIN");
+
+    Script().touch(2).end(100);
+    drive();
+    expect(stats.unlocks == 1, "the PIN owner's finger unlocks");
+
+    Script().after(4000).touch(2).keys("123456").end(100);
+    drive();
+    expect(stats.unlocks == 1 && auth.wrong_pin_attempts == 1, "another user's PIN refused after a finger");
+
+    Script().after(2500).keys("424242").end(100);
+    drive();
+    expect(stats.unlocks == 2, "the finger owner's PIN unlocks");
+
+    Script().after(4000).touch(3).after(1500).keys("515151").end(100);
+    drive();
+    expect(stats.unlocks == 2 && auth.wrong_pin_attempts == 1, "disabled user refused");
+}
+
+bool serialShows(const char *text) {
+    return Serial.output.find(text) != std::string::npos;
+}
+
+// Events stay in RAM through the unlock, reach flash before the lock sleeps,
+// and come back out of the console after the wake
+void scenarioAccessLog() {
+    boot({1});
+    Serial.capture = true;
+    Script().after(500).keys("000000").after(2500).keys("123456").after(3500).touch(1).after(3500)
+        .touch(STRANGER).end(100);
+    drive();
+    expect(access_log.unwritten() == 5 && access_log.pageWrites() == 0, "no flash write on the access path");
+
+    Script().after(20000).keys("*").after(500).console("login 123456").console("log").end(2000);
+    drive();
+    expect(stats.sleeps == 1 && access_log.newest() == 6 && access_log.unwritten() == 1,
+           "written before sleeping and found again after the wake");
+    expect(serialShows(" boot 0 0 0\n") && serialShows(" pin-denied 0 0 0\n"), "boot and wrong PIN exported");
+    expect(serialShows(" granted 1 0 0\n") && serialShows(" granted 1 1 200\n"), "PIN and finger grants exported");
+    expect(serialShows(" finger-denied 0 0 0\n") && serialShows(" console-login 1 0 0\n"), "denial and login exported");
+    expect(serialShows("\nend"), "export finished");
+}
+
+// A smeared image is taken again without a word; only a touch that never
+// gives a clean one costs a message, and never a strike
+void scenarioCaptureRetry() {
+    boot({1});
+    Serial.capture = true;
+    finger.smudged = 2;
+    Script().after(500).touch(1).end(100);
+    drive();
+    expect(stats.unlocks == 1 && fp_stats.data.retries == 2, "unlocked after two silent re-captures");
+    expect(!lcdShows(0, "Image Error"), "no image error shown");
+
+    finger.smudged = 3;
+    Script().after(4000).touch(1).end(100);
+    drive();
+    expect(stats.unlocks == 1 && lcdShows(0, "Image Error"), "a touch that stays smeared is reported");
+    expect(auth.wrong_fp_attempts == 0 && fp_stats.data.imageErrors == 1, "and costs no attempt");
+
+    Script().after(2000).touch(1).console("login 123456").console("fpstats").end(100);
+    drive();
+    expect(fp_stats.data.touches == 3 && fp_stats.data.bands[4] == 2, "touches and confidences counted");
+    expect(serialShows("\n    1       2    200  200     200\n"), "per-user confidence reported");
+}
+
+bool flashHolds(const char *text) {
+    std::string needle(text);
+    for (const auto &ns : Preferences::flash()) {
+        for (const auto &key : ns.second) {
+            if (std::search(key.second.begin(), key.second.end(), needle.begin(), needle.end()) != key.second.end()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// A lock upgraded from the EEPROM layout keeps its PIN, hashed, and the clear
+// copy is gone
+void scenarioPinMigratesFromEeprom() {
+    boot({1}, false, [] {
+        const char legacy[] = "654321";
+        for (uint8_t i = 0; i < 6; i++) EEPROM.write(i, legacy[i]);
+        EEPROM.write(Config::AUTH_MODE_ADDR, Config::SINGLE_FACTOR);
+    });
+    oracle.pin = "654321";
+    expect(!flashHolds("654321"), "no clear PIN in NVS");
+    expect(EEPROM.read(0) == 0xFF, "legacy EEPROM wiped");
+
+    Script().after(500).keys("654321").end(100);
+    drive();
+    expect(stats.unlocks == 1, "migrated PIN unlocks");
+}
+
+struct Scenario {
+    const char *name;
+    void (*run)();
+};
+
+const Scenario scenarios[] = {
+    {"pin-unlocks", scenarioPinUnlocks},
+    {"relay-extends", scenarioRelayExtends},
+    {"buzzer", scenarioBuzzer},
+    {"pin-lockout", scenarioPinLockout},
+    {"menu-pin-lockout", scenarioMenuPinLockout},
+    {"pin-change", scenarioPinChange},
+    {"menu-times-out", scenarioMenuTimesOut},
+    {"pin-migrates-from-eeprom", scenarioPinMigratesFromEeprom},
+    {"two-factor", scenarioTwoFactor},
+    {"fp-lockout", scenarioFingerprintLockout},
+    {"2fa-factor-dropped-on-sleep", scenarioFactorDroppedOnSleep},
+    {"console", scenarioConsole},
+    {"enroll-from-menu", scenarioEnrollFromMenu},
+    {"users", scenarioUsers},
+    {"access-log", scenarioAccessLog},
+    {"capture-retry", scenarioCaptureRetry},
+};
+
+bool runScenarios() {
+    int broken = 0;
+    for (const Scenario &s : scenarios) {
+        checks_failed = 0;
+        failed = false;
+        printf("%-30s", s.name);
+        fflush(stdout);
+        s.run();
+        bool ok = checks_failed == 0 && !failed;
+        printf("%s\n", ok ? "ok" : "FAILED");
+        if (!ok) broken++;
+    }
+    printf("%d of %zu scenarios passed\n", (int)(sizeof(scenarios) / sizeof(scenarios[0])) - broken,
+           sizeof(scenarios) / sizeof(scenarios[0]));
+    return broken == 0;
+}
+
+// ---------------------------------------------------------------------------
+// Fuzzing
+// ---------------------------------------------------------------------------
+
+uint64_t rng_state;
+uint64_t fuzz_remaining;
+uint64_t fuzz_at;
+
+uint32_t rnd(uint32_t bound) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state % bound;
+}
+
+// Mostly quick typing and touches; sometimes the right PIN in one go, and
+// now and then a long pause that runs out a lockout or puts the lock to sleep
+bool fuzzRefill() {
+    if (fuzz_remaining == 0) {
+        schedule({Stimulus::END, fuzz_at + 5000 * MS, 0, 0, ""});
+        refill = nullptr;
+        return true;
+    }
+    fuzz_remaining--;
+    uint32_t gap = rnd(100) < 3 ? 1000 + rnd(40000) : 20 + rnd(600);
+    fuzz_at = (fuzz_at > sim::now() ? fuzz_at : sim::now()) + gap * MS;
+
+    uint32_t pick = rnd(100);
+    if (pick < 60) {
+        static const char alphabet[] = "0123456789*#";
+        schedule({Stimulus::KEY, fuzz_at, alphabet[rnd(12)], 0, ""});
+    } else if (pick < 70) {
+        Script s;
+        s.t = fuzz_at;
+        s.keys(oracle.pin.c_str(), 20 + rnd(200));
+        fuzz_at = s.t;
+    } else {
+        static const uint16_t pages[] = {1, 2, 3, 40, STRANGER, STRANGER + 1};
+        schedule({Stimulus::TOUCH, fuzz_at, 0, pages[rnd(6)], ""});
+    }
+    return true;
+}
+
+bool runFuzz(uint64_t count, uint64_t seed, bool twoFactor) {
+    boot({1, 2, 3, 40}, twoFactor);
+    failed = false;
+    rng_state = seed ? seed : 1;
+    fuzz_remaining = count;
+    fuzz_at = sim::now();
+    refill = fuzzRefill;
+
+    HostClock::time_point start = HostClock::now();
+    uint64_t simStart = sim::now();
+    drive();
+    double wall = hostNs(start) / 1e9;
+    double simulated = (sim::now() - simStart) / 1e6;
+
+    printf("fuzz: %llu stimuli, seed %llu, %s\n", (unsigned long long)stats.stimuli, (unsigned long long)seed,
+           twoFactor ? "two-factor" : "single-factor");
+    printf("  %.0f s simulated in %.2f s (%.0fx), %.0f stimuli/s\n", simulated, wall,
+           wall > 0 ? simulated / wall : 0, wall > 0 ? stats.stimuli / wall : 0);
+    printf("  %u unlocks, %u deep sleeps, %u display commands, %.1f LCD writes each\n", stats.unlocks,
+           stats.sleeps, stats.renders,
+           stats.renders ? (double)(lcd.writes - stats.lcdWritesAtStart) / stats.renders : 0.0);
+    printf("  cost per event, ns:     p50     p90     max    mean\n");
+    printf("    handle          %7lu %7lu %7lu %7lu\n", (unsigned long)stats.handle.percentile(50),
+           (unsigned long)stats.handle.percentile(90), (unsigned long)stats.handle.slowest(),
+           (unsigned long)stats.handle.mean());
+    printf("    render          %7lu %7lu %7lu %7lu\n", (unsigned long)stats.render.percentile(50),
+           (unsigned long)stats.render.percentile(90), (unsigned long)stats.render.slowest(),
+           (unsigned long)stats.render.mean());
+    printf("  (percentiles to a power of two)\n");
+    printf("%s\n", failed ? "invariants BROKEN" : "invariants held");
+    return !failed;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    const char *args[4] = {};
+    int n = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else if (n < 4) args[n++] = argv[i];
+    }
+
+    if (n == 0) {
+        bool ok = runScenarios();
+        ok = runFuzz(50000, 1, false) && ok;
+        ok = runFuzz(50000, 2, true) && ok;
+        return ok ? 0 : 1;
+    }
+    if (strcmp(args[0], "scenarios") == 0) return runScenarios() ? 0 : 1;
+    if (strcmp(args[0], "fuzz") == 0) {
+        uint64_t count = n > 1 ? strtoull(args[1], nullptr, 10) : 1000000;
+        uint64_t seed = n > 2 ? strtoull(args[2], nullptr, 10) : 1;
+        bool twoFactor = n > 3 && strcmp(args[3], "2fa") == 0;
+        return runFuzz(count, seed, twoFactor) ? 0 : 1;
+    }
+    fprintf(stderr, "usage: %s [scenarios | fuzz [events] [seed] [2fa]] [-v]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Back up or restore the lock's fingerprint templates over USB serial.
+
+    template_transfer.py PORT backup FILE [--first N] [--count N]
+    template_transfer.py PORT restore FILE
+
+FILE holds one record per template: id:u16, length:u16, bytes (little endian).
+Framing is described in include/TemplateTransfer.h. Needs pyserial.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+import serial
+
+BACKUP, FINISH, BEGIN, DATA, END, STATUS, DONE = 0x01, 0x02, 0x10, 0x11, 0x12, 0x20, 0x21
+MAX_DATA = 256
+
+
+def write_frame(port, ftype, payload=b""):
+    body = struct.pack("<BH", ftype, len(payload)) + payload
+    port.write(b"\xA5\x5A" + body + struct.pack("<I", zlib.crc32(body)))
+
+
+def read_frame(port):
+    """Next valid frame as (type, payload); skips log text between frames."""
+    while True:
+        matched = 0
+        while matched < 2:
+            c = port.read(1)
+            if not c:
+                raise TimeoutError("no frame from the lock")
+            matched = 2 if (matched == 1 and c == b"\x5A") else (1 if c == b"\xA5" else 0)
+        header = port.read(3)
+        if len(header) < 3:
+            continue
+        ftype, length = struct.unpack("<BH", header)
+        if length > MAX_DATA:
+            continue
+        payload = port.read(length)
+        trailer = port.read(4)
+        if len(payload) == length and len(trailer) == 4 and \
+                struct.unpack("<I", trailer)[0] == zlib.crc32(header + payload):
+            return ftype, payload
+
+
+def open_session(device):
+    port = serial.Serial(device, 115200, timeout=5)
+    port.reset_input_buffer()
+    port.write(b"transfer\n")
+    while b"TRANSFER READY" not in port.readline():
+        pass
+    return port
+
+
+def backup(port, path, first, count):
+    saved = 0
+    with open(path, "wb") as out:
+        write_frame(port, BACKUP, struct.pack("<HH", first, count))
+        template = None
+        while True:
+            ftype, payload = read_frame(port)
+            if ftype == BEGIN:
+                template = bytearray()
+            elif ftype == DATA and template is not None:
+                template += payload
+            elif ftype == END and template is not None:
+                (tid,) = struct.unpack("<H", payload[:2])
+                out.write(struct.pack("<HH", tid, len(template)) + template)
+                saved += 1
+                print(f"saved id {tid} ({len(template)} bytes)")
+                template = None
+            elif ftype == STATUS:
+                code, tid = struct.unpack("<BH", payload[:3])
+                print(f"id {tid}: error 0x{code:02x}", file=sys.stderr)
+                template = None
+            elif ftype == DONE:
+                break
+    return saved
+
+
+def restore(port, path):
+    stored = 0
+    with open(path, "rb") as src:
+        while True:
+            head = src.read(4)
+            if len(head) < 4:
+                break
+            tid, length = struct.unpack("<HH", head)
+            template = src.read(length)
+            for attempt in range(3):
+                write_frame(port, BEGIN, struct.pack("<H", tid))
+                for offset in range(0, len(template), 128):
+                    write_frame(port, DATA, template[offset:offset + 128])
+                write_frame(port, END, struct.pack("<H", tid))
+                ftype, payload = read_frame(port)
+                while ftype != STATUS:
+                    ftype, payload = read_frame(port)
+                code, reply_id = struct.unpack("<BH", payload[:3])
+                if code == 0 and reply_id == tid:
+                    stored += 1
+                    print(f"stored id {tid}")
+                    break
+                print(f"id {tid}: error 0x{code:02x}, attempt {attempt + 1}", file=sys.stderr)
+    return stored
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("action", choices=["backup", "restore"])
+    parser.add_argument("file")
+    parser.add_argument("--first", type=int, default=0)
+    parser.add_argument("--count", type=int, default=1000)
+    args = parser.parse_args()
+
+    port = open_session(args.port)
+    try:
+        if args.action == "backup":
+            moved = backup(port, args.file, args.first, args.count)
+        else:
+            moved = restore(port, args.file)
+    finally:
+        write_frame(port, FINISH)
+    print(f"{moved} templates {'saved' if args.action == 'backup' else 'stored'}")
+
+
+if __name__ == "__main__":
+    main()